@@ -2,7 +2,7 @@
 /* Updated pknowles, gl 2010 */
 
 #include <GL/glew.h>
-#include <GL/glut.h> /* for screen text only */
+#include <GL/glut.h> /* for the screen text's font only */
 
 #include <math.h>
 #include <string.h>
@@ -13,13 +13,28 @@
 #include "shaders.h"
 #include "sdl-base.h"
 #include "objects.h"
+#include "objects-simd.h"
+#include "mesh-builder.h"
+#include "geometry-cache.h"
+#include "scene-uniforms.h"
+#include "clustered-lights.h"
+#include "gbuffer.h"
+#include "gpu-culling.h"
+#include "text.h"
+#include "workers.h"
+#include "bench.h"
+#include "profiler.h"
+#include "timer.h"
 
 #define CAMERA_VELOCITY 0.005		 /* Units per millisecond */
 #define CAMERA_ANGULAR_VELOCITY 0.05	 /* Degrees per millisecond */
 #define CAMERA_MOUSE_X_VELOCITY 0.3	 /* Degrees per mouse unit */
 #define CAMERA_MOUSE_Y_VELOCITY 0.3	 /* Degrees per mouse unit */
 
-#define TEXT_HEIGHT 20
+#define MESH_BENCH_REPEATS 5 /* mesh builds per measurement, median is kept */
+#define ERROR_BENCH_CHECKS 100000 /* error checks timed for the average */
+#define SWEEP_BENCH_TESS 6 /* the objects the light and resolution sweeps draw */
+#define BENCH_INSTANCE_COUNTS 6 /* 1 to 100000 instances, by tens */
 
 #ifndef min
 #define min(a, b) ((a)>(b)?(b):(a))
@@ -39,6 +54,11 @@ static int mouse2_down;		/* Right mouse button Up/Down. Only zoom camera when do
 
 /* Object data */
 Object* object = NULL;
+static DynamicObject* dynamic = NULL; /* the animated wave without shaders */
+static MeshRequest wanted; /* the geometry the current state should show */
+static VertexFormat grid_format = VERTEX_FLOAT; /* for the shaders' grid */
+static VertexFormat mesh_format = VERTEX_FLOAT; /* for CPU generated meshes */
+static int attributeless = 0; /* shaders draw the grid from gl_VertexID */
 static int tessellation = 2; /* Tessellation level */
 const int min_tess = 2;
 const int max_tess = 10;
@@ -48,6 +68,12 @@ static char key_state[1024];
 
 /* The opengl handle to our shader */
 GLuint shader = 0;
+static const char* shader_header = NULL; /* defines it was built with */
+static int uniform_buffer = 0; /* the shaders read the Scene block, not GL state */
+static SceneUniforms scene;
+static float projection[16];
+static double shader_startup = 0.0; /* seconds init() spent getting it */
+static ShaderOrigin shader_origin;
 
 static struct {
 	GLuint object;
@@ -55,10 +81,23 @@ static struct {
 	GLuint isLocalViewer;
 	GLuint isPerPixelLighting;
 	GLuint time;
+	GLuint uvScale;
+	GLuint gridSize;
 } uniform;
 
+/* Programs specialised with #defines for each combination of the uniforms
+ * the shader above branches on, built the first time one is needed */
+typedef struct {
+	GLuint program;
+	int failed;
+	GLint time;
+	GLint uvScale;
+	GLint gridSize;
+	GLint viewport; /* for the tessellation control shader */
+} Permutation;
+
 /* Store render state variables.  Can be toggled with function keys. */
-static struct {
+typedef struct {
 	int wireframe;
 	int lighting;
 	int shaders;
@@ -70,13 +109,66 @@ static struct {
 	int shading;
 	int perPixel;
 	int animate;
-} renderstate;
+} RenderState;
+static RenderState renderstate;
 
 enum Object {
   TORUS, WAVE, OBJECT_MAX
 };
 
-char object_names[3][8] = { "Torus", "Sphere", "Wave" };
+char object_names[OBJECT_MAX][8] = { "Torus", "Wave" };
+
+/* By object, lighting model, local viewer, per pixel lighting, clustered
+ * point lights and instancing (see shader_instancing()) */
+static Permutation permutations[OBJECT_MAX][2][2][2][2][3];
+static int uber_shader = 0; /* branch on uniforms instead */
+
+/* Deferred shading: a geometry pass per object and instancing into the
+ * G-buffer, then a lighting pass by lighting model, local viewer and
+ * clustered point lights */
+static Permutation gbuffer_permutations[OBJECT_MAX][3];
+static Permutation lighting_permutations[2][2][2];
+static int deferred = 0;
+static int deferred_support = 0;
+
+/* Hardware tessellation: TESS_PATCHES by TESS_PATCHES patches subdivided
+ * by the GPU to suit their size on screen, built by object, lighting model,
+ * local viewer, per pixel lighting and clustered point lights */
+#define TESS_PATCHES 8
+static Permutation tessellated_permutations[OBJECT_MAX][2][2][2][2];
+static int hardware_tessellation = 0;
+
+/* Screen text, laid out again only when it changes. The OSD's string is
+ * only rebuilt after an event or when the frame rate (and so its stats)
+ * updates. */
+static TextLayout framerate_text, osd_text, log_text;
+static int osd_dirty = 1;
+static int osd_frame_rate = -1;
+static const char *osd_log = NULL;
+static int tessellation_support = 0;
+static GLuint primitives_query = 0;
+static int primitives_pending = 0;
+static GLuint tessellated_triangles = 0; /* drawn by the last finished query */
+
+/* Copies of the object drawn with one instanced draw call */
+#define MAX_INSTANCES 100000
+#define INSTANCE_SPACING 3.0 /* between neighbours on the grid */
+static int num_instances = 1;
+static int instancing_support = 0;
+static int separate_draws = 0; /* one draw per instance instead, to compare */
+static Instance *instances = NULL;
+static int laid_out = 0; /* instances filled in */
+static GLuint instance_buffer = 0;
+static float instance_materials[MAX_MATERIALS][4] = {
+	{1.0, 0.0, 0.0, 1.0}, {0.2, 0.4, 1.0, 1.0}, {0.2, 0.8, 0.2, 1.0}, {1.0, 0.8, 0.1, 1.0}};
+
+/* Or culled and given a level of detail on the GPU, drawn from a chain of
+ * the shaders' grid at every tessellation level. The shaders make the
+ * surface, so one chain serves both objects, only the bounds differ. */
+static int gpu_culling = 0;
+static int culling_support = 0;
+static LodChain *lod_chain = NULL;
+static const float object_radius[OBJECT_MAX] = {1.5, 1.43};
 
 /* Light and materials */
 static float light0_directional[] = {2.0, 2.0, 2.0, 0.0};
@@ -88,9 +180,54 @@ static float material_ambient[] = {0.5, 0.5, 0.5, 1.0};
 static float material_diffuse[] = {1.0, 0.0, 0.0, 1.0};
 static float material_specular[] = {1.0, 1.0, 1.0, 1.0};
 static float material_shininess = 64;
+static float light_model_ambient[] = {0.2, 0.2, 0.2, 1.0}; /* GL's defaults */
+static float light0_ambient[] = {0.0, 0.0, 0.0, 1.0};
+static float light0_colour[] = {1.0, 1.0, 1.0, 1.0};
+
+/* More lights for --lights N, in eye space like light 0 */
+static int num_lights = 1;
+static float extra_light_positions[MAX_LIGHTS - 1][4] = {
+	{-2.0, 1.0, 1.0, 0.0}, {0.0, -2.0, 1.0, 0.0}, {1.0, 0.5, -2.0, 0.0}};
+static float extra_light_colours[MAX_LIGHTS - 1][4] = {
+	{0.2, 0.3, 0.8, 1.0}, {0.2, 0.7, 0.3, 1.0}, {0.7, 0.6, 0.2, 1.0}};
+
+/* Point lights drifting around the objects, shaded in clusters */
+static int clustered = 0;
+static int cluster_support = 0;
+static int num_point_lights = 64;
+static PointLight point_lights[MAX_POINT_LIGHTS];
+static struct {
+	float origin[3];
+	float phase;
+	float speed;
+	float colour[3];
+} point_light_paths[MAX_POINT_LIGHTS];
+static double lights_time_s;
+static int viewport_width, viewport_height;
 
 //time
-static double time_s;
+static double time_s; /* shown, between the update() steps below */
+static long time_ms, last_time_ms; /* the wave's, after and before the last step */
+static long lights_time_ms, last_lights_time_ms;
+
+/* What display() shows. event(), update() and interpolate() change the
+ * main thread's copy, sim, without touching GL; the render thread gets a
+ * snapshot() of it each frame and apply_snapshot() copies it into the
+ * globals above, doing the GL work the changes need. */
+typedef struct {
+	RenderState renderstate;
+	float camera_zoom, camera_heading, camera_pitch;
+	int tessellation;
+	float material_shininess;
+	int deferred, clustered, num_point_lights;
+	int num_instances, hardware_tessellation, gpu_culling, uber_shader;
+	double time_s, lights_time_s;
+	int osd_version; /* bumped by key presses, for the OSD to refresh */
+} FrameState;
+static FrameState sim;
+static int osd_version = 0; /* of the last snapshot applied */
+static int applied_hardware_tessellation; /* display() may turn it off */
+const size_t snapshot_size = sizeof(FrameState);
 
 void update_renderstate()
 {
@@ -116,55 +253,277 @@ void update_renderstate()
 
 void regenerate_geometry()
 {
+	MeshRequest request;
+	Object* cached;
 	int subdivs;
 	subdivs = 1 << (tessellation);
 
-	/* Free previous object */
-	if (object) freeObject(object);
+	PROFILE_BEGIN("regenerate geometry");
+
+	/* The animated wave streams into its own buffers instead, update()
+	 * creates them again at the new size */
+	if (dynamic) {
+		freeDynamicObject(dynamic);
+		dynamic = NULL;
+	}
+	if (renderstate.animate && !renderstate.shaders && renderstate.object == WAVE) {
+		PROFILE_END();
+		return;
+	}
+
+	/* Nothing to build, display() draws the grid size from uniforms */
+	if (renderstate.shaders && attributeless) {
+		PROFILE_END();
+		return;
+	}
 
-	//printf("Generating %ix%i... ", subdivs, subdivs);
-	fflush(stdout);
+	memset(&request, 0, sizeof(request));
+	request.x = subdivs + 1;
+	request.y = subdivs + 1;
 
 	if (renderstate.shaders) {
-		object = createObject(parametricGrid, subdivs + 1, subdivs + 1);
+		request.batch = batchGrid;
+		request.format = grid_format;
 	} else {
+		request.format = mesh_format;
 		switch (renderstate.object) {
 			case TORUS:
-				object = createObject(parametricTorus, subdivs + 1, subdivs + 1, 1.0, 0.5);
+				request.batch = batchTorus;
+				request.args.torus.R = 1.0;
+				request.args.torus.r = 0.5;
 				break;
 			default:
 				assert(renderstate.object == WAVE);
-				object = createObject(parametricWave, subdivs + 1, subdivs + 1, 2.0, 2.0, time_s);
+				request.batch = batchWave;
+				request.args.wave.width = 2.0;
+				request.args.wave.height = 2.0;
+				request.args.wave.time = time_s;
 		}
 	}
 
-	//printf("done.\n");
-	fflush(stdout);
+	wanted = request;
+
+	/* Revisiting a state is just a pointer swap */
+	if ((cached = findGeometry(&request))) {
+		object = cached;
+		PROFILE_END();
+		return;
+	}
+
+	/* Built in the background, update() swaps it in when it is ready */
+	requestMesh(&request);
+	PROFILE_END();
+}
+
+/* Caches a newly built object, and displays it if the state still wants it */
+void swap_geometry(Object *ready, const MeshRequest *request)
+{
+	if (!ready)
+		return;
+	cacheGeometry(request, ready);
+	if (sameMeshRequest(request, &wanted))
+		object = ready;
+	trimGeometryCache(object);
+}
+
+/* Uniform locations, again whenever the shaders are reloaded */
+static void get_uniforms()
+{
+	uniform.object = glGetUniformLocation(shader, "object");
+	uniform.lightingModel = glGetUniformLocation(shader, "lightingModel");
+	uniform.isLocalViewer = glGetUniformLocation(shader, "isLocalViewer");
+	uniform.isPerPixelLighting = glGetUniformLocation(shader, "isPerPixelLighting");
+	uniform.time = glGetUniformLocation(shader, "time");
+	uniform.uvScale = glGetUniformLocation(shader, "uvScale");
+	uniform.gridSize = glGetUniformLocation(shader, "gridSize");
+	if (uniform_buffer)
+		bindSceneUniforms(shader);
+
+	/* Looked up again when next used */
+	memset(permutations, 0, sizeof(permutations));
+	memset(gbuffer_permutations, 0, sizeof(gbuffer_permutations));
+	memset(lighting_permutations, 0, sizeof(lighting_permutations));
+	memset(tessellated_permutations, 0, sizeof(tessellated_permutations));
+}
+
+/* Scatters the point lights, the same every run so benchmarks compare */
+static void init_point_lights()
+{
+	unsigned int seed = 12345;
+	int i, j;
+
+	for (i = 0; i < MAX_POINT_LIGHTS; ++i)
+	{
+		float r[8];
+		for (j = 0; j < 8; ++j)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			r[j] = (seed >> 8) / (float)(1 << 24);
+		}
+		point_light_paths[i].origin[0] = r[0] * 4.0 - 2.0;
+		point_light_paths[i].origin[1] = r[1] * 4.0 - 2.0;
+		point_light_paths[i].origin[2] = r[2] * 1.1 - 0.3;
+		point_light_paths[i].phase = r[3] * 6.2831853;
+		point_light_paths[i].speed = 0.5 + r[4];
+		point_lights[i].radius = 0.6;
+		for (j = 0; j < 3; ++j)
+			point_light_paths[i].colour[j] = 0.2 + 0.8 * r[5 + j];
+	}
+}
+
+/* Moves the first count lights round their circles, dimmer the more there
+ * are so the scene doesn't wash out */
+static void move_point_lights(int count)
+{
+	float brightness = min(1.0, 4.0 / sqrt(count));
+	int i, j;
+
+	for (i = 0; i < count; ++i)
+	{
+		float a = point_light_paths[i].phase + lights_time_s * point_light_paths[i].speed;
+		point_lights[i].position[0] = point_light_paths[i].origin[0] + 0.25 * cos(a);
+		point_lights[i].position[1] = point_light_paths[i].origin[1] + 0.25 * sin(a);
+		point_lights[i].position[2] = point_light_paths[i].origin[2];
+		for (j = 0; j < 3; ++j)
+			point_lights[i].colour[j] = brightness * point_light_paths[i].colour[j];
+	}
+}
+
+/* The render thread's state, for sim to start from */
+static void capture_frame(FrameState *frame)
+{
+	frame->renderstate = renderstate;
+	frame->camera_zoom = camera_zoom;
+	frame->camera_heading = camera_heading;
+	frame->camera_pitch = camera_pitch;
+	frame->tessellation = tessellation;
+	frame->material_shininess = material_shininess;
+	frame->deferred = deferred;
+	frame->clustered = clustered;
+	frame->num_point_lights = num_point_lights;
+	frame->num_instances = num_instances;
+	frame->hardware_tessellation = applied_hardware_tessellation = hardware_tessellation;
+	frame->gpu_culling = gpu_culling;
+	frame->uber_shader = uber_shader;
+	frame->time_s = time_s;
+	frame->lights_time_s = lights_time_s;
+	frame->osd_version = osd_version;
 }
 
 void init()
 {
+	MeshRequest built;
+	int i;
+#ifndef HEADLESS
 	int argc = 0;
 	char** argv = NULL;
 	glutInit(&argc, argv); /* NOTE: this hack will not work on windows */
+#endif
 	glewInit();
 
-	/* Load the shader */
-	shader = getShader("mesh-generation.vert", "shader.frag");
+#ifndef NDEBUG
+	/* GL errors go to a callback instead of a glGetError() round trip at
+	 * every CHECKERROR, unless asked to poll or the driver can't */
+	{
+		const int poll = options.gl_debug && !strcmp(options.gl_debug, "poll");
+		const int sync = options.gl_debug && !strcmp(options.gl_debug, "sync");
+		printf("GL errors: %s\n", !poll && enableDebugOutput(sync) ?
+			(sync ? "debug callback, synchronous" : "debug callback") :
+			"glGetError() at every check");
+	}
+#endif
 
-	uniform.object = glGetUniformLocation(shader, "object");
-	uniform.lightingModel = glGetUniformLocation(shader, "lightingModel");
-	uniform.isLocalViewer = glGetUniformLocation(shader, "isLocalViewer");
-	uniform.isPerPixelLighting = glGetUniformLocation(shader, "isPerPixelLighting");
-	uniform.time = glGetUniformLocation(shader, "time");
+	setGeometryCacheBudget((size_t)options.cache_mb << 20);
+
+	/* Mesh generation kernels */
+	if (options.simd)
+	{
+		SimdLevel level;
+		for (level = SIMD_SCALAR; level < SIMD_MAX; ++level)
+			if (!strcmp(options.simd, simdLevelName(level)))
+				setSimdLevel(level);
+	}
+	setWorkerThreads(options.threads);
+	printf("Mesh generation: %s, %d threads\n", simdLevelName(simdLevel()), workerThreads());
+
+	/* Load the shader, generating the grid from gl_VertexID if GLSL 1.30
+	 * is there and we aren't asked to use a VBO. Camera, lights and
+	 * material come from a uniform buffer if there are those too. */
+	shader_startup = getTime();
+	uniform_buffer = GLEW_VERSION_3_0 && sceneUniformsSupported();
+	if (GLEW_VERSION_3_0 && !(options.shader_grid && !strcmp(options.shader_grid, "vbo")))
+	{
+		shader_header = uniform_buffer ?
+			"#version 130\n#define ATTRIBUTELESS\n#define UNIFORM_BUFFER\n" :
+			"#version 130\n#define ATTRIBUTELESS\n";
+		shader = getShaderWithHeader("mesh-generation.vert", "shader.frag", shader_header);
+		attributeless = shader != 0;
+	}
+	if (!attributeless)
+	{
+		shader_header = uniform_buffer ? "#version 130\n#define UNIFORM_BUFFER\n" : NULL;
+		shader = getShaderWithHeader("mesh-generation.vert", "shader.frag", shader_header);
+	}
+	if (!shader && uniform_buffer)
+	{
+		uniform_buffer = 0;
+		shader_header = NULL;
+		shader = getShader("mesh-generation.vert", "shader.frag");
+	}
+	shader_origin = lastShaderOrigin();
+	shader_startup = getTime() - shader_startup;
+	printf("Shader grid: %s, %s\n", attributeless ? "gl_VertexID" : "VBO",
+			uniform_buffer ? "uniform buffer" : "fixed function state");
+	printf("Shader startup: %.1fms (%s)\n", shader_startup * 1000.0, shaderOriginName(shader_origin));
+	uber_shader = options.uber_shader;
+	cluster_support = uniform_buffer && clusteredLightsSupported();
+	deferred_support = uniform_buffer && gbufferSupported();
+	instancing_support = uniform_buffer && instancingSupported();
+	culling_support = instancing_support && gpuCullingSupported();
+	tessellation_support = uniform_buffer && GLEW_VERSION_4_0;
+
+	get_uniforms();
+	init_point_lights();
+
+	/* Compact vertex layouts unless asked not to */
+	if (!options.vertex_format || strcmp(options.vertex_format, "float"))
+	{
+		grid_format = VERTEX_UV16;
+		if (vertexFormatSupported(VERTEX_HALF))
+			mesh_format = VERTEX_HALF;
+	}
+	printf("Vertex formats: %s grid, %s meshes\n",
+			vertexFormatName(grid_format), vertexFormatName(mesh_format));
+
+	/* Triangle order of the meshes' index buffers */
+	if (options.index_order)
+	{
+		IndexOrder order;
+		for (order = INDEX_STRIPS; order < INDEX_ORDER_MAX; ++order)
+			if (!strcmp(options.index_order, indexOrderName(order)))
+				setIndexOrder(order);
+	}
+	printf("Index order: %s\n", indexOrderName(getIndexOrder()));
 
 	/* Lighting and colours */
 	glClearColor(0, 0, 0, 0);
 	glShadeModel(GL_SMOOTH);
 	glEnable(GL_DEPTH_TEST);
 
-	
+	/* The screen text's glyphs, drawn with glut once */
+#ifndef HEADLESS
+	if (!initText())
+		printf("No room for the text atlas, no screen text\n");
+#endif
+
 	glEnable(GL_LIGHT0);
+	num_lights = clamp(options.lights, 1, MAX_LIGHTS);
+	for (i = 1; i < num_lights; ++i)
+	{
+		glEnable(GL_LIGHT0 + i);
+		glLightfv(GL_LIGHT0 + i, GL_DIFFUSE, extra_light_colours[i - 1]);
+		glLightfv(GL_LIGHT0 + i, GL_SPECULAR, extra_light_colours[i - 1]);
+	}
 
 	//glLightfv(GL_LIGHT0, GL_AMBIENT, light0_ambient);
 	//glLightfv(GL_LIGHT0, GL_DIFFUSE, light0_diffuse);
@@ -198,74 +557,91 @@ void init()
 	update_renderstate();
 
 	regenerate_geometry();
+	swap_geometry(finishMesh(&built), &built);
+	capture_frame(&sim);
 }
 
 void reshape(int width, int height)
 {
 	glViewport(0, 0, width, height);
+	viewport_width = width;
+	viewport_height = height;
 
 	/* Reset the projection matrix */
 	glMatrixMode(GL_PROJECTION);
 	glLoadIdentity();
 	gluPerspective(60.0, width / (double) height, 0.1, 100.0);
 	glMatrixMode(GL_MODELVIEW);
+
+	/* The same again for the shaders */
+	loadIdentity(projection);
+	perspective(projection, 60.0, width / (float) height, 0.1, 100.0);
 }
 
-void draw_text(SDL_Surface *surface, char *text, int x, int y)
+/* Draws text with its top left at x, y. Nothing is drawn without an
+ * atlas, e.g. in the headless build, which has no glut. */
+void draw_text(SDL_Surface *surface, TextLayout *layout, const char *text, int x, int y)
 {
-  char *textPtr;
-	/* Write framerate to a string */
-  int lineCount = 1;
-
-	glPushAttrib(GL_ENABLE_BIT);
-	glDisable(GL_DEPTH_TEST);
-	glDisable(GL_LIGHTING);
-
-	/* Apply an orthographic projection temporarily */
-	glMatrixMode(GL_PROJECTION);
-	glPushMatrix();
-	glLoadIdentity();
-	glOrtho(0, surface->w, 0, surface->h, -1, 1);
-
-	glMatrixMode(GL_MODELVIEW);
-	glPushMatrix();
-	glLoadIdentity();
-
-	/* Draw the string */
-	glRasterPos2i(x, surface->h - y - TEXT_HEIGHT);
-	for (textPtr = text; *textPtr; textPtr++) {
-		if (*textPtr == '\n') {
-			lineCount++;
-			glRasterPos2i(x, surface->h - y - (lineCount * TEXT_HEIGHT));
-		} else {
-			glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *textPtr);
-		}
-	}
-
-	glPopMatrix();	/* Pop modelview */
-	glMatrixMode(GL_PROJECTION);
-
-	glPopMatrix();	/* Pop projection */
-	glMatrixMode(GL_MODELVIEW);
-
-	glPopAttrib();
+	setText(layout, text, x, y, surface->w, surface->h);
+	drawText(layout);
 }
 
 void draw_framerate(SDL_Surface *surface)
 {
 	char buffer[32];
 	snprintf(buffer, sizeof buffer, "FR: %d\n", frame_rate);
-	draw_text(surface, buffer, 0, 0);
+	draw_text(surface, &framerate_text, buffer, 0, 0);
+}
+
+/* How the shaders draw the object: 0 just the one, 1 num_instances copies
+ * from the instance buffer, 2 the copies the GPU culls from it at their own
+ * level of detail */
+static int shader_instancing()
+{
+	if (!renderstate.shaders || !instancing_support)
+		return 0;
+	if (gpu_culling && culling_support && !separate_draws)
+		return 2;
+	return num_instances > 1;
+}
+
+/* Whether the shaders subdivide patches on the GPU. Instances and the
+ * G-buffer draw the grid as before. */
+static int tessellated()
+{
+	return renderstate.shaders && hardware_tessellation && tessellation_support &&
+		!shader_instancing() && !(deferred && deferred_support && renderstate.perPixel);
 }
 
 void draw_osd(SDL_Surface *surface)
 {
-	char buffer[1024];
+	static char buffer[1024 + 4096];
+	GeometryCacheStats cache;
+	ClusterStats clusters;
+	CullingStats culling;
+	VertexCacheStats vertex_cache;
+	const char *log = shaderReloadLog();
+	int i;
+
+	if (!osd_dirty && frame_rate == osd_frame_rate && log == osd_log)
+	{
+		draw_text(surface, &osd_text, buffer, 0, 30);
+		return;
+	}
+	osd_dirty = 0;
+	osd_frame_rate = frame_rate;
+	osd_log = log;
+
+	geometryCacheStats(&cache);
 	snprintf(buffer, sizeof buffer,
 			"[a]   - wave animation: %s\n" //toggle wave animation
+			"[d]   - deferred shading: %s\n" //G-buffer/forward, per pixel only
 			"[f]   - shading: %s\n" //smooth/flat
 			"[g]   - model: %s\n" //torus, wave
 			"[H/h] - shininess: %d\n" //increase/decrease
+			"[I/i] - instances: %d, %s\n" //more/fewer
+			"[z]   - GPU culling and LOD: %s\n"
+			"[e]   - hardware tessellation: %s\n"
 			"[l]   - lighting: %s\n" //toggle
 			"[m]   - specular mode: %s\n" //Blinn-Phong or Phong
 			"[n]   - normals: %s\n" //enabled/disabled
@@ -273,13 +649,25 @@ void draw_osd(SDL_Surface *surface)
 			"[p]   - per pixel lighting: %s\n" //per vertex/per pixel
 			"[s]   - shaders: %s\n"
 			"[T/t] - tessellation: %d\n" //increase/decrease
+			"[u]   - uber-shader: %s\n" //uniform branches/permutations
 			"[v]   - local viewer: %s\n"
 			"[w]   - wireframe: %s\n" //enabled/disabled
-			"[k]   - light type: %s\n", //directional/point
+			"[k]   - light type: %s\n" //directional/point
+			"[c]   - clustered point lights: %s\n"
+			"[[/]] - point lights: %d\n" //halve/double
+			"geometry cache: %d objects, %.1f of %.0f MB, "
+			"%d hits, %d misses, %d evictions\n"
+			"lights: %d, scene uniforms: %s, %d uploads\n",
 			renderstate.animate ? "enabled" : "disabled", // shaders, // wave animation
+			!deferred_support ? "unsupported" : deferred ? "enabled" : "disabled",
 			renderstate.shading ? "Smooth" : "Flat",   // shading
 			object_names[renderstate.object],   // model
 			(int) material_shininess,          // shininess
+			num_instances, num_instances == 1 ? "one object" :
+				!renderstate.shaders ? "one draw each" :
+				!instancing_support ? "instancing unsupported" : "one instanced draw",
+			!culling_support ? "unsupported" : gpu_culling ? "enabled" : "disabled",
+			!tessellation_support ? "unsupported" : hardware_tessellation ? "enabled" : "disabled",
 			renderstate.lighting ? "enabled" : "disabled",
 			renderstate.specularMode ? "Phong" : "Blinn-Phong",
 			"todo", // normals
@@ -288,15 +676,398 @@ void draw_osd(SDL_Surface *surface)
 			/* shaders */
 			renderstate.shaders ? "enabled" : "disabled", // shaders
 			tessellation,
+			uber_shader ? "enabled" : "disabled",
 			renderstate.lightModel ? "enabled" : "disabled", // local viewer
 			/* wireframe */
 			renderstate.wireframe ? "enabled" : "disabled",
-			renderstate.lightType ? "directional" : "point"); // lighting mode
-	draw_text(surface, buffer, 0, 30);
+			renderstate.lightType ? "directional" : "point", // lighting mode
+			!cluster_support ? "unsupported" : clustered ? "enabled" : "disabled",
+			num_point_lights,
+			cache.count, cache.bytes / 1048576.0, cache.budget / 1048576.0,
+			cache.hits, cache.misses, cache.evictions,
+			num_lights, uniform_buffer ? "buffer" : "fixed function", sceneUniformUploads());
+	if (clustered && cluster_support && renderstate.shaders)
+	{
+		clusteredLightStats(&clusters);
+		snprintf(buffer + strlen(buffer), sizeof buffer - strlen(buffer),
+				"clusters: %d lights in view, %d references, %d most in one, %.2fms binning\n",
+				clusters.lights, clusters.indices, clusters.maxPerCluster, clusters.binMs);
+	}
+	if (deferred && deferred_support && renderstate.shaders && renderstate.perPixel)
+		snprintf(buffer + strlen(buffer), sizeof buffer - strlen(buffer),
+				"G-buffer: %dx%d, %.1f MB\n", viewport_width, viewport_height,
+				gbufferBytes() / 1048576.0);
+	if (dynamic || (object && !(renderstate.shaders && attributeless)))
+	{
+		objectCacheStats(dynamic ? &dynamic->object : object, &vertex_cache);
+		snprintf(buffer + strlen(buffer), sizeof buffer - strlen(buffer),
+				"index order: %s, ACMR %.2f, ATVR %.2f\n", indexOrderName(getIndexOrder()),
+				vertex_cache.acmr, vertex_cache.atvr);
+	}
+	if (tessellated())
+		snprintf(buffer + strlen(buffer), sizeof buffer - strlen(buffer),
+				"tessellation: %d patches, %u triangles\n", TESS_PATCHES * TESS_PATCHES,
+				tessellated_triangles);
+	if (shader_instancing() == 2 && !options.bench)
+	{
+		gpuCullingStats(&culling);
+		snprintf(buffer + strlen(buffer), sizeof buffer - strlen(buffer),
+				"culling: %d of %d visible, by tessellation", culling.visible, culling.instances);
+		for (i = 0; i < lod_chain->levels; ++i)
+			snprintf(buffer + strlen(buffer), sizeof buffer - strlen(buffer),
+					" %d:%d", lod_chain->minTess + i, culling.perLevel[i]);
+		snprintf(buffer + strlen(buffer), sizeof buffer - strlen(buffer),
+				", %.1f MB\n", gpuCullingBytes() / 1048576.0);
+	}
+#ifndef NDEBUG
+	if (!options.bench)
+	{
+		snprintf(buffer + strlen(buffer), sizeof buffer - strlen(buffer), "profile, cpu/gpu ms:\n");
+		profileSummary(buffer + strlen(buffer), sizeof buffer - strlen(buffer));
+		snprintf(buffer + strlen(buffer), sizeof buffer - strlen(buffer), "\n");
+	}
+#endif
+	if (!options.bench && input_latency > 0.0f)
+		snprintf(buffer + strlen(buffer), sizeof buffer - strlen(buffer),
+				"input to present: %.1f ms median\n", input_latency);
+	if (log)
+		snprintf(buffer + strlen(buffer), sizeof buffer - strlen(buffer),
+				"shader reload failed, still using the old program:\n%s", log);
+	draw_text(surface, &osd_text, buffer, 0, 30);
+}
+
+/* Builds p from vert and shader.frag with the shader header plus defines.
+ * Programs reading the clustered lights' buffers need GLSL 1.40, which
+ * cluster_support means the header asks for 1.30 of. Tessellated ones are
+ * built with vert as the evaluation shader too and need GLSL 4.00. */
+static void build_permutation(Permutation *p, const char *vert, const char *defines,
+		int clustered, int tessellated)
+{
+	const char *base = shader_header ? shader_header : "";
+	const char *version = tessellated ? "#version 400 compatibility\n" :
+			clustered ? "#version 140\n" : "";
+	char header[256];
+
+	if (*version)
+		base = strchr(base, '\n') + 1;
+	snprintf(header, sizeof header, "%s%s%s%s", version,
+			base, defines, clustered ? "#define CLUSTERED\n" : "");
+	if (tessellated)
+		p->program = getTessellationShader(vert, "mesh-generation.tesc", vert, "shader.frag",
+				header);
+	else
+		p->program = getShaderWithHeader(vert, "shader.frag", header);
+	p->failed = !p->program;
+	p->time = glGetUniformLocation(p->program, "time");
+	p->uvScale = glGetUniformLocation(p->program, "uvScale");
+	p->gridSize = glGetUniformLocation(p->program, "gridSize");
+	p->viewport = glGetUniformLocation(p->program, "viewport");
+	if (uniform_buffer && p->program)
+		bindSceneUniforms(p->program);
+	if (clustered && p->program)
+		bindClusteredLights(p->program);
+}
+
+/* The state as #defines for the shaders */
+static void permutation_defines(char *defines, int size, int obj, int lighting_model,
+		int local_viewer, int per_pixel, int instanced)
+{
+	snprintf(defines, size,
+			"#define PERMUTATION\n#define OBJECT %d\n#define LIGHTING_MODEL %d\n"
+			"#define LOCAL_VIEWER %s\n#define PER_PIXEL %s\n%s",
+			obj, lighting_model, local_viewer ? "true" : "false", per_pixel ? "true" : "false",
+			instanced == 2 ? "#define INSTANCED\n#define INDIRECT_LODS\n" :
+			instanced ? "#define INSTANCED\n" : "");
+}
+
+/* The program specialised for a state, or NULL if it doesn't compile */
+static Permutation *get_permutation(int obj, int lighting_model, int local_viewer, int per_pixel,
+		int clustered, int instanced)
+{
+	Permutation *p = &permutations[obj][lighting_model][local_viewer][per_pixel][clustered][instanced];
+	char defines[192];
+
+	if (!p->program && !p->failed)
+	{
+		permutation_defines(defines, sizeof defines, obj, lighting_model, local_viewer, per_pixel,
+				instanced);
+		build_permutation(p, "mesh-generation.vert", defines, clustered, 0);
+	}
+	return p->failed ? NULL : p;
+}
+
+/* The state's program subdividing patches with hardware tessellation */
+static Permutation *get_tessellated_permutation(int obj, int lighting_model, int local_viewer,
+		int per_pixel, int clustered)
+{
+	Permutation *p = &tessellated_permutations[obj][lighting_model][local_viewer][per_pixel][clustered];
+	char defines[192];
+
+	if (!p->program && !p->failed)
+	{
+		permutation_defines(defines, sizeof defines, obj, lighting_model, local_viewer, per_pixel, 0);
+		strcat(defines, "#define TESSELLATION\n");
+		build_permutation(p, "mesh-generation.vert", defines, clustered, 1);
+	}
+	return p->failed ? NULL : p;
+}
+
+/* The deferred geometry pass for an object, writing the G-buffer */
+static Permutation *get_gbuffer_permutation(int obj, int instanced)
+{
+	Permutation *p = &gbuffer_permutations[obj][instanced];
+	char defines[192];
+
+	if (!p->program && !p->failed)
+	{
+		permutation_defines(defines, sizeof defines, obj, 0, 0, 1, instanced);
+		strcat(defines, "#define GBUFFER\n");
+		build_permutation(p, "mesh-generation.vert", defines, 0, 0);
+	}
+	return p->failed ? NULL : p;
+}
+
+/* The deferred lighting pass, a fullscreen triangle shading the G-buffer */
+static Permutation *get_lighting_permutation(int lighting_model, int local_viewer, int clustered)
+{
+	Permutation *p = &lighting_permutations[lighting_model][local_viewer][clustered];
+	char defines[192];
+
+	if (!p->program && !p->failed)
+	{
+		permutation_defines(defines, sizeof defines, 0, lighting_model, local_viewer, 1, 0);
+		strcat(defines, "#define DEFERRED_LIGHTING\n");
+		build_permutation(p, "fullscreen.vert", defines, clustered, 0);
+		if (p->program)
+			bindGBufferSamplers(p->program);
+	}
+	return p->failed ? NULL : p;
+}
+
+/* Builds every permutation up front rather than on first use */
+static void build_permutations()
+{
+	int o, m, v, p, c, i;
+	for (o = 0; o < OBJECT_MAX; ++o)
+		for (m = 0; m < 2; ++m)
+			for (v = 0; v < 2; ++v)
+				for (p = 0; p < 2; ++p)
+					for (c = 0; c <= cluster_support; ++c)
+					{
+						for (i = 0; i <= instancing_support + culling_support; ++i)
+							get_permutation(o, m, v, p, c, i);
+						if (tessellation_support)
+							get_tessellated_permutation(o, m, v, p, c);
+					}
+	if (!deferred_support)
+		return;
+	for (o = 0; o < OBJECT_MAX; ++o)
+		for (i = 0; i <= instancing_support + culling_support; ++i)
+			get_gbuffer_permutation(o, i);
+	for (m = 0; m < 2; ++m)
+		for (v = 0; v < 2; ++v)
+			for (c = 0; c <= cluster_support; ++c)
+				get_lighting_permutation(m, v, c);
+}
+
+/* Fills in the shaders' Scene block, which is only uploaded if it changed */
+static void update_scene()
+{
+	int i;
+
+	loadIdentity(scene.modelView);
+	translate(scene.modelView, 0, 0, -camera_zoom);
+	rotate(scene.modelView, -camera_pitch, 1, 0, 0);
+	rotate(scene.modelView, -camera_heading, 0, 1, 0);
+	memcpy(scene.projection, projection, sizeof(projection));
+
+	memcpy(scene.sceneAmbient, light_model_ambient, sizeof(scene.sceneAmbient));
+	memcpy(scene.materialAmbient, material_ambient, sizeof(scene.materialAmbient));
+	memcpy(scene.materialDiffuse, material_diffuse, sizeof(scene.materialDiffuse));
+	memcpy(scene.materialSpecular, material_specular, sizeof(scene.materialSpecular));
+	memcpy(scene.materials, instance_materials, sizeof(scene.materials));
+	scene.materialShininess = material_shininess;
+
+	scene.numLights = num_lights;
+	for (i = 0; i < num_lights; ++i)
+	{
+		SceneLight *light = &scene.lights[i];
+		const float *colour = i ? extra_light_colours[i - 1] : light0_colour;
+		if (i)
+			memcpy(light->position, extra_light_positions[i - 1], sizeof(light->position));
+		else
+			memcpy(light->position, renderstate.lightType ? light0_directional : light0_point,
+					sizeof(light->position));
+		memcpy(light->ambient, light0_ambient, sizeof(light->ambient));
+		memcpy(light->diffuse, colour, sizeof(light->diffuse));
+		memcpy(light->specular, colour, sizeof(light->specular));
+	}
+
+	scene.time = time_s;
+	if (shader_instancing() == 2)
+		scene.uvScale = grid_format == VERTEX_UV16 ? 1.0 / 32767.0 : 1.0;
+	else
+		scene.uvScale = object && object->format == VERTEX_UV16 ? 1.0 / 32767.0 : 1.0;
+	scene.gridSize[0] = scene.gridSize[1] = tessellated() ? TESS_PATCHES + 1 : (1 << tessellation) + 1;
+
+	if (clustered && cluster_support)
+	{
+		move_point_lights(num_point_lights);
+		updateClusteredLights(point_lights, num_point_lights, viewport_width, viewport_height,
+				0.1, 100.0, &scene);
+	}
+	updateSceneUniforms(&scene);
+}
+
+static void draw_object()
+{
+	if (tessellated())
+		drawPatches(TESS_PATCHES + 1, TESS_PATCHES + 1);
+	else if (renderstate.shaders && attributeless)
+		drawGrid((1 << tessellation) + 1, (1 << tessellation) + 1);
+	else if (dynamic)
+		drawObject(&dynamic->object);
+	else if (object)
+		drawObject(object);
+	//drawNormals(object);
+}
+
+/* Lays the copies out on a square grid around the origin, turned, coloured
+ * and animating differently. The first is the object as it is drawn alone. */
+static void layout_instances()
+{
+	int side = (int)ceil(sqrt(num_instances));
+	int i;
+
+	if (!instances)
+		instances = (Instance*)malloc(sizeof(Instance) * MAX_INSTANCES);
+	for (i = 0; i < num_instances; ++i)
+	{
+		Instance *instance = &instances[i];
+		loadIdentity(instance->model);
+		translate(instance->model, (i % side - (side - 1) * 0.5) * INSTANCE_SPACING,
+				(i / side - (side - 1) * 0.5) * INSTANCE_SPACING, 0.0);
+		rotate(instance->model, (i * 37) % 360, 0, 1, 0);
+		instance->material = i % MAX_MATERIALS;
+		instance->phase = i * 0.37;
+	}
+	if (instancing_support)
+		instance_buffer = uploadInstances(instance_buffer, instances, num_instances);
+	laid_out = num_instances;
+}
+
+/* Leaves only the visible copies, each at its level of detail, for
+ * draw_scene() to draw. Before any program is bound, as it uses its own. */
+static void cull_instances()
+{
+	if (laid_out != num_instances)
+		layout_instances();
+	if (!lod_chain)
+		lod_chain = createLodChain(batchGrid, NULL, min_tess, max_tess, grid_format);
+	cullInstances(lod_chain, instance_buffer, num_instances, object_radius[renderstate.object],
+			scene.modelView, scene.projection, viewport_height);
+}
+
+static void draw_scene()
+{
+	int i;
+
+	if (num_instances > 1 && laid_out != num_instances)
+		layout_instances();
+
+	if (num_instances > 1 && !renderstate.shaders)
+	{
+		/* No instance attributes without shaders, one draw each */
+		for (i = 0; i < num_instances; ++i)
+		{
+			glPushMatrix();
+			glMultMatrixf(instances[i].model);
+			glMaterialfv(GL_FRONT, GL_DIFFUSE, instance_materials[i % MAX_MATERIALS]);
+			draw_object();
+			glPopMatrix();
+		}
+		glMaterialfv(GL_FRONT, GL_DIFFUSE, material_diffuse);
+	}
+	else if (shader_instancing() == 2)
+		drawCulledInstances(lod_chain);
+	else if (shader_instancing() && separate_draws)
+	{
+		for (i = 0; i < num_instances; ++i)
+		{
+			setInstance(&instances[i]);
+			draw_object();
+		}
+	}
+	else if (shader_instancing() && attributeless)
+		drawGridInstanced((1 << tessellation) + 1, (1 << tessellation) + 1,
+				instance_buffer, num_instances);
+	else if (shader_instancing() && object)
+		drawObjectInstanced(object, instance_buffer, num_instances);
+	else
+		draw_object();
+}
+
+/* Draws the patches, counting the triangles they become. A new count
+ * starts once the last one is in, so nothing waits for it. */
+static void draw_tessellated()
+{
+	GLint available = 0;
+
+	if (!primitives_query)
+		glGenQueries(1, &primitives_query);
+	if (primitives_pending)
+	{
+		glGetQueryObjectiv(primitives_query, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available)
+		{
+			glGetQueryObjectuiv(primitives_query, GL_QUERY_RESULT, &tessellated_triangles);
+			primitives_pending = 0;
+		}
+	}
+
+	if (primitives_pending)
+		draw_scene();
+	else
+	{
+		glBeginQuery(GL_PRIMITIVES_GENERATED, primitives_query);
+		draw_scene();
+		glEndQuery(GL_PRIMITIVES_GENERATED);
+		primitives_pending = 1;
+	}
+}
+
+/* Per pixel lighting in two passes: the visible surface's normal and
+ * material into the G-buffer, then one fullscreen triangle lighting each
+ * pixel once however much the object overlaps itself. Returns 0 if the
+ * programs aren't there, to draw it forward instead. */
+static int draw_deferred()
+{
+	Permutation *geometry = get_gbuffer_permutation(renderstate.object, shader_instancing());
+	Permutation *lighting = get_lighting_permutation(renderstate.specularMode != 0,
+			renderstate.lightModel != 0, clustered && cluster_support);
+
+	if (!geometry || !lighting)
+		return 0;
+
+	beginGBuffer(viewport_width, viewport_height);
+	glUseProgram(geometry->program);
+	draw_scene();
+	endGBuffer();
+
+	glUseProgram(lighting->program);
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	glDepthFunc(GL_ALWAYS); /* writes the G-buffer's depth */
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glDepthFunc(GL_LESS);
+	glPolygonMode(GL_FRONT_AND_BACK, renderstate.wireframe ? GL_LINE : GL_FILL);
+	return 1;
 }
 
 void display(SDL_Surface *surface)
 {
+	int i, drawn;
+	Permutation *permutation;
+
 	/* Clear the colour and depth buffer */
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -310,6 +1081,8 @@ void display(SDL_Surface *surface)
 		glLightfv(GL_LIGHT0, GL_POSITION, light0_directional);
 	else
 		glLightfv(GL_LIGHT0, GL_POSITION, light0_point);
+	for (i = 1; i < num_lights; ++i)
+		glLightfv(GL_LIGHT0 + i, GL_POSITION, extra_light_positions[i - 1]);
 
 	/* Camera transformation - called later so it is static */
 	glTranslatef(0, 0, -camera_zoom);
@@ -318,19 +1091,61 @@ void display(SDL_Surface *surface)
 
 
 	/*Turn on Shaders if applicable*/
-	if (renderstate.shaders) {
+	/* The uber-shader has no clustered lights or instancing, those always
+	 * use a permutation */
+	permutation = NULL;
+	if (tessellated())
+	{
+		permutation = get_tessellated_permutation(renderstate.object, renderstate.specularMode != 0,
+				renderstate.lightModel != 0, renderstate.perPixel != 0, clustered && cluster_support);
+		if (!permutation)
+			hardware_tessellation = 0; /* didn't build, back to the grid */
+	}
+	if (!permutation && renderstate.shaders && (!uber_shader || (clustered && cluster_support) ||
+			shader_instancing()))
+		permutation = get_permutation(renderstate.object, renderstate.specularMode != 0,
+				renderstate.lightModel != 0, renderstate.perPixel != 0, clustered && cluster_support,
+				shader_instancing());
+	if (renderstate.shaders && uniform_buffer)
+		update_scene();
+	if (shader_instancing() == 2)
+		cull_instances();
+	drawn = renderstate.shaders && renderstate.perPixel && deferred && deferred_support &&
+			draw_deferred();
+	if (drawn) {
+		/* both passes are done */
+	} else if (permutation) {
+		/* The state is compiled in, only the animation and grid are left */
+		glUseProgram(permutation->program);
+		if (tessellated())
+			glUniform2f(permutation->viewport, viewport_width, viewport_height);
+		if (!uniform_buffer) {
+			glUniform1f(permutation->time, time_s);
+			glUniform1f(permutation->uvScale, object && object->format == VERTEX_UV16 ? 1.0 / 32767.0 : 1.0);
+			glUniform2i(permutation->gridSize, (1 << tessellation) + 1, (1 << tessellation) + 1);
+		}
+	} else if (renderstate.shaders) {
 		glUseProgram(shader); /* Use our shader for future rendering */
 
 		glUniform1i(uniform.object, renderstate.object);
 		glUniform1i(uniform.lightingModel, renderstate.specularMode);
 		glUniform1i(uniform.isLocalViewer, renderstate.lightModel);
 		glUniform1i(uniform.isPerPixelLighting, renderstate.perPixel);
-		glUniform1f(uniform.time, time_s);
+		if (!uniform_buffer) {
+			glUniform1f(uniform.time, time_s);
+			glUniform1f(uniform.uvScale, object && object->format == VERTEX_UV16 ? 1.0 / 32767.0 : 1.0);
+			glUniform2i(uniform.gridSize, (1 << tessellation) + 1, (1 << tessellation) + 1);
+		}
 	}
 
 	/* Draw the scene */
-	drawObject(object);
-	//drawNormals(object);
+	CHECKERROR;
+	PROFILE_BEGIN("draw scene");
+	if (!drawn && tessellated())
+		draw_tessellated();
+	else if (!drawn)
+		draw_scene();
+	PROFILE_END();
 
 	/* turn shaders off */
 	glUseProgram(0);
@@ -339,23 +1154,570 @@ void display(SDL_Surface *surface)
 	drawAxes(0,0,0,2);
 
 	/* Draw framerate */
+	PROFILE_BEGIN("osd");
 	draw_framerate(surface);
 	if (renderstate.osd) draw_osd(surface);
+	else if (shaderReloadLog()) draw_text(surface, &log_text, shaderReloadLog(), 0, 30);
+	if (renderstate.osd && !options.bench) drawProfiler(surface->w, surface->h);
+	PROFILE_END();
 
 	CHECKERROR;
 }
 
+/* Re-evaluates the animated wave in place, without reallocating */
+void update_dynamic_geometry()
+{
+	WaveArgs wave;
+	int subdivs;
+	subdivs = 1 << (tessellation);
+
+	wave.width = 2.0;
+	wave.height = 2.0;
+	wave.time = time_s;
+	PROFILE_BEGIN("wave geometry");
+	if (dynamic)
+		updateDynamicObject(dynamic, &wave);
+	else
+		dynamic = createDynamicObject(batchWave, &wave, subdivs + 1, subdivs + 1);
+	PROFILE_END();
+}
+
 void update(int milliseconds)
 {
-	static long time_ms = 0;
-	if (renderstate.animate &&
-			renderstate.object == WAVE) {
+	/* interpolate() goes from these to the new times */
+	last_time_ms = time_ms;
+	last_lights_time_ms = lights_time_ms;
+
+	if (sim.clustered)
+		lights_time_ms += milliseconds;
+
+	if (sim.renderstate.animate &&
+			sim.renderstate.object == WAVE)
 		time_ms += milliseconds;
-		time_s = (double) time_ms / 1000.0f;
-		if (renderstate.shaders == 0) {
-			regenerate_geometry();
+}
+
+void interpolate(float alpha)
+{
+	sim.time_s = (last_time_ms + (double)alpha * (time_ms - last_time_ms)) / 1000.0;
+	sim.lights_time_s = (last_lights_time_ms + (double)alpha * (lights_time_ms - last_lights_time_ms)) / 1000.0;
+}
+
+void snapshot(void *frame)
+{
+	*(FrameState *)frame = sim;
+}
+
+void apply_snapshot(const void *snapshot)
+{
+	const FrameState *frame = (const FrameState *)snapshot;
+	const int geometry = frame->renderstate.object != renderstate.object ||
+			frame->renderstate.shaders != renderstate.shaders || frame->tessellation != tessellation;
+	const int state = memcmp(&frame->renderstate, &renderstate, sizeof(RenderState)) != 0;
+	const int shininess = frame->material_shininess != material_shininess;
+	const int animated = frame->time_s != time_s;
+	MeshRequest built;
+
+	renderstate = frame->renderstate;
+	camera_zoom = frame->camera_zoom;
+	camera_heading = frame->camera_heading;
+	camera_pitch = frame->camera_pitch;
+	tessellation = frame->tessellation;
+	material_shininess = frame->material_shininess;
+	deferred = frame->deferred;
+	clustered = frame->clustered;
+	num_point_lights = frame->num_point_lights;
+	num_instances = frame->num_instances;
+	gpu_culling = frame->gpu_culling;
+	uber_shader = frame->uber_shader;
+	time_s = frame->time_s;
+	lights_time_s = frame->lights_time_s;
+	if (frame->hardware_tessellation != applied_hardware_tessellation)
+		hardware_tessellation = applied_hardware_tessellation = frame->hardware_tessellation;
+	if (frame->osd_version != osd_version)
+		osd_dirty = 1;
+	osd_version = frame->osd_version;
+
+	if (shininess)
+		glMaterialf(GL_FRONT, GL_SHININESS, material_shininess);
+	if (state)
+		update_renderstate();
+	if (geometry)
+		regenerate_geometry();
+
+	swap_geometry(pollMesh(&built), &built);
+
+	/* Edited shaders are swapped in as they finish compiling */
+	if (!options.bench && updateShaders()) {
+		shader = getShaderWithHeader("mesh-generation.vert", "shader.frag", shader_header);
+		get_uniforms();
+	}
+
+	/* The wave without shaders is evaluated once a frame, at the time shown */
+	if (renderstate.animate && renderstate.object == WAVE && !renderstate.shaders &&
+			(animated || !dynamic))
+		update_dynamic_geometry();
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	double da = *(const double *)a;
+	double db = *(const double *)b;
+	return (da > db) - (da < db);
+}
+
+/* Time the CPU side of mesh generation (no upload) for every surface and
+ * tessellation level with 1 to 16 worker threads */
+static void bench_mesh_scaling()
+{
+	static const int thread_counts[] = {1, 2, 4, 8, 16};
+	TorusArgs torus = {1.0f, 0.5f};
+	WaveArgs wave = {2.0f, 2.0f, 0.0f};
+	struct {
+		const char *name;
+		ParametricBatchFunc batch;
+		const void *args;
+	} surfaces[] = {
+		{"torus", batchTorus, &torus},
+		{"wave", batchWave, &wave},
+		{"grid", batchGrid, NULL},
+	};
+	double times[MESH_BENCH_REPEATS];
+	char label[64];
+	Mesh mesh;
+	int t, tess, s, r, subdivs;
+
+	for (t = 0; t < (int)(sizeof thread_counts / sizeof thread_counts[0]); ++t)
+	{
+		setWorkerThreads(thread_counts[t]);
+		for (tess = min_tess; tess <= max_tess; ++tess)
+		{
+			subdivs = 1 << tess;
+			for (s = 0; s < (int)(sizeof surfaces / sizeof surfaces[0]); ++s)
+			{
+				for (r = 0; r < MESH_BENCH_REPEATS; ++r)
+				{
+					double start = getTime();
+					buildMesh(&mesh, surfaces[s].batch, surfaces[s].args, subdivs + 1, subdivs + 1);
+					times[r] = (getTime() - start) * 1000.0;
+					freeMesh(&mesh);
+				}
+				qsort(times, MESH_BENCH_REPEATS, sizeof(double), compare_double);
+				snprintf(label, sizeof label, "mesh %s tess=%d threads=%d",
+						surfaces[s].name, tess, thread_counts[t]);
+				benchMeasure(label, times[MESH_BENCH_REPEATS / 2]);
+			}
 		}
 	}
+	setWorkerThreads(options.threads);
+}
+
+/* Memory and per-frame vertex fetch of each vertex format against plain
+ * floats, for a CPU mesh and the shaders' grid at every tessellation level */
+static void bench_vertex_formats()
+{
+	TorusArgs torus = {1.0f, 0.5f};
+	struct {
+		const char *name;
+		ParametricBatchFunc batch;
+		const void *args;
+		VertexFormat format;
+	} surfaces[] = {
+		{"torus", batchTorus, &torus, VERTEX_HALF},
+		{"grid", batchGrid, NULL, VERTEX_UV16},
+	};
+	char label[64];
+	size_t vertex_bytes[2], frame_bytes[2];
+	Mesh mesh;
+	Object *obj;
+	int tess, s, f, subdivs;
+
+	for (tess = min_tess; tess <= max_tess; ++tess)
+	{
+		subdivs = 1 << tess;
+		for (s = 0; s < (int)(sizeof surfaces / sizeof surfaces[0]); ++s)
+		{
+			if (!vertexFormatSupported(surfaces[s].format))
+				continue;
+			for (f = 0; f < 2; ++f)
+			{
+				VertexFormat format = f ? surfaces[s].format : VERTEX_FLOAT;
+				buildMesh(&mesh, surfaces[s].batch, surfaces[s].args, subdivs + 1, subdivs + 1);
+				packMesh(&mesh, format);
+				obj = uploadMesh(&mesh);
+				vertex_bytes[f] = objectVertexBytes(obj);
+				frame_bytes[f] = vertex_bytes[f] + objectIndexBytes(obj); /* every vertex and index read once */
+				freeObject(obj);
+
+				snprintf(label, sizeof label, "vertex bytes %s tess=%d %s",
+						surfaces[s].name, tess, vertexFormatName(format));
+				benchMeasureBytes(label, vertex_bytes[f]);
+				snprintf(label, sizeof label, "frame bytes %s tess=%d %s",
+						surfaces[s].name, tess, vertexFormatName(format));
+				benchMeasureBytes(label, frame_bytes[f]);
+			}
+			printf("%s tess=%d: %s saves %.1f%% memory, %.1f%% bandwidth\n",
+					surfaces[s].name, tess, vertexFormatName(surfaces[s].format),
+					100.0 * (1.0 - (double)vertex_bytes[1] / vertex_bytes[0]),
+					100.0 * (1.0 - (double)frame_bytes[1] / frame_bytes[0]));
+		}
+	}
+}
+
+/* Simulated cache misses of each index order for a torus mesh at every
+ * tessellation level and, with ARB_pipeline_statistics_query, how many
+ * times the driver actually ran the vertex shader drawing it once */
+static void bench_index_orders()
+{
+	TorusArgs torus = {1.0f, 0.5f};
+	const IndexOrder previous = getIndexOrder();
+	const int queries = GLEW_VERSION_4_6 || GLEW_ARB_pipeline_statistics_query;
+	VertexCacheStats stats;
+	IndexOrder order;
+	GLuint query = 0, invocations;
+	char label[64];
+	Mesh mesh;
+	Object *obj;
+	int tess, subdivs;
+
+	if (queries)
+		glGenQueries(1, &query);
+	for (tess = min_tess; tess <= max_tess; ++tess)
+	{
+		subdivs = 1 << tess;
+		for (order = INDEX_STRIPS; order < INDEX_ORDER_MAX; ++order)
+		{
+			setIndexOrder(order);
+			buildMesh(&mesh, batchTorus, &torus, subdivs + 1, subdivs + 1);
+			packMesh(&mesh, mesh_format);
+			obj = uploadMesh(&mesh);
+			objectCacheStats(obj, &stats);
+			printf("torus tess=%d %s: ACMR %.3f, ATVR %.3f\n",
+					tess, indexOrderName(order), stats.acmr, stats.atvr);
+			snprintf(label, sizeof label, "vertex transforms torus tess=%d %s",
+					tess, indexOrderName(order));
+			benchMeasureCount(label, stats.transforms);
+
+			if (queries)
+			{
+				glBeginQuery(GL_VERTEX_SHADER_INVOCATIONS_ARB, query);
+				drawObject(obj);
+				glEndQuery(GL_VERTEX_SHADER_INVOCATIONS_ARB);
+				glGetQueryObjectuiv(query, GL_QUERY_RESULT, &invocations);
+				snprintf(label, sizeof label, "vs invocations torus tess=%d %s",
+						tess, indexOrderName(order));
+				benchMeasureCount(label, invocations);
+			}
+			freeObject(obj);
+		}
+	}
+	if (query)
+		glDeleteQueries(1, &query);
+	setIndexOrder(previous);
+}
+
+/* Time getting the shader with nothing cached (compiling from source), from
+ * the program binary on disk, and from the in-process cache */
+static void bench_shader_startup()
+{
+	char label[64];
+	double start, cold, binary = 0.0, cached;
+	GLuint program;
+
+	start = getTime();
+	program = compileShader("mesh-generation.vert", "shader.frag", shader_header, 0);
+	cold = getTime() - start;
+	glDeleteProgram(program);
+
+	if (shaderBinariesSupported())
+	{
+		/* Make sure there's a binary to load, init() may not have written it */
+		glDeleteProgram(compileShader("mesh-generation.vert", "shader.frag", shader_header, 1));
+		start = getTime();
+		program = compileShader("mesh-generation.vert", "shader.frag", shader_header, 1);
+		binary = getTime() - start;
+		if (lastShaderOrigin() != SHADER_FROM_DISK)
+			binary = 0.0; /* the driver wouldn't take it back */
+		glDeleteProgram(program);
+	}
+
+	start = getTime();
+	getShaderWithHeader("mesh-generation.vert", "shader.frag", shader_header);
+	cached = getTime() - start;
+
+	snprintf(label, sizeof label, "shader startup this run (%s)", shaderOriginName(shader_origin));
+	benchMeasure(label, shader_startup * 1000.0);
+	benchMeasure("shader startup cold", cold * 1000.0);
+	if (binary > 0.0)
+		benchMeasure("shader startup warm binary", binary * 1000.0);
+	benchMeasure("shader startup warm cached", cached * 1000.0);
+	if (binary > 0.0)
+		printf("Shader startup: cold %.2fms, binary %.2fms, cached %.3fms\n",
+				cold * 1000.0, binary * 1000.0, cached * 1000.0);
+	else
+		printf("Shader startup: cold %.2fms, no program binaries, cached %.3fms\n",
+				cold * 1000.0, cached * 1000.0);
+}
+
+/* Per call, a bare glGetError() and a CHECKERROR as built: a glGetError()
+ * loop, only noting the place for the debug callback, or nothing with NDEBUG */
+static void bench_error_checks()
+{
+	double start, poll, check;
+	int i;
+
+	glFinish();
+	start = getTime();
+	for (i = 0; i < ERROR_BENCH_CHECKS; ++i)
+		glGetError();
+	poll = (getTime() - start) / ERROR_BENCH_CHECKS;
+
+	start = getTime();
+	for (i = 0; i < ERROR_BENCH_CHECKS; ++i)
+		CHECKERROR;
+	check = (getTime() - start) / ERROR_BENCH_CHECKS;
+
+	benchMeasure("glGetError", poll * 1000.0);
+	benchMeasure("CHECKERROR", check * 1000.0);
+	printf("GL error checks: glGetError() %.3fus, CHECKERROR %.3fus\n", poll * 1e6, check * 1e6);
+}
+
+/* CPU time binning 1 to MAX_POINT_LIGHTS point lights into clusters,
+ * upload included */
+static void bench_cluster_binning()
+{
+	double times[MESH_BENCH_REPEATS];
+	ClusterStats stats;
+	char label[64];
+	int n, r;
+
+	update_scene(); /* for the camera */
+	for (n = 1; n <= MAX_POINT_LIGHTS; n *= 2)
+	{
+		move_point_lights(n);
+		for (r = 0; r < MESH_BENCH_REPEATS; ++r)
+		{
+			updateClusteredLights(point_lights, n, viewport_width, viewport_height,
+					0.1, 100.0, &scene);
+			clusteredLightStats(&stats);
+			times[r] = stats.binMs;
+		}
+		qsort(times, MESH_BENCH_REPEATS, sizeof(double), compare_double);
+		snprintf(label, sizeof label, "cluster binning lights=%d", n);
+		benchMeasure(label, times[MESH_BENCH_REPEATS / 2]);
+		printf("Clusters with %d lights: %d in view, %d references, %d most in one\n",
+				n, stats.lights, stats.indices, stats.maxPerCluster);
+	}
+}
+
+/* Camera distances the tessellation sweep draws at, the default second */
+static const float bench_zooms[] = {2.0, 5.0, 20.0};
+#define BENCH_GRID_TESS 8 /* the fixed grid hardware tessellation is compared with */
+
+/* Sizes the forward and deferred paths are compared at */
+static const int bench_resolutions[][2] = {{640, 480}, {1280, 720}, {1920, 1080}};
+static int bench_width, bench_height; /* the size to go back to */
+
+int bench_step(int step, char *label, int size)
+{
+	/* Every object at every tessellation level, with shaders and per-pixel
+	 * lighting each on and off */
+	const int num_tess = max_tess - min_tess + 1;
+	const int num_static = OBJECT_MAX * 4 * num_tess;
+	int per_pixel = step % 2;
+	int shaders = (step / 2) % 2;
+	int tess = min_tess + (step / 4) % num_tess;
+	int obj = step / (4 * num_tess);
+	int animate = 0;
+	const int num_uber = OBJECT_MAX * 2 * num_tess;
+	const int first_clustered = num_static + num_tess + num_uber;
+	const int num_resolutions = sizeof bench_resolutions / sizeof bench_resolutions[0];
+	const int num_zooms = sizeof bench_zooms / sizeof bench_zooms[0];
+	int num_clustered = 0, first_deferred, num_deferred, first_tessellated, num_tessellated;
+	int first_instanced;
+	int uber = options.uber_shader;
+	int lights = 0;
+	int deferred_state = 0, resolution = -1;
+	int copies = 1, separate = 0, culled = 0;
+	int hardware = 0;
+	float zoom = 5.0;
+	MeshRequest built;
+
+	/* How many triangles the last state's patches became */
+	if (step > 0 && tessellated())
+	{
+		if (primitives_pending)
+			glGetQueryObjectuiv(primitives_query, GL_QUERY_RESULT, &tessellated_triangles);
+		primitives_pending = 0;
+		printf("  %u triangles from %d patches\n", tessellated_triangles, TESS_PATCHES * TESS_PATCHES);
+	}
+
+	while (cluster_support && (1 << num_clustered) <= MAX_POINT_LIGHTS)
+		++num_clustered;
+	first_deferred = first_clustered + num_clustered;
+	num_deferred = deferred_support ? num_resolutions * OBJECT_MAX * 2 : 0;
+	first_tessellated = first_deferred + num_deferred;
+	num_tessellated = tessellation_support ? num_zooms * OBJECT_MAX * 2 : 0;
+	first_instanced = first_tessellated + num_tessellated;
+
+	/* Last a field of 1 to MAX_INSTANCES small tori in one instanced draw,
+	 * then up to a tenth of that with a draw call each, then all of them
+	 * again culled on the GPU at their own levels of detail */
+	if (step >= first_instanced)
+	{
+		int s = step - first_instanced;
+		int k = s % BENCH_INSTANCE_COUNTS;
+		if (!instancing_support)
+			return 0;
+		if (s >= 2 * BENCH_INSTANCE_COUNTS - 1)
+		{
+			k = s - (2 * BENCH_INSTANCE_COUNTS - 1);
+			if (!culling_support || k >= BENCH_INSTANCE_COUNTS)
+				return 0;
+			culled = 1;
+		}
+		separate = s >= BENCH_INSTANCE_COUNTS && !culled;
+		for (copies = 1; k > 0; --k)
+			copies *= 10;
+		obj = TORUS;
+		shaders = 1;
+		per_pixel = 1;
+		tess = min_tess;
+	}
+	/* Before that each object near, in the middle and far away, as a fixed
+	 * grid and with hardware tessellation */
+	else if (step >= first_tessellated)
+	{
+		int s = step - first_tessellated;
+		hardware = s % 2;
+		obj = (s / 2) % OBJECT_MAX;
+		zoom = bench_zooms[s / (2 * OBJECT_MAX)];
+		shaders = 1;
+		per_pixel = 1;
+		tess = BENCH_GRID_TESS;
+	}
+	/* Before that each object shaded per pixel forward and deferred, at
+	 * several resolutions */
+	else if (step >= first_deferred)
+	{
+		int s = step - first_deferred;
+		deferred_state = s % 2;
+		obj = (s / 2) % OBJECT_MAX;
+		resolution = s / (2 * OBJECT_MAX);
+		shaders = 1;
+		per_pixel = 1;
+		tess = SWEEP_BENCH_TESS;
+	}
+	/* Before that a torus shaded by 1 to MAX_POINT_LIGHTS clustered point
+	 * lights */
+	else if (step >= first_clustered)
+	{
+		obj = TORUS;
+		shaders = 1;
+		per_pixel = 1;
+		tess = SWEEP_BENCH_TESS;
+		lights = 1 << (step - first_clustered);
+	}
+	/* Before those the shader states again with the uber-shader, to compare
+	 * with the permutations */
+	else if (step >= num_static + num_tess)
+	{
+		int s = step - num_static - num_tess;
+		per_pixel = s % 2;
+		shaders = 1;
+		tess = min_tess + (s / 2) % num_tess;
+		obj = s / (2 * num_tess);
+		uber = 1;
+	}
+	/* Then the animated wave without shaders at every tessellation level,
+	 * which streams new vertices every frame */
+	else if (step >= num_static)
+	{
+		obj = WAVE;
+		shaders = 0;
+		per_pixel = 0;
+		tess = min_tess + step - num_static;
+		animate = 1;
+	}
+
+	/* Make sure the vector mesh kernels agree with the scalar reference */
+	if (step == 0)
+	{
+		SimdLevel level;
+		double start;
+		for (level = SIMD_SSE2; level <= simdSupported(); ++level)
+		{
+			float error = simdCheck(level);
+			printf("SIMD %s: max error vs scalar %g%s\n", simdLevelName(level), error,
+					error > SIMD_TOLERANCE ? " -- FAILED" : "");
+		}
+		bench_shader_startup();
+		bench_error_checks();
+		start = getTime();
+		build_permutations();
+		benchMeasure("shader permutations build", (getTime() - start) * 1000.0);
+		bench_mesh_scaling();
+		bench_vertex_formats();
+		bench_index_orders();
+		if (cluster_support)
+			bench_cluster_binning();
+	}
+
+	renderstate.object = obj;
+	renderstate.shaders = shaders;
+	renderstate.perPixel = per_pixel;
+	renderstate.animate = animate;
+	uber_shader = uber;
+	clustered = lights > 0;
+	if (lights)
+		num_point_lights = lights;
+	deferred = deferred_state;
+	num_instances = copies;
+	separate_draws = separate;
+	gpu_culling = culled;
+	hardware_tessellation = hardware;
+	camera_zoom = zoom;
+	osd_dirty = 1;
+	if (step == 0)
+	{
+		bench_width = viewport_width;
+		bench_height = viewport_height;
+	}
+	if (resolution >= 0)
+		resize_window(bench_resolutions[resolution][0], bench_resolutions[resolution][1]);
+	else if (viewport_width != bench_width || viewport_height != bench_height)
+		resize_window(bench_width, bench_height);
+	tessellation = tess;
+	update_renderstate();
+	regenerate_geometry();
+	swap_geometry(finishMesh(&built), &built); /* measure the new state, not the old one */
+	capture_frame(&sim);
+
+	if (animate)
+		snprintf(label, size, "%s tess=%d animated", object_names[obj], tess);
+	else if (lights)
+		snprintf(label, size, "%s tess=%d shaders=1 perpixel=1 clustered lights=%d",
+				object_names[obj], tess, lights);
+	else if (step >= first_tessellated && step < first_instanced)
+	{
+		if (hardware)
+			snprintf(label, size, "%s tess=hw shaders=1 perpixel=1 zoom=%g", object_names[obj], zoom);
+		else
+			snprintf(label, size, "%s tess=%d shaders=1 perpixel=1 zoom=%g", object_names[obj], tess, zoom);
+	}
+	else if (culled)
+		snprintf(label, size, "%s tess=%d-%d shaders=1 perpixel=1 instances=%d culled",
+				object_names[obj], min_tess, max_tess, copies);
+	else if (copies > 1 || step >= first_instanced)
+		snprintf(label, size, "%s tess=%d shaders=1 perpixel=1 instances=%d %s",
+				object_names[obj], tess, copies, separate ? "separate" : "instanced");
+	else if (resolution >= 0)
+		snprintf(label, size, "%s tess=%d shaders=1 perpixel=1 %s %dx%d",
+				object_names[obj], tess, deferred ? "deferred" : "forward",
+				viewport_width, viewport_height);
+	else
+		snprintf(label, size, "%s tess=%d shaders=%s perpixel=%d",
+				object_names[obj], tess, !shaders ? "0" : uber ? "uber" : "1", per_pixel);
+	return 1;
 }
 
 void set_mousestate(unsigned char button, int state)
@@ -378,6 +1740,7 @@ void event(SDL_Event *event)
 	switch (event->type)
 	{
 	case SDL_KEYDOWN:
+		++sim.osd_version;
 		key_state[event->key.keysym.sym] = 1;
 
 		/* Handle non-state keys */
@@ -386,98 +1749,120 @@ void event(SDL_Event *event)
 		case SDLK_ESCAPE:
 			quit();
 			break;
+		case SDLK_d:
+			sim.deferred = !sim.deferred;
+			printf("Deferred shading %i\n", sim.deferred);
+			break;
+		case SDLK_c:
+			sim.clustered = !sim.clustered;
+			printf("Clustered point lights %i\n", sim.clustered);
+			break;
+		case SDLK_LEFTBRACKET:
+			sim.num_point_lights = max(sim.num_point_lights / 2, 1);
+			printf("Point lights %i\n", sim.num_point_lights);
+			break;
+		case SDLK_RIGHTBRACKET:
+			sim.num_point_lights = min(sim.num_point_lights * 2, MAX_POINT_LIGHTS);
+			printf("Point lights %i\n", sim.num_point_lights);
+			break;
 		case SDLK_a:
-			renderstate.animate = !renderstate.animate;
-			printf("Wave Animate %i\n", renderstate.animate);
+			sim.renderstate.animate = !sim.renderstate.animate;
+			printf("Wave Animate %i\n", sim.renderstate.animate);
 			break;
 		case SDLK_g:
-			renderstate.object = (renderstate.object + 1) % OBJECT_MAX;
-			printf("Object %s\n", object_names[renderstate.object]);
-			regenerate_geometry();
+			sim.renderstate.object = (sim.renderstate.object + 1) % OBJECT_MAX;
+			printf("Object %s\n", object_names[sim.renderstate.object]);
 			break;
 		case SDLK_s:
-			renderstate.shaders = !renderstate.shaders;
-			regenerate_geometry();
-			printf("Using Shaders %i\n", renderstate.shaders);
+			sim.renderstate.shaders = !sim.renderstate.shaders;
+			printf("Using Shaders %i\n", sim.renderstate.shaders);
 			break;
 		case SDLK_f:
-			renderstate.shading = !renderstate.shading;
-			printf("Changed shading mode %i\n", renderstate.shading);
-			update_renderstate();
+			sim.renderstate.shading = !sim.renderstate.shading;
+			printf("Changed shading mode %i\n", sim.renderstate.shading);
 			break;
 		case SDLK_h:
 			if ((key_state[SDLK_LSHIFT] || key_state[SDLK_RSHIFT]))
 			{
-				if (material_shininess < 128)
+				if (sim.material_shininess < 128)
 				{
 					printf("keypress\n");
-					material_shininess += 16;
-					glMaterialf(GL_FRONT, GL_SHININESS, material_shininess);
-					printf("shininess: %f\n", material_shininess);
+					sim.material_shininess += 16;
+					printf("shininess: %f\n", sim.material_shininess);
 				}
 			}
 			else
 			{
-				if (material_shininess > 16)
+				if (sim.material_shininess > 16)
 				{
 					printf("keypress\n");
-					material_shininess -= 16;
-					glMaterialf(GL_FRONT, GL_SHININESS, material_shininess);
-					printf("shininess: %f\n", material_shininess);
+					sim.material_shininess -= 16;
+					printf("shininess: %f\n", sim.material_shininess);
 				}
 			}
 			break;
+		case SDLK_i:
+			if ((key_state[SDLK_LSHIFT] || key_state[SDLK_RSHIFT]))
+				sim.num_instances = min(sim.num_instances * 10, MAX_INSTANCES);
+			else
+				sim.num_instances = max(sim.num_instances / 10, 1);
+			printf("Instances %i\n", sim.num_instances);
+			break;
+		case SDLK_e:
+			sim.hardware_tessellation = !sim.hardware_tessellation;
+			printf("Hardware tessellation %i\n", sim.hardware_tessellation);
+			break;
+		case SDLK_z:
+			sim.gpu_culling = !sim.gpu_culling;
+			printf("GPU culling %i\n", sim.gpu_culling);
+			break;
 		case SDLK_k:
-			renderstate.lightType = !renderstate.lightType;
-			printf("Light Mode %i\n", renderstate.lightType);
-			update_renderstate();
+			sim.renderstate.lightType = !sim.renderstate.lightType;
+			printf("Light Mode %i\n", sim.renderstate.lightType);
 			break;
 		case SDLK_l:
-			renderstate.lighting = !renderstate.lighting;
-			printf("Lighting %i\n", renderstate.lighting);
-			update_renderstate();
+			sim.renderstate.lighting = !sim.renderstate.lighting;
+			printf("Lighting %i\n", sim.renderstate.lighting);
 			break;
 		case SDLK_m:
-			renderstate.specularMode = !renderstate.specularMode;
-			printf("Specular Mode %i\n", renderstate.specularMode);
-			update_renderstate();
+			sim.renderstate.specularMode = !sim.renderstate.specularMode;
+			printf("Specular Mode %i\n", sim.renderstate.specularMode);
 			break;
 		case SDLK_o:
-			renderstate.osd = !renderstate.osd;
-			printf("OSD %i\n", renderstate.osd);
-			update_renderstate();
+			sim.renderstate.osd = !sim.renderstate.osd;
+			printf("OSD %i\n", sim.renderstate.osd);
 			break;
 		case SDLK_p:
-			renderstate.perPixel = !renderstate.perPixel;
-			printf("Per pixel %i\n", renderstate.perPixel);
+			sim.renderstate.perPixel = !sim.renderstate.perPixel;
+			printf("Per pixel %i\n", sim.renderstate.perPixel);
 			break;
 		case SDLK_t:
 			if ((key_state[SDLK_LSHIFT] || key_state[SDLK_RSHIFT]))
 			{
-				if (tessellation < max_tess)
+				if (sim.tessellation < max_tess)
 				{
-					++tessellation;
-					regenerate_geometry();
+					++sim.tessellation;
 				}
 			}
 			else
 			{
-				if (tessellation > min_tess)
+				if (sim.tessellation > min_tess)
 				{
-					--tessellation;
-					regenerate_geometry();
+					--sim.tessellation;
 				}
 			}
 			break;
+		case SDLK_u:
+			sim.uber_shader = !sim.uber_shader;
+			printf("Uber-shader %i\n", sim.uber_shader);
+			break;
 		case SDLK_v:
-			renderstate.lightModel = !renderstate.lightModel;
-			printf("Local Viewer %i\n", renderstate.lightModel);
-			update_renderstate();
+			sim.renderstate.lightModel = !sim.renderstate.lightModel;
+			printf("Local Viewer %i\n", sim.renderstate.lightModel);
 			break;
 		case SDLK_w:
-			renderstate.wireframe = !renderstate.wireframe;
-			printf("Wireframe %i\n", renderstate.wireframe);
-			update_renderstate();
+			sim.renderstate.wireframe = !sim.renderstate.wireframe;
+			printf("Wireframe %i\n", sim.renderstate.wireframe);
 			break;
 		default:
 			break;
@@ -506,12 +1891,12 @@ void event(SDL_Event *event)
 		if (mouse1_down)
 		{
 			/* Only move the camera if the mouse is down*/
-			camera_heading -= event->motion.xrel * CAMERA_MOUSE_X_VELOCITY;
-			camera_pitch -= event->motion.yrel * CAMERA_MOUSE_Y_VELOCITY;
+			sim.camera_heading -= event->motion.xrel * CAMERA_MOUSE_X_VELOCITY;
+			sim.camera_pitch -= event->motion.yrel * CAMERA_MOUSE_Y_VELOCITY;
 		}
 		if (mouse2_down)
 		{
-			camera_zoom -= event->motion.yrel * CAMERA_MOUSE_Y_VELOCITY * 0.1;
+			sim.camera_zoom -= event->motion.yrel * CAMERA_MOUSE_Y_VELOCITY * 0.1;
 		}
 		break;
 	default:
@@ -521,10 +1906,41 @@ void event(SDL_Event *event)
 
 void cleanup()
 {
-	/* Delete the shader */
-	glDeleteProgram(shader);
+	/* Delete the shader and its permutations */
+	clearShaderCache();
+	shader = 0;
+	freeSceneUniforms();
+	freeClusteredLights();
+	freeGBuffer();
+	freeGpuCulling();
+	freeTextLayout(&framerate_text);
+	freeTextLayout(&osd_text);
+	freeTextLayout(&log_text);
+	freeText();
+	memset(tessellated_permutations, 0, sizeof(tessellated_permutations));
+	if (primitives_query)
+		glDeleteQueries(1, &primitives_query);
+	primitives_query = 0;
+	primitives_pending = 0;
+	if (lod_chain)
+		freeLodChain(lod_chain);
+	lod_chain = NULL;
+	memset(permutations, 0, sizeof(permutations));
+	memset(gbuffer_permutations, 0, sizeof(gbuffer_permutations));
+	memset(lighting_permutations, 0, sizeof(lighting_permutations));
+	if (instance_buffer)
+		glDeleteBuffers(1, &instance_buffer);
+	instance_buffer = 0;
+	free(instances);
+	instances = NULL;
+	laid_out = 0;
 
 	/* Free object data */
-	if (object)
-		freeObject(object);
+	shutdownMeshBuilder();
+	clearGeometryCache();
+	object = NULL;
+	if (dynamic)
+		freeDynamicObject(dynamic);
+
+	shutdownWorkers();
 }
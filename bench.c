@@ -0,0 +1,361 @@
+/* bench.c */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <GL/glew.h>
+
+#include "bench.h"
+#include "timer.h"
+
+/* Number of timer queries in flight. A query is read back this many frames
+ * after it was issued, by which time the GPU has long finished with it. */
+#define BENCH_QUERIES 4
+
+typedef struct {
+	float cpu; /* ms */
+	float gpu; /* ms, negative if unavailable */
+} BenchSample;
+
+typedef struct {
+	char label[64];
+	int firstSample;
+	int numSamples;
+} BenchState;
+
+typedef struct {
+	char label[64];
+	double value;
+	const char* unit; /* "ms", "bytes" or "count", also the JSON key */
+} BenchMeasurement;
+
+typedef struct {
+	float min, p50, p95, p99, max, mean;
+	int count;
+} BenchStats;
+
+static BenchSample* samples = NULL;
+static int numSamples = 0;
+static int maxSamples = 0;
+
+static BenchState* states = NULL;
+static int numStates = 0;
+static int maxStates = 0;
+
+static BenchMeasurement* measurements = NULL;
+static int numMeasurements = 0;
+static int maxMeasurements = 0;
+
+static int haveTimer = 0;
+static GLuint queries[BENCH_QUERIES];
+static int querySample[BENCH_QUERIES]; /* sample waiting on each query, or -1 */
+static int currentQuery = 0;
+static int currentSample = -1;
+static double frameStart;
+
+static char renderer[256];
+static char version[256];
+
+void benchInit()
+{
+	int i;
+
+	haveTimer = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+	if (haveTimer)
+		glGenQueries(BENCH_QUERIES, queries);
+	for (i = 0; i < BENCH_QUERIES; ++i)
+		querySample[i] = -1;
+
+	snprintf(renderer, sizeof renderer, "%s", (const char*)glGetString(GL_RENDERER));
+	snprintf(version, sizeof version, "%s", (const char*)glGetString(GL_VERSION));
+	printf("Benchmarking on %s (%s)%s\n", renderer, version,
+		haveTimer ? "" : ", no GPU timer queries");
+}
+
+static void collectQuery(int query)
+{
+	GLuint64 elapsed;
+	if (querySample[query] < 0)
+		return;
+	glGetQueryObjectui64v(queries[query], GL_QUERY_RESULT, &elapsed);
+	samples[querySample[query]].gpu = (float)(elapsed / 1.0e6);
+	querySample[query] = -1;
+}
+
+void benchBeginState(const char* label)
+{
+	if (numStates == maxStates)
+	{
+		maxStates = maxStates ? maxStates * 2 : 64;
+		states = (BenchState*)realloc(states, sizeof(BenchState) * maxStates);
+	}
+	snprintf(states[numStates].label, sizeof states[numStates].label, "%s", label);
+	states[numStates].firstSample = numSamples;
+	states[numStates].numSamples = 0;
+}
+
+void benchBeginFrame()
+{
+	if (numSamples == maxSamples)
+	{
+		maxSamples = maxSamples ? maxSamples * 2 : 1024;
+		samples = (BenchSample*)realloc(samples, sizeof(BenchSample) * maxSamples);
+	}
+	currentSample = numSamples++;
+	samples[currentSample].cpu = 0.0f;
+	samples[currentSample].gpu = -1.0f;
+
+	if (haveTimer)
+	{
+		/* Reuse the oldest query, reading back its result first */
+		collectQuery(currentQuery);
+		querySample[currentQuery] = currentSample;
+		glBeginQuery(GL_TIME_ELAPSED, queries[currentQuery]);
+	}
+	frameStart = getTime();
+}
+
+void benchEndGPU()
+{
+	if (haveTimer)
+	{
+		glEndQuery(GL_TIME_ELAPSED);
+		currentQuery = (currentQuery + 1) % BENCH_QUERIES;
+	}
+}
+
+void benchEndFrame()
+{
+	samples[currentSample].cpu = (float)((getTime() - frameStart) * 1000.0);
+}
+
+static int compareFloat(const void* a, const void* b)
+{
+	float fa = *(const float*)a;
+	float fb = *(const float*)b;
+	return (fa > fb) - (fa < fb);
+}
+
+/* Nearest-rank percentile of a sorted array */
+static float percentile(const float* sorted, int n, float p)
+{
+	int rank = (int)ceil(p / 100.0 * n);
+	if (rank < 1)
+		rank = 1;
+	if (rank > n)
+		rank = n;
+	return sorted[rank - 1];
+}
+
+static void computeStats(const BenchState* state, int gpu, BenchStats* stats)
+{
+	float* values;
+	float value;
+	double sum = 0.0;
+	int i;
+
+	memset(stats, 0, sizeof(BenchStats));
+	values = (float*)malloc(sizeof(float) * (state->numSamples + 1));
+	for (i = 0; i < state->numSamples; ++i)
+	{
+		value = gpu ? samples[state->firstSample + i].gpu : samples[state->firstSample + i].cpu;
+		if (value < 0.0f)
+			continue;
+		values[stats->count++] = value;
+		sum += value;
+	}
+
+	if (stats->count)
+	{
+		qsort(values, stats->count, sizeof(float), compareFloat);
+		stats->min = values[0];
+		stats->max = values[stats->count - 1];
+		stats->p50 = percentile(values, stats->count, 50.0f);
+		stats->p95 = percentile(values, stats->count, 95.0f);
+		stats->p99 = percentile(values, stats->count, 99.0f);
+		stats->mean = (float)(sum / stats->count);
+	}
+	free(values);
+}
+
+void benchEndState()
+{
+	BenchStats cpu, gpu;
+	BenchState* state = &states[numStates];
+	int i;
+
+	/* Wait for the queries still in flight so every sample is complete */
+	if (haveTimer)
+		for (i = 0; i < BENCH_QUERIES; ++i)
+			collectQuery(i);
+
+	state->numSamples = numSamples - state->firstSample;
+	++numStates;
+
+	computeStats(state, 0, &cpu);
+	computeStats(state, 1, &gpu);
+	printf("%-40s cpu p50 %7.3f p95 %7.3f ms", state->label, cpu.p50, cpu.p95);
+	if (gpu.count)
+		printf("  gpu p50 %7.3f p95 %7.3f ms", gpu.p50, gpu.p95);
+	printf("\n");
+}
+
+static void addMeasurement(const char* label, double value, const char* unit)
+{
+	if (numMeasurements == maxMeasurements)
+	{
+		maxMeasurements = maxMeasurements ? maxMeasurements * 2 : 64;
+		measurements = (BenchMeasurement*)realloc(measurements, sizeof(BenchMeasurement) * maxMeasurements);
+	}
+	snprintf(measurements[numMeasurements].label, sizeof measurements[numMeasurements].label, "%s", label);
+	measurements[numMeasurements].value = value;
+	measurements[numMeasurements].unit = unit;
+	++numMeasurements;
+}
+
+void benchMeasure(const char* label, double ms)
+{
+	addMeasurement(label, ms, "ms");
+	printf("%-40s %9.3f ms\n", label, ms);
+}
+
+void benchMeasureBytes(const char* label, double bytes)
+{
+	addMeasurement(label, bytes, "bytes");
+	printf("%-40s %9.1f KB\n", label, bytes / 1024.0);
+}
+
+void benchMeasureCount(const char* label, double count)
+{
+	addMeasurement(label, count, "count");
+	printf("%-40s %9.0f\n", label, count);
+}
+
+static void writeJsonString(FILE* file, const char* str)
+{
+	fputc('"', file);
+	for (; *str; ++str)
+	{
+		if (*str == '"' || *str == '\\')
+			fprintf(file, "\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			fprintf(file, "\\u%04x", *str);
+		else
+			fputc(*str, file);
+	}
+	fputc('"', file);
+}
+
+/* A quoted CSV field, quotes doubled (RFC 4180), labels have commas */
+static void writeCsvString(FILE* file, const char* str)
+{
+	fputc('"', file);
+	for (; *str; ++str)
+	{
+		if (*str == '"')
+			fputc('"', file);
+		fputc(*str, file);
+	}
+	fputc('"', file);
+}
+
+static void writeJsonStats(FILE* file, const char* name, const BenchStats* stats)
+{
+	fprintf(file, "\"%s\": ", name);
+	if (!stats->count)
+	{
+		fprintf(file, "null");
+		return;
+	}
+	fprintf(file, "{\"min\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, "
+		"\"max\": %.4f, \"mean\": %.4f, \"count\": %d}",
+		stats->min, stats->p50, stats->p95, stats->p99,
+		stats->max, stats->mean, stats->count);
+}
+
+int benchWrite(const char* csvFile, const char* jsonFile)
+{
+	FILE* file;
+	BenchStats cpu, gpu;
+	int i, j;
+
+	if (csvFile)
+	{
+		file = fopen(csvFile, "w");
+		if (!file)
+		{
+			printf("Error writing %s\n", csvFile);
+			return 1;
+		}
+		fprintf(file, "state,label,frame,cpu_ms,gpu_ms\n");
+		for (i = 0; i < numStates; ++i)
+		{
+			for (j = 0; j < states[i].numSamples; ++j)
+			{
+				const BenchSample* sample = &samples[states[i].firstSample + j];
+				fprintf(file, "%d,", i);
+				writeCsvString(file, states[i].label);
+				fprintf(file, ",%d,%.4f,", j, sample->cpu);
+				if (sample->gpu >= 0.0f)
+					fprintf(file, "%.4f", sample->gpu);
+				fprintf(file, "\n");
+			}
+		}
+		fclose(file);
+	}
+
+	if (jsonFile)
+	{
+		file = fopen(jsonFile, "w");
+		if (!file)
+		{
+			printf("Error writing %s\n", jsonFile);
+			return 1;
+		}
+		fprintf(file, "{\n\t\"renderer\": ");
+		writeJsonString(file, renderer);
+		fprintf(file, ",\n\t\"version\": ");
+		writeJsonString(file, version);
+		fprintf(file, ",\n\t\"measurements\": [\n");
+		for (i = 0; i < numMeasurements; ++i)
+		{
+			fprintf(file, "\t\t{\"label\": ");
+			writeJsonString(file, measurements[i].label);
+			fprintf(file, ", \"%s\": %.4f}%s\n", measurements[i].unit, measurements[i].value,
+				i + 1 < numMeasurements ? "," : "");
+		}
+		fprintf(file, "\t],\n\t\"states\": [\n");
+		for (i = 0; i < numStates; ++i)
+		{
+			computeStats(&states[i], 0, &cpu);
+			computeStats(&states[i], 1, &gpu);
+			fprintf(file, "\t\t{\"label\": ");
+			writeJsonString(file, states[i].label);
+			fprintf(file, ", \"frames\": %d, ", states[i].numSamples);
+			writeJsonStats(file, "cpu_ms", &cpu);
+			fprintf(file, ", ");
+			writeJsonStats(file, "gpu_ms", &gpu);
+			fprintf(file, "}%s\n", i + 1 < numStates ? "," : "");
+		}
+		fprintf(file, "\t]\n}\n");
+		fclose(file);
+	}
+	return 0;
+}
+
+void benchCleanup()
+{
+	if (haveTimer)
+		glDeleteQueries(BENCH_QUERIES, queries);
+	free(samples);
+	free(states);
+	free(measurements);
+	samples = NULL;
+	states = NULL;
+	measurements = NULL;
+	numSamples = maxSamples = 0;
+	numStates = maxStates = 0;
+	numMeasurements = maxMeasurements = 0;
+}
@@ -0,0 +1,34 @@
+/* bench.h */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+/*
+USAGE:
+benchInit();
+for each render state:
+	benchBeginState("label");
+	for each measured frame:
+		benchBeginFrame(); <update, draw> benchEndGPU(); <swap> benchEndFrame();
+	benchEndState();
+benchWrite("frames.csv", "summary.json");
+benchCleanup();
+
+CPU time is the wall time from benchBeginFrame() to benchEndFrame(). GPU time
+comes from GL_TIME_ELAPSED queries between benchBeginFrame() and
+benchEndGPU(). Query results are collected a few frames late so measuring
+never stalls the pipeline; times are reported in milliseconds.
+*/
+void benchInit();
+void benchBeginState(const char* label);
+void benchBeginFrame();
+void benchEndGPU();
+void benchEndFrame();
+void benchEndState();
+void benchMeasure(const char* label, double ms); /* a one-off timing, e.g. startup */
+void benchMeasureBytes(const char* label, double bytes); /* a one-off size */
+void benchMeasureCount(const char* label, double count); /* a one-off count, e.g. of queries */
+int benchWrite(const char* csvFile, const char* jsonFile); /* returns 0 on success */
+void benchCleanup();
+
+#endif
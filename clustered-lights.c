@@ -0,0 +1,257 @@
+/* clustered-lights.c */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <GL/glew.h>
+
+#include "clustered-lights.h"
+#include "timer.h"
+
+#define NUM_CLUSTERS (CLUSTER_TILES_X * CLUSTER_TILES_Y * CLUSTER_SLICES)
+
+enum { GRID, INDICES, LIGHTS, NUM_BUFFERS };
+
+static GLuint buffers[NUM_BUFFERS];
+static GLuint textures[NUM_BUFFERS];
+static int created = 0;
+
+/* Offset and count of each cluster's run of indices */
+static unsigned int grid[NUM_CLUSTERS * 2];
+static unsigned int fill[NUM_CLUSTERS];
+static unsigned int* indices = NULL;
+static int maxIndices = 0;
+
+/* Eye space position and radius, then colour, for each binned light */
+static float lightData[MAX_POINT_LIGHTS * 8];
+
+/* The clusters each binned light overlaps, inclusive */
+static struct {
+	int x0, x1, y0, y1, z0, z1;
+} bounds[MAX_POINT_LIGHTS];
+
+static ClusterStats stats;
+
+int clusteredLightsSupported()
+{
+	return GLEW_VERSION_3_1;
+}
+
+void bindClusteredLights(GLuint program)
+{
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "clusterGrid"), CLUSTER_GRID_UNIT);
+	glUniform1i(glGetUniformLocation(program, "clusterLights"), CLUSTER_LIGHTS_UNIT);
+	glUniform1i(glGetUniformLocation(program, "pointLights"), POINT_LIGHTS_UNIT);
+	glUseProgram(0);
+}
+
+static void createBuffers()
+{
+	static const GLenum formats[NUM_BUFFERS] = {GL_RG32UI, GL_R32UI, GL_RGBA32F};
+	int i;
+
+	glGenBuffers(NUM_BUFFERS, buffers);
+	glGenTextures(NUM_BUFFERS, textures);
+	for (i = 0; i < NUM_BUFFERS; ++i)
+	{
+		glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+		glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+		glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+		glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+	}
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	created = 1;
+}
+
+static int clampInt(int x, int a, int b)
+{
+	return x < a ? a : x > b ? b : x;
+}
+
+/* The depth slice a view distance falls in */
+static int slice(float depth, float sliceScale, float sliceBias)
+{
+	return clampInt((int)floorf(logf(depth) * sliceScale + sliceBias), 0, CLUSTER_SLICES - 1);
+}
+
+/* x = m * v for a column major 4x4 */
+static void transform(float* x, const float* m, const float* v)
+{
+	int i;
+	for (i = 0; i < 4; ++i)
+		x[i] = m[i] * v[0] + m[4 + i] * v[1] + m[8 + i] * v[2] + m[12 + i] * v[3];
+}
+
+/* The range of tiles a light's eye space bounding box covers on screen */
+static void tileBounds(int* b, const float* centre, float radius, const float* projection,
+	float tileWidth, float tileHeight, int width, int height)
+{
+	float corner[4], clip[4];
+	float x0 = (float)width, x1 = 0.0f, y0 = (float)height, y1 = 0.0f, x, y;
+	int i;
+
+	for (i = 0; i < 8; ++i)
+	{
+		corner[0] = centre[0] + (i & 1 ? radius : -radius);
+		corner[1] = centre[1] + (i & 2 ? radius : -radius);
+		corner[2] = centre[2] + (i & 4 ? radius : -radius);
+		corner[3] = 1.0f;
+		transform(clip, projection, corner);
+		x = (clip[0] / clip[3] * 0.5f + 0.5f) * width;
+		y = (clip[1] / clip[3] * 0.5f + 0.5f) * height;
+		x0 = x < x0 ? x : x0;
+		x1 = x > x1 ? x : x1;
+		y0 = y < y0 ? y : y0;
+		y1 = y > y1 ? y : y1;
+	}
+	b[0] = clampInt((int)floorf(x0 / tileWidth), 0, CLUSTER_TILES_X - 1);
+	b[1] = clampInt((int)floorf(x1 / tileWidth), 0, CLUSTER_TILES_X - 1);
+	b[2] = clampInt((int)floorf(y0 / tileHeight), 0, CLUSTER_TILES_Y - 1);
+	b[3] = clampInt((int)floorf(y1 / tileHeight), 0, CLUSTER_TILES_Y - 1);
+}
+
+static void upload(int buffer, unsigned int unit, const void* data, size_t size)
+{
+	glBindBuffer(GL_TEXTURE_BUFFER, buffers[buffer]);
+	glBufferData(GL_TEXTURE_BUFFER, size ? size : 16, size ? data : NULL, GL_STREAM_DRAW);
+	glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(GL_TEXTURE_BUFFER, textures[buffer]);
+}
+
+void binClusteredLights(const PointLight* lights, int count, int width, int height,
+	float zNear, float zFar, SceneUniforms* scene)
+{
+	float sliceScale = CLUSTER_SLICES / logf(zFar / zNear);
+	float sliceBias = -logf(zNear) * sliceScale;
+	float tileWidth = ceilf(width / (float)CLUSTER_TILES_X);
+	float tileHeight = ceilf(height / (float)CLUSTER_TILES_Y);
+	float position[4], centre[4], nearest, farthest;
+	int i, binned, total, x, y, z, c, tiles[4];
+
+	if (count > MAX_POINT_LIGHTS)
+		count = MAX_POINT_LIGHTS;
+
+	/* Count the lights in each cluster, keeping the light data and the
+	 * clusters each overlaps */
+	memset(grid, 0, sizeof(grid));
+	stats.maxPerCluster = 0;
+	binned = 0;
+	for (i = 0; i < count; ++i)
+	{
+		memcpy(position, lights[i].position, sizeof(float) * 3);
+		position[3] = 1.0f;
+		transform(centre, scene->modelView, position);
+		nearest = -centre[2] - lights[i].radius;
+		farthest = -centre[2] + lights[i].radius;
+		if (farthest <= zNear || nearest >= zFar)
+			continue;
+
+		bounds[binned].z0 = slice(nearest > zNear ? nearest : zNear, sliceScale, sliceBias);
+		bounds[binned].z1 = slice(farthest < zFar ? farthest : zFar, sliceScale, sliceBias);
+		if (nearest <= zNear)
+		{
+			/* Around the camera, the projected box means nothing */
+			tiles[0] = tiles[2] = 0;
+			tiles[1] = CLUSTER_TILES_X - 1;
+			tiles[3] = CLUSTER_TILES_Y - 1;
+		}
+		else
+			tileBounds(tiles, centre, lights[i].radius, scene->projection,
+				tileWidth, tileHeight, width, height);
+		bounds[binned].x0 = tiles[0];
+		bounds[binned].x1 = tiles[1];
+		bounds[binned].y0 = tiles[2];
+		bounds[binned].y1 = tiles[3];
+
+		memcpy(lightData + binned * 8, centre, sizeof(float) * 3);
+		lightData[binned * 8 + 3] = lights[i].radius;
+		memcpy(lightData + binned * 8 + 4, lights[i].colour, sizeof(float) * 3);
+		lightData[binned * 8 + 7] = 1.0f;
+
+		for (z = bounds[binned].z0; z <= bounds[binned].z1; ++z)
+			for (y = tiles[2]; y <= tiles[3]; ++y)
+				for (x = tiles[0]; x <= tiles[1]; ++x)
+					++grid[((z * CLUSTER_TILES_Y + y) * CLUSTER_TILES_X + x) * 2 + 1];
+		++binned;
+	}
+
+	/* Each cluster's lights follow the previous cluster's */
+	total = 0;
+	for (c = 0; c < NUM_CLUSTERS; ++c)
+	{
+		grid[c * 2] = fill[c] = total;
+		total += grid[c * 2 + 1];
+		if ((int)grid[c * 2 + 1] > stats.maxPerCluster)
+			stats.maxPerCluster = grid[c * 2 + 1];
+	}
+	if (total > maxIndices)
+	{
+		maxIndices = total * 2;
+		indices = (unsigned int*)realloc(indices, sizeof(unsigned int) * maxIndices);
+	}
+	for (i = 0; i < binned; ++i)
+		for (z = bounds[i].z0; z <= bounds[i].z1; ++z)
+			for (y = bounds[i].y0; y <= bounds[i].y1; ++y)
+				for (x = bounds[i].x0; x <= bounds[i].x1; ++x)
+					indices[fill[(z * CLUSTER_TILES_Y + y) * CLUSTER_TILES_X + x]++] = i;
+
+	scene->clusterParams[0] = tileWidth;
+	scene->clusterParams[1] = tileHeight;
+	scene->clusterParams[2] = sliceScale;
+	scene->clusterParams[3] = sliceBias;
+	scene->clusterCount[0] = CLUSTER_TILES_X;
+	scene->clusterCount[1] = CLUSTER_TILES_Y;
+	scene->clusterCount[2] = CLUSTER_SLICES;
+	scene->clusterCount[3] = binned;
+
+	stats.lights = binned;
+	stats.indices = total;
+}
+
+int clusterLights(int x, int y, int z, const unsigned int** lights)
+{
+	int c = (z * CLUSTER_TILES_Y + y) * CLUSTER_TILES_X + x;
+	*lights = indices + grid[c * 2];
+	return (int)grid[c * 2 + 1];
+}
+
+void updateClusteredLights(const PointLight* lights, int count, int width, int height,
+	float zNear, float zFar, SceneUniforms* scene)
+{
+	double start = getTime();
+
+	if (!created)
+		createBuffers();
+	binClusteredLights(lights, count, width, height, zNear, zFar, scene);
+
+	/* Orphaned every frame, the driver can keep the old ones for frames
+	 * still in flight */
+	upload(GRID, CLUSTER_GRID_UNIT, grid, sizeof(grid));
+	upload(INDICES, CLUSTER_LIGHTS_UNIT, indices, sizeof(unsigned int) * stats.indices);
+	upload(LIGHTS, POINT_LIGHTS_UNIT, lightData, sizeof(float) * 8 * stats.lights);
+	glActiveTexture(GL_TEXTURE0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	stats.binMs = (getTime() - start) * 1000.0;
+}
+
+void clusteredLightStats(ClusterStats* s)
+{
+	*s = stats;
+}
+
+void freeClusteredLights()
+{
+	if (created)
+	{
+		glDeleteTextures(NUM_BUFFERS, textures);
+		glDeleteBuffers(NUM_BUFFERS, buffers);
+	}
+	created = 0;
+	free(indices);
+	indices = NULL;
+	maxIndices = 0;
+}
@@ -0,0 +1,70 @@
+/* clustered-lights.h */
+
+#ifndef CLUSTERED_LIGHTS_H
+#define CLUSTERED_LIGHTS_H
+
+#include "scene-uniforms.h"
+
+/* View space clusters: screen tiles times exponentially spaced depth slices */
+#define CLUSTER_TILES_X 16
+#define CLUSTER_TILES_Y 9
+#define CLUSTER_SLICES 24
+#define MAX_POINT_LIGHTS 1024
+
+/* Texture units the clustered shaders read their buffers from */
+#define CLUSTER_GRID_UNIT 1
+#define CLUSTER_LIGHTS_UNIT 2
+#define POINT_LIGHTS_UNIT 3
+
+typedef struct {
+	float position[3]; /* world space */
+	float radius; /* no light past this */
+	float colour[3];
+	float pad;
+} PointLight;
+
+typedef struct {
+	int lights; /* binned, after culling those behind the camera */
+	int indices; /* light references over every cluster */
+	int maxPerCluster;
+	double binMs; /* CPU time of the last updateClusteredLights() */
+} ClusterStats;
+
+/* Forward shading with many point lights. Each frame the CPU bins the
+ * lights into the clusters they might touch, and uploads that as texture
+ * buffers: per cluster an offset and count (RG32UI), the light indices
+ * (R32UI), and each light's eye space position, radius and colour (RGBA32F).
+ * The fragment shader finds its cluster from gl_FragCoord and depth and
+ * loops over just those lights.
+
+USAGE:
+bindClusteredLights(program); once per program with CLUSTERED defined
+updateClusteredLights(lights, count, width, height, zNear, zFar, &scene); each frame, before updateSceneUniforms()
+*/
+
+/* GL 3.1, the shaders need GLSL 1.40 for buffer samplers */
+int clusteredLightsSupported();
+
+/* Points the program's samplers at the units above */
+void bindClusteredLights(GLuint program);
+
+/* Bins lights with scene's modelView and projection for a width x height
+ * viewport, uploads and binds the buffers, and fills in the scene's cluster
+ * fields */
+void updateClusteredLights(const PointLight* lights, int count, int width, int height,
+	float zNear, float zFar, SceneUniforms* scene);
+
+/* Just the binning, without GL: fills in the scene's cluster fields and the
+ * stats but uploads nothing */
+void binClusteredLights(const PointLight* lights, int count, int width, int height,
+	float zNear, float zFar, SceneUniforms* scene);
+
+/* The indices of the binned lights in cluster (x, y, z) from the last
+ * binning, returning how many */
+int clusterLights(int x, int y, int z, const unsigned int** lights);
+
+void clusteredLightStats(ClusterStats* stats);
+
+void freeClusteredLights();
+
+#endif
@@ -0,0 +1,99 @@
+/* frame-pacer.c */
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#define _POSIX_C_SOURCE 199309L
+#include <time.h>
+#endif
+
+#include "frame-pacer.h"
+#include "timer.h"
+
+#define MIN_SPIN 0.0002 /* seconds, sleeps wake at least this late */
+#define MAX_SPIN 0.004
+#define COST_SMOOTHING 0.1 /* weight of the newest frame */
+#define SPIN_SMOOTHING 0.1 /* weight of the newest sleep */
+#define DROP_MARGIN 0.9 /* go back to a faster multiple below this much of it */
+
+static void sleepFor(double seconds)
+{
+#ifdef _WIN32
+	Sleep((DWORD)(seconds * 1000.0));
+#else
+	struct timespec duration;
+	duration.tv_sec = (time_t)seconds;
+	duration.tv_nsec = (long)((seconds - duration.tv_sec) * 1e9);
+	nanosleep(&duration, NULL);
+#endif
+}
+
+void initFramePacer(FramePacer* pacer, double budget, int adaptive)
+{
+	pacer->budget = budget > 0.0 ? budget : 0.0;
+	pacer->adaptive = adaptive;
+	pacer->multiple = 1;
+	pacer->cost = 0.0;
+	pacer->otherCost = 0.0;
+	pacer->spin = MIN_SPIN;
+	pacer->frameStart = getTime();
+	pacer->waited = 0.0;
+}
+
+/* Sleeps most of the way and spins the rest, learning how late sleeps wake */
+static void waitUntil(FramePacer* pacer, double deadline)
+{
+	double now = getTime();
+	double wake, late;
+
+	if (deadline - now > pacer->spin)
+	{
+		wake = deadline - pacer->spin;
+		sleepFor(wake - now);
+		late = getTime() - wake;
+		/* Twice the typical lateness. The odd very late wake up (another
+		 * process got the CPU) would cost a frame of spinning to cover, so
+		 * it only nudges the margin. */
+		pacer->spin += (2.0 * late - pacer->spin) * SPIN_SMOOTHING;
+		pacer->spin = pacer->spin < MIN_SPIN ? MIN_SPIN : pacer->spin > MAX_SPIN ? MAX_SPIN : pacer->spin;
+	}
+	while (getTime() < deadline)
+		;
+}
+
+void paceFrame(FramePacer* pacer)
+{
+	const double now = getTime();
+	double cost = now - pacer->frameStart;
+	double deadline;
+
+	if (pacer->otherCost > cost)
+		cost = pacer->otherCost;
+
+	pacer->cost = pacer->cost > 0.0 ? pacer->cost + (cost - pacer->cost) * COST_SMOOTHING : cost;
+	pacer->waited = 0.0;
+	if (pacer->budget <= 0.0)
+	{
+		pacer->frameStart = now;
+		return;
+	}
+
+	if (pacer->adaptive)
+	{
+		if (pacer->cost > pacer->multiple * pacer->budget && pacer->multiple < PACER_MAX_MULTIPLE)
+			++pacer->multiple;
+		else if (pacer->multiple > 1 && pacer->cost < (pacer->multiple - 1) * pacer->budget * DROP_MARGIN)
+			--pacer->multiple;
+	}
+
+	/* Missed it, start again from now rather than rushing to catch up */
+	deadline = pacer->frameStart + pacer->multiple * pacer->budget;
+	if (deadline <= now)
+	{
+		pacer->frameStart = now;
+		return;
+	}
+	waitUntil(pacer, deadline);
+	pacer->waited = deadline - now;
+	pacer->frameStart = deadline;
+}
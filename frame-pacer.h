@@ -0,0 +1,40 @@
+/* frame-pacer.h */
+
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H
+
+/* Ends each frame on a frame-time budget instead of as soon as it is drawn.
+ * paceFrame() sleeps until shortly before the frame's deadline, then spins
+ * for the rest, so the wake up is exact without burning the whole frame.
+ * The spin margin follows how late sleeps typically wake. Adaptive
+ * pacing keeps a smoothed frame cost, and when it doesn't fit the budget
+ * paces at a whole multiple of it (e.g. 30 Hz for a 60 Hz budget) so frames
+ * stay evenly spaced instead of alternating between one and two budgets.
+ * Deadlines follow on from each other, so a late wake up doesn't shift the
+ * next frame.
+ * When part of each frame runs on another thread (a render thread), the
+ * caller puts its latest time in otherCost, and the frame costs whichever
+ * is longer.
+
+USAGE:
+FramePacer pacer;
+initFramePacer(&pacer, 1.0 / 60.0, 1);
+every frame: ... swap; paceFrame(&pacer);
+*/
+#define PACER_MAX_MULTIPLE 4 /* slowest adaptive pacing, in budgets */
+
+typedef struct {
+	double budget; /* seconds per frame, 0 to not wait */
+	int adaptive;
+	int multiple; /* budgets per frame */
+	double cost; /* smoothed seconds of work per frame, without waiting */
+	double otherCost; /* seconds of the frame's work on other threads, set by the caller */
+	double spin; /* seconds before a deadline to stop sleeping */
+	double frameStart; /* when the current frame began */
+	double waited; /* seconds the last paceFrame() waited */
+} FramePacer;
+
+void initFramePacer(FramePacer* pacer, double budget, int adaptive);
+void paceFrame(FramePacer* pacer);
+
+#endif
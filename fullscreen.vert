@@ -0,0 +1,7 @@
+// vertex shader for the deferred lighting pass
+// one triangle covering the screen, from gl_VertexID, no vertex arrays
+
+void main(void) {
+	vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+	gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,97 @@
+/* gbuffer.c */
+
+#include <GL/glew.h>
+
+#include "gbuffer.h"
+
+enum { NORMAL, MATERIAL, DEPTH, NUM_TARGETS };
+
+static GLuint framebuffer = 0;
+static GLuint textures[NUM_TARGETS];
+static int gbufferWidth = 0, gbufferHeight = 0;
+
+int gbufferSupported()
+{
+	return GLEW_VERSION_3_0;
+}
+
+void bindGBufferSamplers(GLuint program)
+{
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "gbufferNormal"), GBUFFER_NORMAL_UNIT);
+	glUniform1i(glGetUniformLocation(program, "gbufferMaterial"), GBUFFER_MATERIAL_UNIT);
+	glUniform1i(glGetUniformLocation(program, "gbufferDepth"), GBUFFER_DEPTH_UNIT);
+	glUseProgram(0);
+}
+
+static void target(GLuint texture, GLint internalFormat, GLenum format, GLenum type)
+{
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, gbufferWidth, gbufferHeight, 0,
+		format, type, NULL);
+}
+
+/* Allocates the targets at the new size, keeping the objects */
+static void resize(int width, int height)
+{
+	if (!framebuffer)
+	{
+		glGenFramebuffers(1, &framebuffer);
+		glGenTextures(NUM_TARGETS, textures);
+	}
+	gbufferWidth = width;
+	gbufferHeight = height;
+
+	target(textures[NORMAL], GL_RGBA16F, GL_RGBA, GL_FLOAT);
+	target(textures[MATERIAL], GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+	target(textures[DEPTH], GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[NORMAL], 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, textures[MATERIAL], 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, textures[DEPTH], 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void beginGBuffer(int width, int height)
+{
+	static const GLenum drawBuffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+
+	if (width != gbufferWidth || height != gbufferHeight)
+		resize(width, height);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glDrawBuffers(2, drawBuffers);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void endGBuffer()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glActiveTexture(GL_TEXTURE0 + GBUFFER_NORMAL_UNIT);
+	glBindTexture(GL_TEXTURE_2D, textures[NORMAL]);
+	glActiveTexture(GL_TEXTURE0 + GBUFFER_MATERIAL_UNIT);
+	glBindTexture(GL_TEXTURE_2D, textures[MATERIAL]);
+	glActiveTexture(GL_TEXTURE0 + GBUFFER_DEPTH_UNIT);
+	glBindTexture(GL_TEXTURE_2D, textures[DEPTH]);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+size_t gbufferBytes()
+{
+	return (size_t)gbufferWidth * gbufferHeight * (8 + 4 + 4);
+}
+
+void freeGBuffer()
+{
+	if (framebuffer)
+	{
+		glDeleteFramebuffers(1, &framebuffer);
+		glDeleteTextures(NUM_TARGETS, textures);
+	}
+	framebuffer = 0;
+	gbufferWidth = gbufferHeight = 0;
+}
@@ -0,0 +1,43 @@
+/* gbuffer.h */
+
+#ifndef GBUFFER_H
+#define GBUFFER_H
+
+#include <stddef.h>
+
+/* Texture units the lighting pass reads the G-buffer from, after the
+ * clustered lights' */
+#define GBUFFER_NORMAL_UNIT 4
+#define GBUFFER_MATERIAL_UNIT 5
+#define GBUFFER_DEPTH_UNIT 6
+
+/* Render targets for deferred shading: the eye space normal and shininess
+ * (RGBA16F), the material's diffuse colour (RGBA8) and depth (24 bit). The
+ * geometry pass writes them with the GBUFFER shaders, then a fullscreen
+ * triangle with DEFERRED_LIGHTING shades each pixel once.
+
+USAGE:
+bindGBufferSamplers(program); once per lighting program
+beginGBuffer(width, height); draw the scene; endGBuffer(); each frame
+draw the lighting pass
+*/
+
+/* GL 3.0, for framebuffer objects and texelFetch */
+int gbufferSupported();
+
+/* Points the program's G-buffer samplers at the units above */
+void bindGBufferSamplers(GLuint program);
+
+/* Draws into the G-buffer, (re)allocating it for a width x height viewport,
+ * and clears it */
+void beginGBuffer(int width, int height);
+
+/* Back to the window, with the G-buffer bound to the units above */
+void endGBuffer();
+
+/* Size of the render targets, in bytes */
+size_t gbufferBytes();
+
+void freeGBuffer();
+
+#endif
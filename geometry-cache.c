@@ -0,0 +1,132 @@
+/* geometry-cache.c */
+
+#include <stdlib.h>
+
+#include "geometry-cache.h"
+
+/* Doubly linked, most recently used first. Only a handful of states are
+ * reachable from the keyboard, so lookups just walk the list. */
+typedef struct CacheEntry {
+	MeshRequest request;
+	Object* obj;
+	size_t bytes;
+	struct CacheEntry* prev;
+	struct CacheEntry* next;
+} CacheEntry;
+
+static CacheEntry* head = NULL;
+static CacheEntry* tail = NULL;
+static GeometryCacheStats stats = {0, 0, 0, 0, 0, 256 << 20};
+
+/* Index buffers are shared by every object of a grid size and freed with
+ * the last of them, so only vertex data counts towards the budget */
+static size_t objectBytes(const Object* obj)
+{
+	return objectVertexBytes(obj);
+}
+
+static void unlinkEntry(CacheEntry* entry)
+{
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		head = entry->next;
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		tail = entry->prev;
+}
+
+static void pushFront(CacheEntry* entry)
+{
+	entry->prev = NULL;
+	entry->next = head;
+	if (head)
+		head->prev = entry;
+	else
+		tail = entry;
+	head = entry;
+}
+
+static void removeEntry(CacheEntry* entry)
+{
+	unlinkEntry(entry);
+	stats.bytes -= entry->bytes;
+	--stats.count;
+	freeObject(entry->obj);
+	free(entry);
+}
+
+void setGeometryCacheBudget(size_t bytes)
+{
+	stats.budget = bytes;
+}
+
+static CacheEntry* find(const MeshRequest* request)
+{
+	CacheEntry* entry;
+	for (entry = head; entry; entry = entry->next)
+		if (sameMeshRequest(&entry->request, request))
+			return entry;
+	return NULL;
+}
+
+Object* findGeometry(const MeshRequest* request)
+{
+	CacheEntry* entry = find(request);
+	if (!entry)
+	{
+		++stats.misses;
+		return NULL;
+	}
+	++stats.hits;
+	unlinkEntry(entry);
+	pushFront(entry);
+	return entry->obj;
+}
+
+void cacheGeometry(const MeshRequest* request, Object* obj)
+{
+	CacheEntry* entry = find(request);
+	if (entry)
+	{
+		if (entry->obj == obj)
+			return;
+		removeEntry(entry);
+	}
+
+	entry = (CacheEntry*)malloc(sizeof(CacheEntry));
+	entry->request = *request;
+	entry->obj = obj;
+	entry->bytes = objectBytes(obj);
+	pushFront(entry);
+	stats.bytes += entry->bytes;
+	++stats.count;
+}
+
+void trimGeometryCache(const Object* inUse)
+{
+	CacheEntry* entry = tail;
+	CacheEntry* prev;
+	while (entry && stats.bytes > stats.budget)
+	{
+		prev = entry->prev;
+		if (entry->obj != inUse)
+		{
+			removeEntry(entry);
+			++stats.evictions;
+		}
+		entry = prev;
+	}
+}
+
+void geometryCacheStats(GeometryCacheStats* out)
+{
+	*out = stats;
+}
+
+void clearGeometryCache()
+{
+	while (head)
+		removeEntry(head);
+}
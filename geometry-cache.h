@@ -0,0 +1,43 @@
+/* geometry-cache.h */
+
+#ifndef GEOMETRY_CACHE_H
+#define GEOMETRY_CACHE_H
+
+#include <stddef.h>
+
+#include "objects.h"
+#include "mesh-builder.h"
+
+/* GPU resident Objects kept after they stop being displayed, keyed by the
+ * MeshRequest that built them, so revisiting a surface, tessellation level
+ * and argument set is a lookup rather than a rebuild. Least recently used
+ * Objects are freed once their total size goes over the budget. The cache
+ * owns everything put into it.
+
+USAGE:
+if (!(obj = findGeometry(&request))) { ...build it... cacheGeometry(&request, obj); }
+trimGeometryCache(obj);
+*/
+typedef struct {
+	int hits, misses, evictions;
+	int count; /* Objects currently cached */
+	size_t bytes; /* their vertex buffer sizes */
+	size_t budget;
+} GeometryCacheStats;
+
+void setGeometryCacheBudget(size_t bytes);
+
+/* The cached Object for request, now the most recently used, or NULL */
+Object* findGeometry(const MeshRequest* request);
+
+/* Adds obj as the most recently used, replacing any Object cached for the
+ * same request. Does not evict, see trimGeometryCache(). */
+void cacheGeometry(const MeshRequest* request, Object* obj);
+
+/* Frees least recently used Objects until within budget, except inUse */
+void trimGeometryCache(const Object* inUse);
+
+void geometryCacheStats(GeometryCacheStats* stats);
+void clearGeometryCache(); /* frees every cached Object */
+
+#endif
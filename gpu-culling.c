@@ -0,0 +1,189 @@
+/* gpu-culling.c */
+
+#include <GL/glew.h>
+
+#include <math.h>
+#include <string.h>
+
+#include "gpu-culling.h"
+#include "shaders.h"
+
+#define WORK_GROUP_SIZE 64 /* as local_size_x in gpu-culling.comp */
+#define Z_NEAR 0.1f /* closest distance sizes are worked out at */
+
+/* Storage buffer bindings in gpu-culling.comp */
+enum { INSTANCES, VISIBLE, COMMANDS };
+
+static GLuint visible = 0; /* levels regions of capacity instances */
+static GLuint commands = 0;
+static GLuint resetCommands = 0; /* the commands with no instances, copied over them each cull */
+static int capacity = 0;
+static int levels = 0;
+static int culled = 0;
+
+static struct {
+	GLuint program;
+	GLint modelView, planes, radius, pixelScale, cellPixels, zNear, count, minTess, levels;
+} cull;
+
+int gpuCullingSupported()
+{
+	return GLEW_VERSION_4_3;
+}
+
+/* The program, again whenever the shader has been reloaded */
+static int getProgram()
+{
+	GLuint program = getComputeShader("gpu-culling.comp", "#version 430\n");
+	if (program && program != cull.program)
+	{
+		cull.program = program;
+		cull.modelView = glGetUniformLocation(program, "modelView");
+		cull.planes = glGetUniformLocation(program, "planes");
+		cull.radius = glGetUniformLocation(program, "radius");
+		cull.pixelScale = glGetUniformLocation(program, "pixelScale");
+		cull.cellPixels = glGetUniformLocation(program, "cellPixels");
+		cull.zNear = glGetUniformLocation(program, "zNear");
+		cull.count = glGetUniformLocation(program, "count");
+		cull.minTess = glGetUniformLocation(program, "minTess");
+		cull.levels = glGetUniformLocation(program, "levels");
+	}
+	return program != 0;
+}
+
+/* Room for count instances in each of the chain's levels, with each level's
+ * command pointing at its region */
+static void reserve(LodChain* chain, int count)
+{
+	DrawElementsIndirectCommand reset[MAX_LOD_LEVELS];
+	int i;
+
+	if (count <= capacity && chain->levels == levels)
+		return;
+	if (!visible)
+	{
+		glGenBuffers(1, &visible);
+		glGenBuffers(1, &commands);
+		glGenBuffers(1, &resetCommands);
+	}
+	capacity = count;
+	levels = chain->levels;
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, visible);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(Instance) * capacity * levels, NULL, GL_DYNAMIC_COPY);
+	for (i = 0; i < levels; ++i)
+	{
+		reset[i] = chain->draws[i];
+		reset[i].baseInstance = i * capacity;
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, resetCommands);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(reset[0]) * levels, reset, GL_STATIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, commands);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(reset[0]) * levels, NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+/* From the projection's rows (Gribb and Hartmann) */
+void frustumPlanes(const float* projection, float planes[6][4])
+{
+	float length;
+	int p, j;
+
+	for (p = 0; p < 6; ++p)
+	{
+		const float sign = p % 2 ? -1.0f : 1.0f;
+		for (j = 0; j < 4; ++j)
+			planes[p][j] = projection[j * 4 + 3] + sign * projection[j * 4 + p / 2];
+		length = sqrtf(planes[p][0] * planes[p][0] + planes[p][1] * planes[p][1] +
+				planes[p][2] * planes[p][2]);
+		for (j = 0; j < 4; ++j)
+			planes[p][j] /= length;
+	}
+}
+
+void cullInstances(LodChain* chain, GLuint instances, int count, float radius,
+		const float* modelView, const float* projection, int viewportHeight)
+{
+	float planes[6][4];
+
+	culled = 0;
+	if (!getProgram())
+		return;
+	reserve(chain, count);
+	culled = count;
+
+	/* Every level's command starts from no instances */
+	glBindBuffer(GL_COPY_READ_BUFFER, resetCommands);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, commands);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+			sizeof(DrawElementsIndirectCommand) * levels);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	frustumPlanes(projection, planes);
+	glUseProgram(cull.program);
+	glUniformMatrix4fv(cull.modelView, 1, GL_FALSE, modelView);
+	glUniform4fv(cull.planes, 6, planes[0]);
+	glUniform1f(cull.radius, radius);
+	glUniform1f(cull.pixelScale, projection[5] * viewportHeight * 0.5f);
+	glUniform1f(cull.cellPixels, LOD_CELL_PIXELS);
+	glUniform1f(cull.zNear, Z_NEAR);
+	glUniform1i(cull.count, count);
+	glUniform1i(cull.minTess, chain->minTess);
+	glUniform1i(cull.levels, levels);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INSTANCES, instances);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, VISIBLE, visible);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, COMMANDS, commands);
+	glDispatchCompute((count + WORK_GROUP_SIZE - 1) / WORK_GROUP_SIZE, 1, 1);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INSTANCES, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, VISIBLE, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, COMMANDS, 0);
+	glUseProgram(0);
+
+	/* The draw reads the counts as commands and the copies as attributes */
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+}
+
+void drawCulledInstances(LodChain* chain)
+{
+	if (culled)
+		drawLodChainIndirect(chain, visible, commands);
+}
+
+void gpuCullingStats(CullingStats* stats)
+{
+	DrawElementsIndirectCommand counts[MAX_LOD_LEVELS];
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+	if (!culled)
+		return;
+	glBindBuffer(GL_COPY_READ_BUFFER, commands);
+	glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(counts[0]) * levels, counts);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	stats->instances = culled;
+	for (i = 0; i < levels; ++i)
+	{
+		stats->perLevel[i] = counts[i].instanceCount;
+		stats->visible += counts[i].instanceCount;
+	}
+}
+
+size_t gpuCullingBytes()
+{
+	return sizeof(Instance) * capacity * levels + sizeof(DrawElementsIndirectCommand) * levels * 2;
+}
+
+void freeGpuCulling()
+{
+	if (visible)
+	{
+		glDeleteBuffers(1, &visible);
+		glDeleteBuffers(1, &commands);
+		glDeleteBuffers(1, &resetCommands);
+	}
+	visible = commands = resetCommands = 0;
+	capacity = levels = culled = 0;
+	cull.program = 0; /* owned by the shader cache */
+}
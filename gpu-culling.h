@@ -0,0 +1,52 @@
+/* gpu-culling.h */
+
+#ifndef GPU_CULLING_H
+#define GPU_CULLING_H
+
+#include "objects.h"
+
+/* Frustum culling and level of detail for a buffer of Instances, without
+ * the CPU looking at any of them. gpu-culling.comp runs once per instance,
+ * tests its bounding sphere against the view frustum and, if any of it is
+ * in view, picks the LodChain level its size on screen needs and appends it
+ * to that level's instances, counting them into the level's indirect draw
+ * command. drawCulledInstances() then draws every level with one
+ * glMultiDrawElementsIndirect. Each level has room for every instance, so
+ * the copies take levels times the instance buffer.
+
+USAGE:
+cullInstances(chain, instances, count, radius, modelView, projection, viewportHeight);
+with the program for INDIRECT_LODS bound: drawCulledInstances(chain);
+*/
+
+/* Grid cells are wanted about this many pixels across */
+#define LOD_CELL_PIXELS 8.0f
+
+typedef struct {
+	int instances; /* culled last time */
+	int visible;
+	int perLevel[MAX_LOD_LEVELS];
+} CullingStats;
+
+/* GL 4.3, for compute shaders, storage buffers and multi draw indirect */
+int gpuCullingSupported();
+
+/* Culls count instances whose objects fit in a sphere of radius about their
+ * origin, for the camera's column major modelView and projection */
+void cullInstances(LodChain* chain, GLuint instances, int count, float radius,
+		const float* modelView, const float* projection, int viewportHeight);
+void drawCulledInstances(LodChain* chain);
+
+/* The eye space frustum planes of a projection, facing in and normalised:
+ * left, right, bottom, top, near, far */
+void frustumPlanes(const float* projection, float planes[6][4]);
+
+/* Reads the last cull's counts back from the GPU, which waits for it */
+void gpuCullingStats(CullingStats* stats);
+
+/* Bytes of the culled copies and commands */
+size_t gpuCullingBytes();
+
+void freeGpuCulling();
+
+#endif
@@ -0,0 +1,255 @@
+/* mesh-builder.c */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <GL/glew.h>
+
+#include "mesh-builder.h"
+#include "profiler.h"
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t doneCond = PTHREAD_COND_INITIALIZER;
+static pthread_t thread;
+static int started = 0;
+static int quitFlag = 0;
+
+/* Shared with the builder thread, under lock */
+static MeshRequest pending;
+static int hasPending = 0;
+static int building = 0;
+static MeshRequest last; /* most recent request, to spot shape changes */
+static unsigned shape = 0; /* bumped when the surface or grid size changes */
+static Mesh ready;
+static MeshRequest readyRequest;
+static int hasReady = 0;
+static unsigned readyShape;
+
+/* Read by the worker pool while building, set when the build is stale */
+static volatile int cancelBuild = 0;
+
+/* GL thread only: an uploaded Object waiting for its fence */
+static Object* uploaded = NULL;
+static MeshRequest uploadedRequest;
+static unsigned uploadedShape;
+static GLsync fence = 0;
+static int haveSync = -1; /* -1 until checked */
+
+static void* builderMain(void* arg)
+{
+	MeshRequest request;
+	unsigned generation;
+	Mesh mesh;
+	int built;
+
+	(void)arg;
+	pthread_mutex_lock(&lock);
+	for (;;)
+	{
+		while (!quitFlag && !hasPending)
+			pthread_cond_wait(&wakeCond, &lock);
+		if (quitFlag)
+			break;
+
+		request = pending;
+		generation = shape;
+		hasPending = 0;
+		building = 1;
+		cancelBuild = 0;
+		pthread_mutex_unlock(&lock);
+
+		built = buildMeshCancellable(&mesh, request.batch, &request.args,
+			request.x, request.y, &cancelBuild);
+		if (built)
+			packMesh(&mesh, request.format);
+
+		pthread_mutex_lock(&lock);
+		building = 0;
+		if (built && generation == shape)
+		{
+			if (hasReady)
+				freeMesh(&ready); /* never picked up, this one is newer */
+			ready = mesh;
+			readyRequest = request;
+			readyShape = generation;
+			hasReady = 1;
+		}
+		else if (built)
+			freeMesh(&mesh); /* reshaped after the last row was done */
+		pthread_cond_broadcast(&doneCond);
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+void requestMesh(const MeshRequest* request)
+{
+	pthread_mutex_lock(&lock);
+	if (!started)
+	{
+		quitFlag = 0;
+		if (pthread_create(&thread, NULL, builderMain, NULL))
+		{
+			pthread_mutex_unlock(&lock);
+			printf("Error starting mesh builder thread\n");
+			exit(EXIT_FAILURE);
+		}
+		started = 1;
+	}
+
+	/* Coalesce: replace any pending request. A build of a different surface
+	 * grid size or format is useless now, so cancel it and drop any finished one.
+	 * One that only differs in its arguments (animation) is still worth
+	 * showing, and cancelling those would starve the display when requests
+	 * come faster than builds finish. */
+	if (request->batch != last.batch || request->x != last.x || request->y != last.y ||
+		request->format != last.format)
+	{
+		++shape;
+		if (building)
+			cancelBuild = 1;
+		if (hasReady)
+		{
+			freeMesh(&ready);
+			hasReady = 0;
+		}
+	}
+	last = *request;
+	pending = *request;
+	hasPending = 1;
+	pthread_cond_signal(&wakeCond);
+	pthread_mutex_unlock(&lock);
+}
+
+static void discardUploaded()
+{
+	if (fence)
+		glDeleteSync(fence);
+	if (uploaded)
+		freeObject(uploaded);
+	fence = 0;
+	uploaded = NULL;
+}
+
+/* Hands over the uploaded Object if its fence has signalled within timeout
+ * nanoseconds */
+static Object* takeUploaded(GLuint64 timeout, MeshRequest* request)
+{
+	Object* obj;
+	GLenum status;
+
+	if (!uploaded)
+		return NULL;
+	if (fence)
+	{
+		status = glClientWaitSync(fence, timeout ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, timeout);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			return NULL;
+		glDeleteSync(fence);
+		fence = 0;
+	}
+	obj = uploaded;
+	uploaded = NULL;
+	if (request)
+		*request = uploadedRequest;
+	return obj;
+}
+
+static void uploadReady()
+{
+	Mesh mesh;
+	MeshRequest meshRequest;
+	unsigned meshShape, current;
+	int haveMesh;
+
+	if (haveSync < 0)
+		haveSync = GLEW_VERSION_3_2 || GLEW_ARB_sync;
+
+	/* Let an upload in flight finish first, or a steady stream of new
+	 * meshes could keep replacing it before its fence signals */
+	pthread_mutex_lock(&lock);
+	current = shape;
+	haveMesh = hasReady && (!uploaded || uploadedShape != current);
+	if (haveMesh)
+	{
+		mesh = ready;
+		meshRequest = readyRequest;
+		meshShape = readyShape;
+		hasReady = 0;
+	}
+	pthread_mutex_unlock(&lock);
+
+	/* The surface changed since this was uploaded */
+	if (uploaded && uploadedShape != current)
+		discardUploaded();
+
+	if (haveMesh)
+	{
+		discardUploaded();
+		PROFILE_BEGIN("upload");
+		uploaded = uploadMesh(&mesh);
+		PROFILE_END();
+		uploadedRequest = meshRequest;
+		uploadedShape = meshShape;
+		if (haveSync)
+		{
+			fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			glFlush();
+		}
+	}
+}
+
+Object* pollMesh(MeshRequest* request)
+{
+	uploadReady();
+	return takeUploaded(0, request);
+}
+
+Object* finishMesh(MeshRequest* request)
+{
+	int newer;
+
+	if (!started)
+		return NULL;
+
+	pthread_mutex_lock(&lock);
+	while (hasPending || building)
+		pthread_cond_wait(&doneCond, &lock);
+	newer = hasReady;
+	pthread_mutex_unlock(&lock);
+
+	/* An upload still in flight is older than what was just built */
+	if (newer)
+		discardUploaded();
+	uploadReady();
+	return takeUploaded(~(GLuint64)0, request);
+}
+
+int sameMeshRequest(const MeshRequest* a, const MeshRequest* b)
+{
+	return a->batch == b->batch && a->x == b->x && a->y == b->y &&
+		a->format == b->format && !memcmp(&a->args, &b->args, sizeof(a->args));
+}
+
+void shutdownMeshBuilder()
+{
+	if (started)
+	{
+		pthread_mutex_lock(&lock);
+		quitFlag = 1;
+		cancelBuild = 1;
+		pthread_cond_signal(&wakeCond);
+		pthread_mutex_unlock(&lock);
+		pthread_join(thread, NULL);
+		started = 0;
+	}
+
+	if (hasReady)
+		freeMesh(&ready);
+	hasReady = 0;
+	hasPending = 0;
+	discardUploaded();
+}
@@ -0,0 +1,48 @@
+/* mesh-builder.h */
+
+#ifndef MESH_BUILDER_H
+#define MESH_BUILDER_H
+
+#include "objects.h"
+
+/* Builds meshes on a background thread so the render loop never waits for
+ * createObjectBatch(). Requests are coalesced, only the newest pending one
+ * gets built. Changing the surface or grid size also cancels the build in
+ * progress and throws away finished meshes of the old shape; builds that
+ * only differ in their arguments (e.g. the wave's time) run to completion
+ * so an animation keeps updating.
+
+USAGE:
+MeshRequest request = {batchTorus, {{0}}, 65, 65, VERTEX_HALF};
+request.args.torus.R = 1.0f; ...
+requestMesh(&request);
+...every frame, on the GL thread:
+if ((ready = pollMesh(NULL))) { freeObject(current); current = ready; }
+*/
+typedef struct {
+	ParametricBatchFunc batch;
+	ParametricArgs args; /* copied, so the caller's may go out of scope */
+	int x, y;
+	VertexFormat format; /* packMesh() to this after building */
+} MeshRequest;
+
+void requestMesh(const MeshRequest* request);
+
+/* GL thread only. Uploads a finished mesh and returns its Object once the
+ * GPU has the data (checked with a fence, without blocking), else NULL.
+ * If request is not NULL it receives the request the Object was built for,
+ * which need not be the latest one. */
+Object* pollMesh(MeshRequest* request);
+
+/* GL thread only. Blocks until the latest request is built and uploaded and
+ * returns it, or NULL if nothing was requested since the last poll. */
+Object* finishMesh(MeshRequest* request);
+
+/* Same surface, grid size, arguments and format. Compares args bytewise, so
+ * requests should be zeroed before filling them in. */
+int sameMeshRequest(const MeshRequest* a, const MeshRequest* b);
+
+/* Stops the thread and frees anything not yet handed out. GL thread only. */
+void shutdownMeshBuilder();
+
+#endif
@@ -1,11 +1,115 @@
 // vertex shader for per-pixel lighting
-// assumes single directional light
+// treats the scene lights as directional
+// with TESSELLATION it is built as the tessellation evaluation shader too,
+// and the vertex stage only places the patch corners for
+// mesh-generation.tesc
 
 #define M_PI 3.1415926535897932384626433832795
 
+#ifdef INSTANCED
+#extension GL_ARB_explicit_attrib_location : enable
+#endif
+
+#ifdef INDIRECT_LODS
+/* Drawn from a LodChain's vertex buffer whatever the grid, see gpu-culling.h */
+#undef ATTRIBUTELESS
+#endif
+
+#ifdef TESSELLATION
+/* Patches of gridSize - 1 by gridSize - 1 cells from gl_VertexID instead of
+ * the grid, subdivided on the GPU. Needs #version 400. */
+#undef ATTRIBUTELESS
+#endif
+
+#ifdef UNIFORM_BUFFER
+#extension GL_ARB_uniform_buffer_object : enable
+#define MAX_LIGHTS 4 /* as in scene-uniforms.h */
+#define MAX_MATERIALS 4
+
+struct Light {
+	vec4 position; /* eye space */
+	vec4 halfVector;
+	vec4 ambient;
+	vec4 diffuse;
+	vec4 specular;
+};
+
+/* Camera, lights and material, shared by every program. Must match
+ * SceneUniforms in scene-uniforms.h and the block in shader.frag. */
+layout(std140) uniform Scene {
+	mat4 modelView;
+	mat4 projection;
+	mat4 normalMatrix;
+	vec4 sceneAmbient;
+	vec4 materialAmbient;
+	vec4 materialDiffuse;
+	vec4 materialSpecular;
+	float materialShininess;
+	int numLights;
+	float time;
+	float uvScale;
+	ivec2 gridSize;
+	Light lights[MAX_LIGHTS];
+	vec4 clusterParams; /* tile width and height in pixels, slice scale and bias */
+	ivec4 clusterCount; /* tiles across and down, slices, point lights */
+	vec4 materials[MAX_MATERIALS]; /* diffuse colours for instances */
+};
+#define modelViewProjection (projection * modelView)
+
+#ifdef INSTANCED
+/* Per instance, see Instance in objects.h */
+layout(location = 4) in mat4 instanceModel;
+layout(location = 8) in vec2 instanceData; /* material, phase */
+
+/* The instance's material, for shade() and the fragment shader */
+varying vec4 instanceDiffuse;
+#define materialDiffuse instanceDiffuse
+#endif
+#else
+/* The fixed function state, which has one light */
+#define numLights 1
+#define lights gl_LightSource
+#define sceneAmbient gl_LightModel.ambient
+#define materialAmbient gl_FrontMaterial.ambient
+#define materialDiffuse gl_FrontMaterial.diffuse
+#define materialSpecular gl_FrontMaterial.specular
+#define materialShininess gl_FrontMaterial.shininess
+#define modelView gl_ModelViewMatrix
+#define normalMatrix gl_NormalMatrix
+#define modelViewProjection gl_ModelViewProjectionMatrix
+
+uniform float time;
+
+#ifdef ATTRIBUTELESS
+uniform ivec2 gridSize;
+#else
+uniform float uvScale;
+#endif
+#endif
+
+#ifdef TESSELLATION
+#ifdef TESS_EVALUATION_SHADER
+layout(quads, fractional_odd_spacing, ccw) in;
+in vec2 controlUV[];
+#define varying out
+#else
+out vec2 cornerUV;
+#endif
+#endif
+
 varying vec3 eye;
 varying vec3 normal;
-
+#ifdef CLUSTERED
+varying vec3 position; /* eye space, for the point lights */
+#endif
+
+#ifdef PERMUTATION
+/* Specialised for one state, the branches below fold away */
+const int object = OBJECT;
+const int lightingModel = LIGHTING_MODEL;
+const bool isLocalViewer = LOCAL_VIEWER;
+const bool isPerPixelLighting = PER_PIXEL;
+#else
 /* objects:
  *  0 = torus
  *  1 = wave
@@ -18,34 +122,107 @@ uniform int object;
  */
 uniform int lightingModel;
 
+uniform bool isLocalViewer;
+uniform bool isPerPixelLighting;
+#endif
+
 /* light type:
  *  0 = point
  *  1 = directional
  */
 uniform bool lightType;
 
-uniform bool isLocalViewer;
-uniform bool isPerPixelLighting;
+#ifdef ATTRIBUTELESS
+/* No vertex arrays: u and v come from gl_VertexID and gridSize, walking
+ * the same triangle strips, degenerate joins included, as a grid's index
+ * buffer. Needs #version 130. */
+vec2 gridUV(int id)
+{
+	int strip = id / (gridSize.x * 2 + 2);
+	int k = id - strip * (gridSize.x * 2 + 2);
+	ivec2 ij;
+	if (k == 0)
+		ij = ivec2(0, strip);
+	else if (k == gridSize.x * 2 + 1)
+		ij = ivec2(gridSize.x - 1, strip + 1);
+	else
+		ij = ivec2((k - 1) / 2, strip + (k - 1) % 2);
+	return vec2(ij) / vec2(gridSize - 1);
+}
+#endif
+
+#ifdef TESSELLATION
+/* Corner id % 4 of patch id / 4, anticlockwise from its lowest u and v */
+vec2 patchCorner(int id)
+{
+	int p = id / 4;
+	int corner = id % 4;
+	ivec2 ij = ivec2(p % (gridSize.x - 1), p / (gridSize.x - 1));
+	ij += ivec2(corner == 1 || corner == 2 ? 1 : 0, corner >= 2 ? 1 : 0);
+	return vec2(ij) / vec2(gridSize - 1);
+}
+#endif
 
-uniform float time;
+/* Phong or Blinn-Phong, summed over the lights */
+vec4 shade(vec3 normal, vec3 eye)
+{
+	const int Phong = 0;
+	const int BlinnPhong = 1;
 
-void main(void) {
+	// add global ambient
+	vec4 color = materialAmbient * sceneAmbient;
 
-	const int Torus = 0;
-	const int Wave  = 1;
+	for (int i = 0; i < numLights; ++i) {
 
-	const int Phong = 0;
-	const int BlinnPhong = 1;
+		// unit vector in direction of light, light source position/direction
+		// already transformed into eye space coordinates by modelview matrix
+		vec3 light = normalize(vec3(lights[i].position));
 
-	vec4 vertex;
+		// compute diffuse scalar
+		float NdotL = max(dot(normal, light), 0.0);
+
+		// add light ambient
+		color += materialAmbient * lights[i].ambient;
+
+		if (NdotL > 0.0) {
+			// add diffuse component
+			color += NdotL * materialDiffuse * lights[i].diffuse;
+
+			// add specular color depending on light model
+			if (lightingModel == Phong) {
+
+				// calculate reflection vector
+				vec3 reflection = reflect(light, normal);
+				float RdotE = max(dot(reflection, eye), 0.0);
+
+				color += pow(RdotE, materialShininess) *
+					lights[i].specular * materialSpecular;
+
+			} else /* lightingModel == BlinnPhong */ {
+
+				float NdotHV = max(dot(normal, lights[i].halfVector.xyz), 0.0);
+				color += materialSpecular * lights[i].specular *
+					pow(NdotHV, materialShininess);
+
+			}
+		}
+	}
+	return color;
+}
+
+/* The object's surface at u and v */
+void surface(vec2 uv, float waveTime, out vec4 vertex, out vec3 normal)
+{
+	const int Torus = 0;
+	const int Wave  = 1;
 
 	if (object == Torus) {
 
 		const float R = 1.0;
 		const float r = 0.5;
 
-		float u = gl_Vertex.x * 2.0 * M_PI;
-		float v = gl_Vertex.y * 2.0 * M_PI;
+		float u = uv.x * 2.0 * M_PI;
+		float v = uv.y * 2.0 * M_PI;
 
 		normal = vec3(
 				cos(u) * cos(v),
@@ -65,21 +242,21 @@ void main(void) {
 		const float Amplitude = 0.2;
 		const float Frequency = 5.0;
 
-		float u = gl_Vertex.x;
-		float v = gl_Vertex.y;
+		float u = uv.x;
+		float v = uv.y;
 
 		float phi = M_PI * Frequency * u;
 		float theta = M_PI * Frequency * v;
 
 		float x = -Amplitude * cos(theta) * sin(phi);
 		float y =  Amplitude * sin(theta) * cos(phi);
-		float z =  Amplitude * sin(theta + time) * sin (phi +time);
+		float z =  Amplitude * sin(theta + waveTime) * sin (phi +waveTime);
 		float m = sqrt(x * x + y * y + 1.0);
 
 		normal = vec3(
 				x / m,
 				y / m,
-				1 / m);
+				1.0 / m);
 
 		vertex = vec4(
 				(u - 0.5) * Width,
@@ -87,53 +264,55 @@ void main(void) {
 				z,
 				1);
 	}
+}
 
-	// set eye and normal vectors
-	eye = isLocalViewer ? normalize(vec3(gl_ModelViewMatrix * vertex)) : vec3(0.0, 0.0, -1.0);
-	normal = normalize(vec3(gl_NormalMatrix * normal));
-
-	// if vertex lit, set vertex color
-	if (!isPerPixelLighting) {
-
-		vec4 color = vec4(0.0);
-
-		// unit vector in direction of light, light source position/direction
-		// already transformed into eye space coordinates by modelview matrix
-		vec3 light = normalize(vec3(gl_LightSource[0].position));
-
-		// compute diffuse scalar
-		float NdotL = max(dot(normal, light), 0.0);
-
-		// add global and light ambient
-		color += gl_FrontMaterial.ambient * (gl_LightModel.ambient + gl_LightSource[0].ambient);
-
-		if (NdotL > 0.0) {
-			// add diffuse component
-			color += NdotL * gl_FrontMaterial.diffuse * gl_LightSource[0].diffuse;
-
-			// add specular color depending on light model
-			if (lightingModel == Phong) {
-
-				// calculate reflection vector
-				vec3 reflection = reflect(light, normal);
-				float RdotE = max(dot(reflection, eye), 0.0);
-
-				color += pow(RdotE, gl_FrontMaterial.shininess) *
-					gl_LightSource[0].specular * gl_FrontMaterial.specular;
+void main(void) {
 
-			} else /* lightingModel == BlinnPhong */ {
+	vec4 vertex;
+#ifdef INSTANCED
+	float waveTime = time + instanceData.y;
+	instanceDiffuse = materials[int(instanceData.x)];
+#else
+	float waveTime = time;
+#endif
+#if defined(TESSELLATION) && defined(TESS_EVALUATION_SHADER)
+	/* Across the patch from the corners the control shader passed on */
+	vec2 uv = mix(mix(controlUV[0], controlUV[1], gl_TessCoord.x),
+			mix(controlUV[3], controlUV[2], gl_TessCoord.x), gl_TessCoord.y);
+#elif defined(TESSELLATION)
+	vec2 uv = patchCorner(gl_VertexID);
+#elif defined(ATTRIBUTELESS)
+	vec2 uv = gridUV(gl_VertexID);
+#else
+	/* uvScale is 1 for float grids, 1/32767 for 16 bit fixed point ones */
+	vec2 uv = gl_Vertex.xy * uvScale;
+#endif
+
+	surface(uv, waveTime, vertex, normal);
+
+#if defined(TESSELLATION) && !defined(TESS_EVALUATION_SHADER)
+	/* Just the corner, where it lands sizes the patch's edges */
+	cornerUV = uv;
+	gl_Position = modelViewProjection * vertex;
+#else
+#ifdef INSTANCED
+	vertex = instanceModel * vertex;
+	normal = mat3(instanceModel) * normal;
+#endif
 
-				float NdotHV = max(dot(normal, gl_LightSource[0].halfVector.xyz), 0.0);
-				color += gl_FrontMaterial.specular * gl_LightSource[0].specular *
-					pow(NdotHV, gl_FrontMaterial.shininess);
+	// set eye and normal vectors
+	eye = isLocalViewer ? normalize(vec3(modelView * vertex)) : vec3(0.0, 0.0, -1.0);
+	normal = normalize(vec3(mat3(normalMatrix) * normal));
 
-			}
-		}
+#ifdef CLUSTERED
+	position = vec3(modelView * vertex);
+#endif
 
-		// set the color
-		gl_FrontColor = color;
-	}
+	// if vertex lit, set vertex color
+	if (!isPerPixelLighting)
+		gl_FrontColor = shade(normal, eye);
 
 	// apply matrix transforms to vertex position
-	gl_Position = gl_ModelViewProjectionMatrix * vertex;
+	gl_Position = modelViewProjection * vertex;
+#endif
 }
@@ -0,0 +1,243 @@
+/* objects-simd-kernels.h */
+
+/* Vector mesh generation kernels, written once against the V_* macros and
+ * included by objects-simd.c for each instruction set. NAME() appends the
+ * variant suffix, WIDTH is the number of float lanes and
+ * NAME(storeVertices) writes WIDTH vertices from six component vectors.
+ * No include guard on purpose. */
+
+/* sin and cos of WIDTH values at once, see fastSinCos() */
+static inline void NAME(sinCos)(VEC x, VEC* s, VEC* c)
+{
+	const VEC signMask = V_CASTI(VI_SET1(0x80000000));
+	VEC signSin, signCos, polyMask;
+	VEC y, z, ys, yc;
+	VECI j;
+
+	/* Work with |x|, sin is odd */
+	signSin = V_AND(x, signMask);
+	x = V_ANDNOT(signMask, x);
+
+	/* j is the nearest even octant, leaving x in [-pi/4, pi/4] */
+	j = V_CVTT(V_MUL(x, V_SET1(1.27323954473516f)));
+	j = VI_AND(VI_ADD(j, VI_SET1(1)), VI_SET1(~1));
+	y = V_CVT(j);
+	signSin = V_XOR(signSin, V_CASTI(VI_SLLI(VI_AND(j, VI_SET1(4)), 29)));
+	signCos = V_CASTI(VI_SLLI(VI_ANDNOT(VI_SUB(j, VI_SET1(2)), VI_SET1(4)), 29));
+	polyMask = V_CASTI(VI_CMPEQ(VI_AND(j, VI_SET1(2)), VI_SET1(0)));
+
+	/* Extended precision x - j * pi/4 */
+	x = V_SUB(x, V_MUL(y, V_SET1(0.78515625f)));
+	x = V_SUB(x, V_MUL(y, V_SET1(2.4187564849853515625e-4f)));
+	x = V_SUB(x, V_MUL(y, V_SET1(3.77489497744594108e-8f)));
+	z = V_MUL(x, x);
+
+	yc = V_ADD(V_MUL(V_SET1(2.443315711809948e-5f), z), V_SET1(-1.388731625493765e-3f));
+	yc = V_ADD(V_MUL(yc, z), V_SET1(4.166664568298827e-2f));
+	yc = V_MUL(V_MUL(yc, z), z);
+	yc = V_ADD(V_SUB(yc, V_MUL(z, V_SET1(0.5f))), V_SET1(1.0f));
+
+	ys = V_ADD(V_MUL(V_SET1(-1.9515295891e-4f), z), V_SET1(8.3321608736e-3f));
+	ys = V_ADD(V_MUL(ys, z), V_SET1(-1.6666654611e-1f));
+	ys = V_ADD(V_MUL(V_MUL(ys, z), x), x);
+
+	/* Odd octants swap the two polynomials */
+	*s = V_XOR(V_OR(V_AND(polyMask, ys), V_ANDNOT(polyMask, yc)), signSin);
+	*c = V_XOR(V_OR(V_AND(polyMask, yc), V_ANDNOT(polyMask, ys)), signCos);
+}
+
+/* 1/sqrt(x): the hardware estimate plus one Newton-Raphson step, which
+ * brings the 12 bit estimate close to full float precision */
+static inline VEC NAME(rsqrt)(VEC x)
+{
+	VEC y = V_RSQRT(x);
+	VEC yyx = V_MUL(V_MUL(y, y), x);
+	return V_MUL(V_MUL(y, V_SET1(0.5f)), V_SUB(V_SET1(3.0f), yyx));
+}
+
+/* sin and cos of offset + scale * k/(n-1) for k = first .. first+count-1.
+ * The tables must have room for count rounded up to a multiple of WIDTH. */
+static void NAME(sinCosTable)(float* s, float* c, int first, int count, int n, float scale, float offset)
+{
+	VEC lane, t, vs, vc;
+	float steps[WIDTH];
+	int k;
+
+	for (k = 0; k < WIDTH; ++k)
+		steps[k] = (float)k;
+	lane = V_LOADU(steps);
+	for (k = 0; k < count; k += WIDTH)
+	{
+		t = V_ADD(V_SET1((float)(first + k)), lane);
+		t = V_ADD(V_MUL(V_DIV(t, V_SET1((float)(n-1))), V_SET1(scale)), V_SET1(offset));
+		NAME(sinCos)(t, &vs, &vc);
+		V_STOREU(s + k, vs);
+		V_STOREU(c + k, vc);
+	}
+}
+
+void NAME(batchSphere)(const void* args, int x, int y, int row0, int row1, vertex_t* vertices)
+{
+	const SphereArgs* sphere = (const SphereArgs*)args;
+	const float pi = acosf(-1.0f);
+	const int padY = PADDED(y);
+	const int padRows = PADDED(row1 - row0);
+	const VEC radius = V_SET1(sphere->radius);
+	float* sinv;
+	float* cosv;
+	float* sinu;
+	float* cosu;
+	int i, j;
+
+	sinv = (float*)malloc(sizeof(float) * (padY + padRows) * 2);
+	cosv = sinv + padY;
+	sinu = cosv + padY;
+	cosu = sinu + padRows;
+	NAME(sinCosTable)(sinv, cosv, 0, y, y, pi, 0.0f);
+	NAME(sinCosTable)(sinu, cosu, row0, row1 - row0, x, 2.0f * pi, 0.0f);
+
+	for (i = row0; i < row1; ++i)
+	{
+		vertex_t* row = vertices + i * y;
+		const float cuS = cosu[i - row0];
+		const float suS = sinu[i - row0];
+		const VEC cu = V_SET1(cuS);
+		const VEC su = V_SET1(suS);
+		for (j = 0; j + WIDTH <= y; j += WIDTH)
+		{
+			VEC sv = V_LOADU(sinv + j);
+			VEC nx = V_MUL(cu, sv);
+			VEC ny = V_MUL(su, sv);
+			VEC nz = V_LOADU(cosv + j);
+			NAME(storeVertices)(row + j,
+				V_MUL(radius, nx), V_MUL(radius, ny), V_MUL(radius, nz),
+				nx, ny, nz);
+		}
+		for (; j < y; ++j)
+		{
+			row[j].norm.x = cuS * sinv[j];
+			row[j].norm.y = suS * sinv[j];
+			row[j].norm.z = cosv[j];
+			row[j].vert.x = sphere->radius * row[j].norm.x;
+			row[j].vert.y = sphere->radius * row[j].norm.y;
+			row[j].vert.z = sphere->radius * row[j].norm.z;
+		}
+	}
+	free(sinv);
+}
+
+void NAME(batchTorus)(const void* args, int x, int y, int row0, int row1, vertex_t* vertices)
+{
+	const TorusArgs* torus = (const TorusArgs*)args;
+	const float pi = acosf(-1.0f);
+	const int padY = PADDED(y);
+	const int padRows = PADDED(row1 - row0);
+	const VEC R = V_SET1(torus->R);
+	const VEC r = V_SET1(torus->r);
+	float* sinv;
+	float* cosv;
+	float* sinu;
+	float* cosu;
+	int i, j;
+
+	sinv = (float*)malloc(sizeof(float) * (padY + padRows) * 2);
+	cosv = sinv + padY;
+	sinu = cosv + padY;
+	cosu = sinu + padRows;
+	NAME(sinCosTable)(sinv, cosv, 0, y, y, 2.0f * pi, 0.0f);
+	NAME(sinCosTable)(sinu, cosu, row0, row1 - row0, x, 2.0f * pi, 0.0f);
+
+	for (i = row0; i < row1; ++i)
+	{
+		vertex_t* row = vertices + i * y;
+		const float cuS = cosu[i - row0];
+		const float suS = sinu[i - row0];
+		const VEC cu = V_SET1(cuS);
+		const VEC su = V_SET1(suS);
+		for (j = 0; j + WIDTH <= y; j += WIDTH)
+		{
+			VEC cv = V_LOADU(cosv + j);
+			VEC sv = V_LOADU(sinv + j);
+			VEC ring = V_ADD(R, V_MUL(r, cv));
+			NAME(storeVertices)(row + j,
+				V_MUL(ring, cu), V_MUL(ring, su), V_MUL(r, sv),
+				V_MUL(cu, cv), V_MUL(su, cv), sv);
+		}
+		for (; j < y; ++j)
+		{
+			row[j].norm.x = cuS * cosv[j];
+			row[j].norm.y = suS * cosv[j];
+			row[j].norm.z = sinv[j];
+			row[j].vert.x = (torus->R + torus->r * cosv[j]) * cuS;
+			row[j].vert.y = (torus->R + torus->r * cosv[j]) * suS;
+			row[j].vert.z = torus->r * sinv[j];
+		}
+	}
+	free(sinv);
+}
+
+void NAME(batchWave)(const void* args, int x, int y, int row0, int row1, vertex_t* vertices)
+{
+	const WaveArgs* wave = (const WaveArgs*)args;
+	const float amp = .2;
+	const float pi = acosf(-1.0f);
+	const int padY = PADDED(y);
+	const int padRows = PADDED(row1 - row0);
+	float* sinTheta;
+	float* cosTheta;
+	float* sinThetaTime;
+	float* posY;
+	float* sinPhi;
+	float* cosPhi;
+	float* sinPhiTime;
+	float* unused;
+	int i, j;
+
+	/* The time tables' cosines go to a scratch table after the rest, long
+	 * enough for either */
+	sinTheta = (float*)malloc(sizeof(float) * (padY * 4 + padRows * 3 + (padY > padRows ? padY : padRows)));
+	cosTheta = sinTheta + padY;
+	sinThetaTime = cosTheta + padY;
+	posY = sinThetaTime + padY;
+	sinPhi = posY + padY;
+	cosPhi = sinPhi + padRows;
+	sinPhiTime = cosPhi + padRows;
+	unused = sinPhiTime + padRows;
+	NAME(sinCosTable)(sinTheta, cosTheta, 0, y, y, pi * 5, 0.0f);
+	NAME(sinCosTable)(sinThetaTime, unused, 0, y, y, pi * 5, wave->time);
+	NAME(sinCosTable)(sinPhi, cosPhi, row0, row1 - row0, x, pi * 5, 0.0f);
+	NAME(sinCosTable)(sinPhiTime, unused, row0, row1 - row0, x, pi * 5, wave->time);
+	for (j = 0; j < y; ++j)
+		posY[j] = j / (float)(y-1) * wave->height - 1;
+
+	for (i = row0; i < row1; ++i)
+	{
+		vertex_t* row = vertices + i * y;
+		const float posX = i / (float)(x-1) * wave->width - 1;
+		const float ampX = -amp * sinPhi[i - row0];
+		const float ampY = amp * cosPhi[i - row0];
+		const float ampZ = amp * sinPhiTime[i - row0];
+		for (j = 0; j + WIDTH <= y; j += WIDTH)
+		{
+			VEC nx = V_MUL(V_SET1(ampX), V_LOADU(cosTheta + j));
+			VEC ny = V_MUL(V_SET1(ampY), V_LOADU(sinTheta + j));
+			VEC m = NAME(rsqrt)(V_ADD(V_ADD(V_MUL(nx, nx), V_MUL(ny, ny)), V_SET1(1.0f)));
+			NAME(storeVertices)(row + j,
+				V_SET1(posX), V_LOADU(posY + j), V_MUL(V_SET1(ampZ), V_LOADU(sinThetaTime + j)),
+				V_MUL(nx, m), V_MUL(ny, m), m);
+		}
+		for (; j < y; ++j)
+		{
+			float nx = ampX * cosTheta[j];
+			float ny = ampY * sinTheta[j];
+			float m = 1.0f / sqrtf(nx * nx + ny * ny + 1.0f);
+			row[j].norm.x = nx * m;
+			row[j].norm.y = ny * m;
+			row[j].norm.z = m;
+			row[j].vert.x = posX;
+			row[j].vert.y = posY[j];
+			row[j].vert.z = ampZ * sinThetaTime[j];
+		}
+	}
+	free(sinTheta);
+}
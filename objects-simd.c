@@ -0,0 +1,299 @@
+/* objects-simd.c */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "objects-simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/* The SSE kernels write vertices as six packed floats */
+typedef char vertex_t_must_be_six_floats[sizeof(vertex_t) == 6 * sizeof(float) ? 1 : -1];
+
+static SimdLevel currentLevel = SIMD_MAX; /* SIMD_MAX until first used */
+
+SimdLevel simdSupported()
+{
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return SIMD_AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return SIMD_SSE2;
+#endif
+	return SIMD_SCALAR;
+}
+
+SimdLevel simdLevel()
+{
+	if (currentLevel == SIMD_MAX)
+		currentLevel = simdSupported();
+	return currentLevel;
+}
+
+void setSimdLevel(SimdLevel level)
+{
+	SimdLevel supported = simdSupported();
+	currentLevel = level > supported ? supported : level;
+}
+
+const char* simdLevelName(SimdLevel level)
+{
+	static const char* names[SIMD_MAX] = {"scalar", "sse2", "avx2"};
+	return level < SIMD_MAX ? names[level] : "unknown";
+}
+
+void fastSinCos(float x, float* s, float* c)
+{
+	float y, z, ys, yc;
+	int j, signSin = 0, signCos;
+
+	if (x < 0.0f)
+	{
+		x = -x;
+		signSin = 1;
+	}
+
+	j = (int)(x * 1.27323954473516f);
+	j = (j + 1) & ~1;
+	y = (float)j;
+	if (j & 4)
+		signSin = !signSin;
+	signCos = !((j - 2) & 4);
+	x = ((x - y * 0.78515625f) - y * 2.4187564849853515625e-4f) - y * 3.77489497744594108e-8f;
+	z = x * x;
+
+	yc = ((2.443315711809948e-5f * z - 1.388731625493765e-3f) * z + 4.166664568298827e-2f) * z * z;
+	yc = yc - z * 0.5f + 1.0f;
+	ys = ((-1.9515295891e-4f * z + 8.3321608736e-3f) * z - 1.6666654611e-1f) * z * x + x;
+
+	if (j & 2)
+	{
+		*s = yc;
+		*c = ys;
+	}
+	else
+	{
+		*s = ys;
+		*c = yc;
+	}
+	if (signSin)
+		*s = -*s;
+	if (signCos)
+		*c = -*c;
+}
+
+#ifdef HAVE_X86_SIMD
+
+#define PADDED(n) (((n) + WIDTH - 1) / WIDTH * WIDTH)
+
+/* Writes four vertices, transposing the component vectors */
+static inline void storeVerticesSSE2(vertex_t* out, __m128 x, __m128 y, __m128 z, __m128 nx, __m128 ny, __m128 nz)
+{
+	float* f = (float*)out;
+	__m128 lo = _mm_unpacklo_ps(ny, nz);
+	__m128 hi = _mm_unpackhi_ps(ny, nz);
+
+	_MM_TRANSPOSE4_PS(x, y, z, nx);
+	_mm_storeu_ps(f, x);
+	_mm_storel_pi((__m64*)(f + 4), lo);
+	_mm_storeu_ps(f + 6, y);
+	_mm_storeh_pi((__m64*)(f + 10), lo);
+	_mm_storeu_ps(f + 12, z);
+	_mm_storel_pi((__m64*)(f + 16), hi);
+	_mm_storeu_ps(f + 18, nx);
+	_mm_storeh_pi((__m64*)(f + 22), hi);
+}
+
+/* SSE2: 4 lanes, part of the x86-64 baseline */
+#define NAME(name) name##SSE2
+#define WIDTH 4
+#define VEC __m128
+#define VECI __m128i
+#define V_SET1 _mm_set1_ps
+#define V_LOADU _mm_loadu_ps
+#define V_STOREU _mm_storeu_ps
+#define V_ADD _mm_add_ps
+#define V_SUB _mm_sub_ps
+#define V_MUL _mm_mul_ps
+#define V_DIV _mm_div_ps
+#define V_AND _mm_and_ps
+#define V_ANDNOT _mm_andnot_ps
+#define V_OR _mm_or_ps
+#define V_XOR _mm_xor_ps
+#define V_RSQRT _mm_rsqrt_ps
+#define V_CVT _mm_cvtepi32_ps
+#define V_CVTT _mm_cvttps_epi32
+#define V_CASTI _mm_castsi128_ps
+#define VI_SET1 _mm_set1_epi32
+#define VI_ADD _mm_add_epi32
+#define VI_SUB _mm_sub_epi32
+#define VI_AND _mm_and_si128
+#define VI_ANDNOT _mm_andnot_si128
+#define VI_SLLI _mm_slli_epi32
+#define VI_CMPEQ _mm_cmpeq_epi32
+
+#include "objects-simd-kernels.h"
+
+#undef NAME
+#undef WIDTH
+#undef VEC
+#undef VECI
+#undef V_SET1
+#undef V_LOADU
+#undef V_STOREU
+#undef V_ADD
+#undef V_SUB
+#undef V_MUL
+#undef V_DIV
+#undef V_AND
+#undef V_ANDNOT
+#undef V_OR
+#undef V_XOR
+#undef V_RSQRT
+#undef V_CVT
+#undef V_CVTT
+#undef V_CASTI
+#undef VI_SET1
+#undef VI_ADD
+#undef VI_SUB
+#undef VI_AND
+#undef VI_ANDNOT
+#undef VI_SLLI
+#undef VI_CMPEQ
+
+/* AVX2: 8 lanes, only called after simdSupported() has checked the CPU */
+#pragma GCC push_options
+#pragma GCC target("avx2")
+
+static inline void storeVerticesAVX2(vertex_t* out, __m256 x, __m256 y, __m256 z, __m256 nx, __m256 ny, __m256 nz)
+{
+	storeVerticesSSE2(out,
+		_mm256_castps256_ps128(x), _mm256_castps256_ps128(y), _mm256_castps256_ps128(z),
+		_mm256_castps256_ps128(nx), _mm256_castps256_ps128(ny), _mm256_castps256_ps128(nz));
+	storeVerticesSSE2(out + 4,
+		_mm256_extractf128_ps(x, 1), _mm256_extractf128_ps(y, 1), _mm256_extractf128_ps(z, 1),
+		_mm256_extractf128_ps(nx, 1), _mm256_extractf128_ps(ny, 1), _mm256_extractf128_ps(nz, 1));
+}
+
+#define NAME(name) name##AVX2
+#define WIDTH 8
+#define VEC __m256
+#define VECI __m256i
+#define V_SET1 _mm256_set1_ps
+#define V_LOADU _mm256_loadu_ps
+#define V_STOREU _mm256_storeu_ps
+#define V_ADD _mm256_add_ps
+#define V_SUB _mm256_sub_ps
+#define V_MUL _mm256_mul_ps
+#define V_DIV _mm256_div_ps
+#define V_AND _mm256_and_ps
+#define V_ANDNOT _mm256_andnot_ps
+#define V_OR _mm256_or_ps
+#define V_XOR _mm256_xor_ps
+#define V_RSQRT _mm256_rsqrt_ps
+#define V_CVT _mm256_cvtepi32_ps
+#define V_CVTT _mm256_cvttps_epi32
+#define V_CASTI _mm256_castsi256_ps
+#define VI_SET1 _mm256_set1_epi32
+#define VI_ADD _mm256_add_epi32
+#define VI_SUB _mm256_sub_epi32
+#define VI_AND _mm256_and_si256
+#define VI_ANDNOT _mm256_andnot_si256
+#define VI_SLLI _mm256_slli_epi32
+#define VI_CMPEQ _mm256_cmpeq_epi32
+
+#include "objects-simd-kernels.h"
+
+#pragma GCC pop_options
+
+#else
+
+/* No vector units we know about, simdSupported() never selects these */
+void batchSphereSSE2(const void* args, int x, int y, int row0, int row1, vertex_t* vertices) { batchSphereScalar(args, x, y, row0, row1, vertices); }
+void batchTorusSSE2(const void* args, int x, int y, int row0, int row1, vertex_t* vertices) { batchTorusScalar(args, x, y, row0, row1, vertices); }
+void batchWaveSSE2(const void* args, int x, int y, int row0, int row1, vertex_t* vertices) { batchWaveScalar(args, x, y, row0, row1, vertices); }
+void batchSphereAVX2(const void* args, int x, int y, int row0, int row1, vertex_t* vertices) { batchSphereScalar(args, x, y, row0, row1, vertices); }
+void batchTorusAVX2(const void* args, int x, int y, int row0, int row1, vertex_t* vertices) { batchTorusScalar(args, x, y, row0, row1, vertices); }
+void batchWaveAVX2(const void* args, int x, int y, int row0, int row1, vertex_t* vertices) { batchWaveScalar(args, x, y, row0, row1, vertices); }
+
+#endif
+
+static float maxDifference(const vertex_t* a, const vertex_t* b, int n)
+{
+	const float* fa = (const float*)a;
+	const float* fb = (const float*)b;
+	float diff, result = 0.0f;
+	int i;
+	for (i = 0; i < n * 6; ++i)
+	{
+		diff = fabsf(fa[i] - fb[i]);
+		if (diff > result)
+			result = diff;
+	}
+	return result;
+}
+
+float simdCheck(SimdLevel level)
+{
+	/* Odd sizes exercise the scalar tails and non-square ones (both ways
+	 * round) the separate row and column tables; the row splits, down to a
+	 * row at a time, the table offsets */
+	static const int sizes[][2] = {{5, 5}, {17, 17}, {33, 33}, {129, 129},
+		{129, 9}, {9, 129}, {257, 17}, {17, 257}, {40, 3}, {3, 40}};
+	const SphereArgs sphere = {1.0f};
+	const TorusArgs torus = {1.0f, 0.5f};
+	const WaveArgs wave = {2.0f, 2.0f, 12.345f};
+	ParametricBatchFunc reference[3] = {batchSphereScalar, batchTorusScalar, batchWaveScalar};
+	ParametricBatchFunc variant[3];
+	const void* args[3] = {&sphere, &torus, &wave};
+	vertex_t* expected;
+	vertex_t* actual;
+	float diff, result = 0.0f;
+	int s, f, x, y, split, parts, i;
+
+	switch (level)
+	{
+	case SIMD_AVX2:
+		variant[0] = batchSphereAVX2;
+		variant[1] = batchTorusAVX2;
+		variant[2] = batchWaveAVX2;
+		break;
+	case SIMD_SSE2:
+		variant[0] = batchSphereSSE2;
+		variant[1] = batchTorusSSE2;
+		variant[2] = batchWaveSSE2;
+		break;
+	default:
+		return 0.0f;
+	}
+
+	for (s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); ++s)
+	{
+		x = sizes[s][0];
+		y = sizes[s][1];
+		expected = (vertex_t*)malloc(sizeof(vertex_t) * x * y);
+		actual = (vertex_t*)malloc(sizeof(vertex_t) * x * y);
+		for (f = 0; f < 3; ++f)
+		{
+			reference[f](args[f], x, y, 0, x, expected);
+			for (split = 0; split < 4; ++split)
+			{
+				parts = split < 3 ? split + 1 : x;
+				for (i = 0; i < parts; ++i)
+					variant[f](args[f], x, y, x * i / parts, x * (i + 1) / parts, actual);
+				diff = maxDifference(expected, actual, x * y);
+				if (diff > result)
+					result = diff;
+			}
+		}
+		free(expected);
+		free(actual);
+	}
+	return result;
+}
@@ -0,0 +1,47 @@
+/* objects-simd.h */
+
+#ifndef OBJECTS_SIMD_H
+#define OBJECTS_SIMD_H
+
+#include "objects.h"
+
+/* Vectorized variants of the batch evaluators in objects.h, computing 4
+ * (SSE2) or 8 (AVX2) vertices per iteration. batchSphere() etc. pick the
+ * best variant the CPU supports; the scalar versions are the reference. */
+typedef enum {
+	SIMD_SCALAR,
+	SIMD_SSE2,
+	SIMD_AVX2,
+	SIMD_MAX
+} SimdLevel;
+
+SimdLevel simdSupported(); /* best level this CPU can run */
+SimdLevel simdLevel(); /* level batchSphere() etc. currently use */
+void setSimdLevel(SimdLevel level); /* clamped to simdSupported() */
+const char* simdLevelName(SimdLevel level);
+
+#define SIMD_TOLERANCE 1e-5 /* max error of the vector kernels */
+
+/* Largest absolute difference between the given level and the scalar
+ * reference over every surface, at square and non-square grid sizes built
+ * whole and in row ranges */
+float simdCheck(SimdLevel level);
+
+/* Polynomial sin and cos (Cephes sinf/cosf, as used by every vector
+ * variant). Absolute error is below 3e-7 for |x| < 8192, beyond which the
+ * range reduction loses precision. */
+void fastSinCos(float x, float* s, float* c);
+
+void batchSphereScalar(const void* args, int x, int y, int row0, int row1, vertex_t* vertices);
+void batchTorusScalar(const void* args, int x, int y, int row0, int row1, vertex_t* vertices);
+void batchWaveScalar(const void* args, int x, int y, int row0, int row1, vertex_t* vertices);
+
+void batchSphereSSE2(const void* args, int x, int y, int row0, int row1, vertex_t* vertices);
+void batchTorusSSE2(const void* args, int x, int y, int row0, int row1, vertex_t* vertices);
+void batchWaveSSE2(const void* args, int x, int y, int row0, int row1, vertex_t* vertices);
+
+void batchSphereAVX2(const void* args, int x, int y, int row0, int row1, vertex_t* vertices);
+void batchTorusAVX2(const void* args, int x, int y, int row0, int row1, vertex_t* vertices);
+void batchWaveAVX2(const void* args, int x, int y, int row0, int row1, vertex_t* vertices);
+
+#endif
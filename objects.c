@@ -6,7 +6,11 @@
 #include <math.h>
 #include <stdio.h>
 
+#include <GL/glew.h>
+
 #include "objects.h"
+#include "objects-simd.h"
+#include "workers.h"
 
 vertex_t parametricSphere(float u, float v, va_list* args)
 {
@@ -90,6 +94,183 @@ vertex_t parametricGrid(float u, float v, va_list *args) {
 	return ret;
 }
 
+/* Fill table[j] with the v (or u) parameter of each of the n grid lines */
+static void gridParams(float* table, int n, float scale)
+{
+	int j;
+	for (j = 0; j < n; ++j)
+		table[j] = j / (float)(n-1) * scale;
+}
+
+void batchSphereScalar(const void* args, int x, int y, int row0, int row1, vertex_t* vertices)
+{
+	const SphereArgs* sphere = (const SphereArgs*)args;
+	const float radius = sphere->radius;
+	float pi = acosf(-1.0f);
+	float* cosv;
+	float* sinv;
+	float u, cu, su;
+	int i, j;
+
+	/* Per column trig, shared by every row */
+	cosv = (float*)malloc(sizeof(float) * y * 2);
+	sinv = cosv + y;
+	gridParams(cosv, y, pi);
+	for (j = 0; j < y; ++j)
+	{
+		sinv[j] = sin(cosv[j]);
+		cosv[j] = cos(cosv[j]);
+	}
+
+	for (i = row0; i < row1; ++i)
+	{
+		vertex_t* restrict row = vertices + i * y;
+		u = i / (float)(x-1) * 2.0f * pi;
+		cu = cos(u);
+		su = sin(u);
+		for (j = 0; j < y; ++j)
+		{
+			row[j].norm.x = cu * sinv[j];
+			row[j].norm.y = su * sinv[j];
+			row[j].norm.z = cosv[j];
+			row[j].vert.x = radius * row[j].norm.x;
+			row[j].vert.y = radius * row[j].norm.y;
+			row[j].vert.z = radius * row[j].norm.z;
+		}
+	}
+	free(cosv);
+}
+
+void batchTorusScalar(const void* args, int x, int y, int row0, int row1, vertex_t* vertices)
+{
+	const TorusArgs* torus = (const TorusArgs*)args;
+	const float R = torus->R;
+	const float r = torus->r;
+	float pi = acosf(-1.0f);
+	float* cosv;
+	float* sinv;
+	float u, cu, su;
+	int i, j;
+
+	cosv = (float*)malloc(sizeof(float) * y * 2);
+	sinv = cosv + y;
+	gridParams(cosv, y, 2.0f * pi);
+	for (j = 0; j < y; ++j)
+	{
+		sinv[j] = sin(cosv[j]);
+		cosv[j] = cos(cosv[j]);
+	}
+
+	for (i = row0; i < row1; ++i)
+	{
+		vertex_t* restrict row = vertices + i * y;
+		u = i / (float)(x-1) * 2.0f * pi;
+		cu = cos(u);
+		su = sin(u);
+		for (j = 0; j < y; ++j)
+		{
+			row[j].norm.x = cu * cosv[j];
+			row[j].norm.y = su * cosv[j];
+			row[j].norm.z = sinv[j];
+			row[j].vert.x = (R + r * cosv[j]) * cu;
+			row[j].vert.y = (R + r * cosv[j]) * su;
+			row[j].vert.z = r * sinv[j];
+		}
+	}
+	free(cosv);
+}
+
+void batchWaveScalar(const void* args, int x, int y, int row0, int row1, vertex_t* vertices)
+{
+	const WaveArgs* wave = (const WaveArgs*)args;
+	const float amp = .2;
+	const float time = wave->time;
+	float pi = acosf(-1.0f);
+	float* posY;
+	float* sinTheta;
+	float* cosTheta;
+	float* sinThetaTime;
+	float u, phi, posX, ampX, ampY, ampZ;
+	float nx, ny, m;
+	int i, j;
+
+	/* theta depends only on v, phi only on u */
+	posY = (float*)malloc(sizeof(float) * y * 4);
+	sinTheta = posY + y;
+	cosTheta = posY + y * 2;
+	sinThetaTime = posY + y * 3;
+	gridParams(posY, y, 1.0f);
+	for (j = 0; j < y; ++j)
+	{
+		float theta = pi * 5 * posY[j];
+		sinTheta[j] = sin(theta);
+		cosTheta[j] = cos(theta);
+		sinThetaTime[j] = sin(theta + time);
+		posY[j] = posY[j] * wave->height - 1;
+	}
+
+	for (i = row0; i < row1; ++i)
+	{
+		vertex_t* restrict row = vertices + i * y;
+		u = i / (float)(x-1);
+		phi = pi * 5 * u;
+		posX = u * wave->width - 1;
+		ampX = -amp * sin(phi);
+		ampY = amp * cos(phi);
+		ampZ = amp * sin(phi + time);
+		for (j = 0; j < y; ++j)
+		{
+			nx = ampX * cosTheta[j];
+			ny = ampY * sinTheta[j];
+			m = 1.0f / sqrtf(nx * nx + ny * ny + 1.0f);
+			row[j].norm.x = nx * m;
+			row[j].norm.y = ny * m;
+			row[j].norm.z = m;
+			row[j].vert.x = posX;
+			row[j].vert.y = posY[j];
+			row[j].vert.z = ampZ * sinThetaTime[j];
+		}
+	}
+	free(posY);
+}
+
+/* Run the fastest batch variant this CPU supports */
+#define DISPATCH_BATCH(name) \
+void name(const void* args, int x, int y, int row0, int row1, vertex_t* vertices) \
+{ \
+	switch (simdLevel()) \
+	{ \
+	case SIMD_AVX2: name##AVX2(args, x, y, row0, row1, vertices); break; \
+	case SIMD_SSE2: name##SSE2(args, x, y, row0, row1, vertices); break; \
+	default: name##Scalar(args, x, y, row0, row1, vertices); break; \
+	} \
+}
+
+DISPATCH_BATCH(batchSphere)
+DISPATCH_BATCH(batchTorus)
+DISPATCH_BATCH(batchWave)
+
+void batchGrid(const void* args, int x, int y, int row0, int row1, vertex_t* vertices)
+{
+	float u;
+	int i, j;
+
+	for (i = row0; i < row1; ++i)
+	{
+		vertex_t* restrict row = vertices + i * y;
+		u = i / (float)(x-1);
+		for (j = 0; j < y; ++j)
+		{
+			row[j].vert.x = u;
+			row[j].vert.y = j / (float)(y-1);
+			row[j].vert.z = 0.0f;
+			row[j].norm.x = 0.0f;
+			row[j].norm.y = 0.0f;
+			row[j].norm.z = 1.0f;
+		}
+	}
+}
+
 void drawAxes(float x,float y,float z,float length)
 {
 	glDisable(GL_DEPTH_TEST);
@@ -112,87 +293,496 @@ void drawAxes(float x,float y,float z,float length)
 	glEnable(GL_DEPTH_TEST);
 }
 
-Object* createObject(ParametricObjFunc paramObjFunc, int x, int y, ...)
-{
-	va_list args;
-	unsigned int i, j;
-	float u, v;
-	int ci = 0; /* current index */
+/* Each worker task fills a range of rows of the grid */
+typedef struct {
+	ParametricBatchFunc batch;
+	const void* args;
+	int x, y;
 	vertex_t* vertices;
 	unsigned int* indices;
-	int numVertices;
-	int numIndices;
-	Object* obj;
+	int restart; /* join strips with primitive restart, not degenerates */
+	const volatile int* cancel; /* optional, skip remaining rows once set */
+} MeshTask;
+
+static void fillVertexRows(void* data, int row0, int row1)
+{
+	MeshTask* task = (MeshTask*)data;
+	if (task->cancel && *task->cancel)
+		return;
+	task->batch(task->args, task->x, task->y, row0, row1, task->vertices);
+}
+
+#define RESTART_INDEX 0xFFFFFFFFu /* narrowed to 0xFFFF for 16 bit indices */
+
+/* Number of indices per triangle strip, including the join to the next */
+static int stripLength(int x, int restart)
+{
+	return restart ? x * 2 + 1 : x * 2 + 2;
+}
+
+/* Triangle strip j runs between columns j and j+1, so it starts at index
+ * j * stripLength(). Strips are joined by a primitive restart index or,
+ * without GL 3.1, by a degenerate triangle. */
+static void fillIndexStrips(void* data, int j0, int j1)
+{
+	MeshTask* task = (MeshTask*)data;
+	const int x = task->x;
+	const int y = task->y;
+	const int length = stripLength(x, task->restart);
+	unsigned int* indices;
+	int i, j;
 #define INDEX(I, J) ((I)*y + (J))
 
-	/* Initialize data */
-	numVertices = x * y;
-	numIndices = (y-1) * (x * 2 + 2);
-	vertices = (vertex_t*)malloc(sizeof(vertex_t) * numVertices);
-	indices = (unsigned int*)malloc(sizeof(unsigned int) * numIndices);
+	for (j = j0; j < j1; ++j)
+	{
+		indices = task->indices + j * length;
+		if (!task->restart)
+			*indices++ = INDEX(0, j);
+		for (i = 0; i < x; ++i)
+		{
+			*indices++ = INDEX(i, j);
+			*indices++ = INDEX(i, j+1);
+		}
+		if (task->restart)
+			*indices++ = RESTART_INDEX;
+		else
+			*indices++ = INDEX(i-1, j+1);
 
-	/* Construct vertex data */
-	for (i = 0; i < x; ++i)
+		/* Double check the loops populated the data correctly */
+		assert(indices == task->indices + (j+1) * length);
+	}
+#undef INDEX
+}
+
+/* Index buffers depend only on the grid size and order, so every object of
+ * the same size shares one. refs counts the objects using it. */
+typedef struct IndexBuffer {
+	int x, y;
+	IndexOrder order;
+	GLuint buffer;
+	GLenum type;
+	GLenum primitive;
+	int count;
+	unsigned int* remap; /* NULL, or where each grid vertex goes in the vertex buffer */
+	VertexCacheStats stats;
+	int refs;
+	struct IndexBuffer* next;
+} IndexBuffer;
+
+static IndexBuffer* indexBuffers = NULL;
+static int primitiveRestart = -1; /* -1 until checked */
+static IndexOrder indexOrder = INDEX_STRIPS;
+
+static const char* indexOrderNames[INDEX_ORDER_MAX] = {"strips", "tiled", "optimized"};
+
+void setIndexOrder(IndexOrder order)
+{
+	indexOrder = order;
+}
+
+IndexOrder getIndexOrder()
+{
+	return indexOrder;
+}
+
+const char* indexOrderName(IndexOrder order)
+{
+	return indexOrderNames[order];
+}
+
+/* Sets obj's elementBuffer, elementType, primitive and numElements for an x
+ * by y grid in order, building and uploading the indices only if no other
+ * object has them. Returns where each vertex has to go for them, or NULL to
+ * keep the grid's own order. */
+static const unsigned int* acquireIndices(Object* obj, int x, int y, IndexOrder order)
+{
+	IndexBuffer* ib;
+	MeshTask task;
+	unsigned int* indices;
+	unsigned short* shortIndices;
+	int i;
+
+	for (ib = indexBuffers; ib; ib = ib->next)
+		if (ib->x == x && ib->y == y && ib->order == order)
+			break;
+
+	if (!ib)
 	{
-		u = i/(float)(x-1);
-		for (j = 0; j < y; ++j)
+		if (primitiveRestart < 0)
+			primitiveRestart = GLEW_VERSION_3_1;
+
+		ib = (IndexBuffer*)malloc(sizeof(IndexBuffer));
+		ib->x = x;
+		ib->y = y;
+		ib->order = order;
+		ib->refs = 0;
+		ib->type = x * y < 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+		ib->remap = NULL;
+		if (order == INDEX_STRIPS)
 		{
-			v = j/(float)(y-1);
-			va_start(args, y);
-			vertices[INDEX(i, j)] = paramObjFunc(u, v, &args);
+			ib->primitive = GL_TRIANGLE_STRIP;
+			ib->count = (y-1) * stripLength(x, primitiveRestart);
+			indices = (unsigned int*)malloc(sizeof(unsigned int) * ib->count);
+
+			task.x = x;
+			task.y = y;
+			task.indices = indices;
+			task.restart = primitiveRestart;
+			task.cancel = NULL;
+			parallelForNoWait(fillIndexStrips, &task, y-1);
+		}
+		else
+		{
+			ib->primitive = GL_TRIANGLES;
+			ib->count = gridTriangleIndices(x, y);
+			indices = (unsigned int*)malloc(sizeof(unsigned int) * ib->count);
+			tileGridTriangles(indices, x, y, VERTEX_CACHE_SIZE);
+			if (order == INDEX_OPTIMIZED)
+				optimizeVertexCache(indices, ib->count, x * y, VERTEX_CACHE_SIZE);
+			ib->remap = (unsigned int*)malloc(sizeof(unsigned int) * x * y);
+			optimizeVertexFetch(indices, ib->count, x * y, ib->remap);
+		}
+		vertexCacheStats(indices, ib->count, x * y, (x-1) * (y-1) * 2, VERTEX_CACHE_SIZE, &ib->stats);
+
+		glGenBuffers(1, &ib->buffer);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ib->buffer);
+		if (ib->type == GL_UNSIGNED_SHORT)
+		{
+			shortIndices = (unsigned short*)malloc(sizeof(unsigned short) * ib->count);
+			for (i = 0; i < ib->count; ++i)
+				shortIndices[i] = (unsigned short)indices[i];
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned short) * ib->count, shortIndices, GL_STATIC_DRAW);
+			free(shortIndices);
 		}
+		else
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * ib->count, indices, GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		free(indices);
+
+		ib->next = indexBuffers;
+		indexBuffers = ib;
 	}
 
-	/* Construct index data */
-	for (j = 0; j < y-1; ++j)
+	++ib->refs;
+	obj->elementBuffer = ib->buffer;
+	obj->elementType = ib->type;
+	obj->primitive = ib->primitive;
+	obj->numElements = ib->count;
+	return ib->remap;
+}
+
+void objectCacheStats(const Object* obj, VertexCacheStats* stats)
+{
+	IndexBuffer* ib;
+
+	memset(stats, 0, sizeof(*stats));
+	for (ib = indexBuffers; ib; ib = ib->next)
+		if (ib->buffer == obj->elementBuffer)
+			*stats = ib->stats;
+}
+
+static void releaseIndices(Object* obj)
+{
+	IndexBuffer** link;
+	IndexBuffer* ib;
+
+	for (link = &indexBuffers; *link; link = &(*link)->next)
 	{
-		indices[ci++] = INDEX(0, j);
-		for (i = 0; i < x; ++i)
+		ib = *link;
+		if (ib->buffer != obj->elementBuffer)
+			continue;
+		if (--ib->refs == 0)
 		{
-			indices[ci++] = INDEX(i, j);
-			indices[ci++] = INDEX(i, j+1);
+			glDeleteBuffers(1, &ib->buffer);
+			*link = ib->next;
+			free(ib->remap);
+			free(ib);
 		}
-		indices[ci++] = INDEX(i-1, j+1);
+		return;
 	}
+	assert(!"index buffer not found");
+}
 
-	/* Double check the loops populated the data correctly */
-	assert(ci == numIndices);
+/* buildMeshCancellable(), waiting for the worker pool or not */
+static int fillMesh(Mesh* mesh, ParametricBatchFunc batch, const void* args, int x, int y,
+	const volatile int* cancel, int wait)
+{
+	MeshTask task;
 
-	/* Create VBOs */
+	/* Initialize data */
+	mesh->x = x;
+	mesh->y = y;
+	mesh->format = VERTEX_FLOAT;
+	mesh->numVertices = x * y;
+	mesh->vertices = (vertex_t*)malloc(sizeof(vertex_t) * mesh->numVertices);
+
+	/* Construct vertex data, split into rows across the worker pool */
+	task.batch = batch;
+	task.args = args;
+	task.x = x;
+	task.y = y;
+	task.vertices = mesh->vertices;
+	task.cancel = cancel;
+	if (wait)
+		parallelFor(fillVertexRows, &task, x);
+	else
+		parallelForNoWait(fillVertexRows, &task, x);
+	if (cancel && *cancel)
+	{
+		freeMesh(mesh);
+		return 0;
+	}
+	return 1;
+}
+
+void buildMesh(Mesh* mesh, ParametricBatchFunc batch, const void* args, int x, int y)
+{
+	fillMesh(mesh, batch, args, x, y, NULL, 1);
+}
+
+int buildMeshCancellable(Mesh* mesh, ParametricBatchFunc batch, const void* args, int x, int y, const volatile int* cancel)
+{
+	return fillMesh(mesh, batch, args, x, y, cancel, 1);
+}
+
+/* Packed vertex layouts, see VertexFormat */
+typedef struct {
+	short uv[2];
+} UV16Vertex;
+
+typedef struct {
+	unsigned short vert[4];
+	signed char norm[4]; /* the fourth is padding */
+} HalfVertex;
+
+typedef char half_vertex_must_be_12_bytes[sizeof(HalfVertex) == 12 ? 1 : -1];
+
+int vertexFormatSize(VertexFormat format)
+{
+	switch (format)
+	{
+	case VERTEX_UV16:
+		return sizeof(UV16Vertex);
+	case VERTEX_HALF:
+		return sizeof(HalfVertex);
+	default:
+		return sizeof(vertex_t);
+	}
+}
+
+const char* vertexFormatName(VertexFormat format)
+{
+	static const char* names[VERTEX_FORMAT_MAX] = {"float", "uv16", "half"};
+	return format < VERTEX_FORMAT_MAX ? names[format] : "unknown";
+}
+
+int vertexFormatSupported(VertexFormat format)
+{
+	switch (format)
+	{
+	case VERTEX_HALF:
+		return GLEW_VERSION_3_0 || GLEW_ARB_half_float_vertex;
+	default:
+		return 1;
+	}
+}
+
+/* Rounds to the nearest half float, flushing values too small for a normal
+ * half to zero and overflowing to infinity */
+static unsigned short floatToHalf(float f)
+{
+	union { float f; unsigned int u; } bits;
+	unsigned int sign, exponent, mantissa;
+
+	bits.f = f;
+	sign = (bits.u >> 16) & 0x8000;
+	exponent = (bits.u >> 23) & 0xFF;
+	mantissa = (bits.u & 0x7FFFFF) + 0x1000;
+	if (mantissa & 0x800000)
+	{
+		mantissa = 0;
+		++exponent;
+	}
+	if (exponent < 127 - 14)
+		return sign;
+	if (exponent > 127 + 15)
+		return sign | 0x7C00;
+	return sign | ((exponent - 127 + 15) << 10) | (mantissa >> 13);
+}
+
+static signed char packSnorm8(float v)
+{
+	v = v < -1.0f ? -1.0f : (v > 1.0f ? 1.0f : v);
+	return (signed char)floorf(v * 127.0f + 0.5f);
+}
+
+void packMesh(Mesh* mesh, VertexFormat format)
+{
+	char* out = (char*)mesh->vertices;
+	vertex_t v;
+	UV16Vertex uv;
+	HalfVertex half;
+	int i;
+
+	assert(mesh->format == VERTEX_FLOAT);
+	if (format == VERTEX_FLOAT)
+		return;
+
+	/* Packed vertices are smaller, so vertex i is read before anything
+	 * overwrites it */
+	for (i = 0; i < mesh->numVertices; ++i)
+	{
+		v = mesh->vertices[i];
+		if (format == VERTEX_UV16)
+		{
+			uv.uv[0] = (short)floorf(v.vert.x * 32767.0f + 0.5f);
+			uv.uv[1] = (short)floorf(v.vert.y * 32767.0f + 0.5f);
+			memcpy(out + i * sizeof(uv), &uv, sizeof(uv));
+		}
+		else
+		{
+			half.vert[0] = floatToHalf(v.vert.x);
+			half.vert[1] = floatToHalf(v.vert.y);
+			half.vert[2] = floatToHalf(v.vert.z);
+			half.vert[3] = floatToHalf(1.0f);
+			half.norm[0] = packSnorm8(v.norm.x);
+			half.norm[1] = packSnorm8(v.norm.y);
+			half.norm[2] = packSnorm8(v.norm.z);
+			half.norm[3] = 0;
+			memcpy(out + i * sizeof(half), &half, sizeof(half));
+		}
+	}
+	mesh->format = format;
+}
+
+size_t objectVertexBytes(const Object* obj)
+{
+	return (size_t)vertexFormatSize(obj->format) * obj->numVertices;
+}
+
+size_t objectIndexBytes(const Object* obj)
+{
+	return (obj->elementType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int)) * obj->numElements;
+}
+
+Object* uploadMesh(Mesh* mesh)
+{
+	const int size = vertexFormatSize(mesh->format);
+	const unsigned int* remap;
+	char* ordered = NULL;
+	Object* obj;
+	int i;
+
+	/* Share the index data, and put the vertices in its order */
 	obj = (Object*)malloc(sizeof(Object));
+	remap = acquireIndices(obj, mesh->x, mesh->y, indexOrder);
+	if (remap)
+	{
+		ordered = (char*)malloc((size_t)size * mesh->numVertices);
+		for (i = 0; i < mesh->numVertices; ++i)
+			memcpy(ordered + (size_t)size * remap[i], (char*)mesh->vertices + (size_t)size * i, size);
+	}
+
+	/* Create VBOs */
 	glGenBuffers(1, &obj->vertexBuffer);
-	glGenBuffers(1, &obj->elementBuffer);
 
 	/* Buffer the vertex data */
 	glBindBuffer(GL_ARRAY_BUFFER, obj->vertexBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_t) * numVertices, vertices, GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, size * mesh->numVertices, ordered ? ordered : (char*)mesh->vertices, GL_STATIC_DRAW);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-	/* Buffer the index data */
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj->elementBuffer);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * numIndices, indices, GL_STATIC_DRAW);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	free(ordered);
 
 	/* Cleanup and return the object struct */
-	obj->numVertices = numVertices;
-	obj->numElements = numIndices;
-	free(vertices);
-	free(indices);
+	obj->numVertices = mesh->numVertices;
+	obj->vertexOffset = 0;
+	obj->format = mesh->format;
+	freeMesh(mesh);
 	return obj;
 }
 
-void drawObject(Object* obj)
+void freeMesh(Mesh* mesh)
+{
+	free(mesh->vertices);
+	mesh->vertices = NULL;
+	mesh->numVertices = 0;
+}
+
+Object* createObject(ParametricObjFunc paramObjFunc, int x, int y, ...)
+{
+	va_list args;
+	unsigned int i, j;
+	float u, v;
+	Mesh mesh;
+
+	/* Construct vertex data, one call per vertex */
+	mesh.x = x;
+	mesh.y = y;
+	mesh.format = VERTEX_FLOAT;
+	mesh.numVertices = x * y;
+	mesh.vertices = (vertex_t*)malloc(sizeof(vertex_t) * mesh.numVertices);
+	for (i = 0; i < x; ++i)
+	{
+		u = i/(float)(x-1);
+		for (j = 0; j < y; ++j)
+		{
+			v = j/(float)(y-1);
+			va_start(args, y);
+			mesh.vertices[i * y + j] = paramObjFunc(u, v, &args);
+			va_end(args);
+		}
+	}
+	return uploadMesh(&mesh);
+}
+
+Object* createObjectBatch(ParametricBatchFunc batch, const void* args, int x, int y)
+{
+	Mesh mesh;
+
+	/* The workers are all done by the time buildMesh() returns, so only
+	 * the upload happens here */
+	buildMesh(&mesh, batch, args, x, y);
+	return uploadMesh(&mesh);
+}
+
+/* Binds the buffers and points at the layout's attributes */
+static void beginDraw(Object* obj)
 {
+	const char* base = (char*)0 + obj->vertexOffset;
+
 	/* Enable vertex arrays and bind VBOs */
 	glEnableClientState(GL_VERTEX_ARRAY);
-	glEnableClientState(GL_NORMAL_ARRAY);
 	glBindBuffer(GL_ARRAY_BUFFER, obj->vertexBuffer);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj->elementBuffer);
 
-	/* Draw object */
-	glVertexPointer(3, GL_FLOAT, sizeof(vertex_t), (void*)0);
-	glNormalPointer(GL_FLOAT, sizeof(vertex_t), (void*)sizeof(vector_t));
-	glDrawElements(GL_TRIANGLE_STRIP, obj->numElements, GL_UNSIGNED_INT, (void*)0);
+	/* Point at the layout's attributes */
+	switch (obj->format)
+	{
+	case VERTEX_UV16:
+		/* No normal, the shader scales gl_Vertex.xy back to [0, 1] */
+		glVertexPointer(2, GL_SHORT, sizeof(UV16Vertex), base);
+		break;
+	case VERTEX_HALF:
+		glEnableClientState(GL_NORMAL_ARRAY);
+		glVertexPointer(4, GL_HALF_FLOAT, sizeof(HalfVertex), base);
+		glNormalPointer(GL_BYTE, sizeof(HalfVertex), base + offsetof(HalfVertex, norm));
+		break;
+	default:
+		glEnableClientState(GL_NORMAL_ARRAY);
+		glVertexPointer(3, GL_FLOAT, sizeof(vertex_t), base);
+		glNormalPointer(GL_FLOAT, sizeof(vertex_t), base + sizeof(vector_t));
+	}
+
+	if (primitiveRestart)
+	{
+		glEnable(GL_PRIMITIVE_RESTART);
+		glPrimitiveRestartIndex(obj->elementType == GL_UNSIGNED_SHORT ? 0xFFFF : RESTART_INDEX);
+	}
+}
+
+static void endDraw()
+{
+	if (primitiveRestart)
+		glDisable(GL_PRIMITIVE_RESTART);
 
 	/* Unbind/disable arrays. could also push/pop enables */
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
@@ -201,6 +791,190 @@ void drawObject(Object* obj)
 	glDisableClientState(GL_NORMAL_ARRAY);
 }
 
+void drawObject(Object* obj)
+{
+	beginDraw(obj);
+	glDrawElements(obj->primitive, obj->numElements, obj->elementType, (void*)0);
+	endDraw();
+}
+
+int instancingSupported()
+{
+	return GLEW_VERSION_3_3 || (GLEW_ARB_draw_instanced && GLEW_ARB_instanced_arrays);
+}
+
+/* Points the instance attributes at instances, one element per instance */
+static void bindInstances(GLuint instances)
+{
+	int i;
+
+	glBindBuffer(GL_ARRAY_BUFFER, instances);
+	for (i = 0; i < 4; ++i)
+	{
+		glEnableVertexAttribArray(INSTANCE_MODEL_ATTRIB + i);
+		glVertexAttribPointer(INSTANCE_MODEL_ATTRIB + i, 4, GL_FLOAT, GL_FALSE, sizeof(Instance),
+			(char*)0 + offsetof(Instance, model) + sizeof(float) * 4 * i);
+		glVertexAttribDivisor(INSTANCE_MODEL_ATTRIB + i, 1);
+	}
+	glEnableVertexAttribArray(INSTANCE_DATA_ATTRIB);
+	glVertexAttribPointer(INSTANCE_DATA_ATTRIB, 2, GL_FLOAT, GL_FALSE, sizeof(Instance),
+		(char*)0 + offsetof(Instance, material));
+	glVertexAttribDivisor(INSTANCE_DATA_ATTRIB, 1);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+static void unbindInstances()
+{
+	int i;
+
+	for (i = 0; i < 4; ++i)
+	{
+		glVertexAttribDivisor(INSTANCE_MODEL_ATTRIB + i, 0);
+		glDisableVertexAttribArray(INSTANCE_MODEL_ATTRIB + i);
+	}
+	glVertexAttribDivisor(INSTANCE_DATA_ATTRIB, 0);
+	glDisableVertexAttribArray(INSTANCE_DATA_ATTRIB);
+}
+
+GLuint uploadInstances(GLuint buffer, const Instance* instances, int count)
+{
+	if (!buffer)
+		glGenBuffers(1, &buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(Instance) * count, instances, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return buffer;
+}
+
+void setInstance(const Instance* instance)
+{
+	int i;
+
+	for (i = 0; i < 4; ++i)
+		glVertexAttrib4fv(INSTANCE_MODEL_ATTRIB + i, instance->model + 4 * i);
+	glVertexAttrib2f(INSTANCE_DATA_ATTRIB, instance->material, instance->phase);
+}
+
+void drawObjectInstanced(Object* obj, GLuint instances, int count)
+{
+	beginDraw(obj);
+	bindInstances(instances);
+	glDrawElementsInstanced(obj->primitive, obj->numElements, obj->elementType, (void*)0, count);
+	unbindInstances();
+	endDraw();
+}
+
+void drawGrid(int x, int y)
+{
+	/* The degenerate joined strip layout of an index buffer without
+	 * primitive restart, which needs no per-strip draw */
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, (y-1) * (x * 2 + 2));
+}
+
+void drawPatches(int x, int y)
+{
+	glPatchParameteri(GL_PATCH_VERTICES, 4);
+	glDrawArrays(GL_PATCHES, 0, (x-1) * (y-1) * 4);
+}
+
+void drawGridInstanced(int x, int y, GLuint instances, int count)
+{
+	bindInstances(instances);
+	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, (y-1) * (x * 2 + 2), count);
+	unbindInstances();
+}
+
+LodChain* createLodChain(ParametricBatchFunc batch, const void* args, int minTess, int maxTess, VertexFormat format)
+{
+	LodChain* chain;
+	DrawElementsIndirectCommand* draw;
+	Mesh mesh;
+	MeshTask task;
+	char* vertices;
+	unsigned int* indices;
+	int i, size, side;
+
+	assert(maxTess - minTess < MAX_LOD_LEVELS);
+	if (primitiveRestart < 0)
+		primitiveRestart = GLEW_VERSION_3_1;
+
+	chain = (LodChain*)malloc(sizeof(LodChain));
+	chain->minTess = minTess;
+	chain->levels = maxTess - minTess + 1;
+	chain->object.numVertices = 0;
+	chain->object.numElements = 0;
+	for (i = 0; i < chain->levels; ++i)
+	{
+		side = (1 << (minTess + i)) + 1;
+		draw = &chain->draws[i];
+		draw->count = (side-1) * stripLength(side, primitiveRestart);
+		draw->instanceCount = 0;
+		draw->firstIndex = chain->object.numElements;
+		draw->baseVertex = chain->object.numVertices;
+		draw->baseInstance = 0;
+		chain->object.numVertices += side * side;
+		chain->object.numElements += draw->count;
+	}
+
+	/* Each level's vertices and indices after the last's. The indices
+	 * start from 0 again, baseVertex offsets them. */
+	size = vertexFormatSize(format);
+	vertices = (char*)malloc((size_t)size * chain->object.numVertices);
+	indices = (unsigned int*)malloc(sizeof(unsigned int) * chain->object.numElements);
+	for (i = 0; i < chain->levels; ++i)
+	{
+		side = (1 << (minTess + i)) + 1;
+		draw = &chain->draws[i];
+		fillMesh(&mesh, batch, args, side, side, NULL, 0);
+		packMesh(&mesh, format);
+		memcpy(vertices + (size_t)size * draw->baseVertex, mesh.vertices, (size_t)size * mesh.numVertices);
+		freeMesh(&mesh);
+
+		task.x = side;
+		task.y = side;
+		task.indices = indices + draw->firstIndex;
+		task.restart = primitiveRestart;
+		task.cancel = NULL;
+		parallelForNoWait(fillIndexStrips, &task, side-1);
+	}
+
+	glGenBuffers(1, &chain->object.vertexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, chain->object.vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, (size_t)size * chain->object.numVertices, vertices, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glGenBuffers(1, &chain->object.elementBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, chain->object.elementBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * chain->object.numElements, indices, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	free(vertices);
+	free(indices);
+
+	chain->object.elementType = GL_UNSIGNED_INT;
+	chain->object.primitive = GL_TRIANGLE_STRIP;
+	chain->object.vertexOffset = 0;
+	chain->object.format = format;
+	return chain;
+}
+
+void drawLodChainIndirect(LodChain* chain, GLuint instances, GLuint commands)
+{
+	beginDraw(&chain->object);
+	bindInstances(instances);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands);
+	glMultiDrawElementsIndirect(GL_TRIANGLE_STRIP, GL_UNSIGNED_INT, (void*)0, chain->levels, 0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	unbindInstances();
+	endDraw();
+}
+
+void freeLodChain(LodChain* chain)
+{
+	/* Its indices are its own, not shared like an object's */
+	glDeleteBuffers(1, &chain->object.vertexBuffer);
+	glDeleteBuffers(1, &chain->object.elementBuffer);
+	free(chain);
+}
+
 void drawNormals(Object* obj)
 {
 	/* Enable vertex arrays and bind VBOs */
@@ -225,9 +999,131 @@ void drawNormals(Object* obj)
 void freeObject(Object* obj)
 {
 	glDeleteBuffers(1, &obj->vertexBuffer);
-	glDeleteBuffers(1, &obj->elementBuffer);
-	obj->vertexBuffer = 0;
-	obj->elementBuffer = 0;
-	obj->numElements = 0;
+	releaseIndices(obj);
+	free(obj);
+}
+
+
+/* Evaluates every row of the grid into vertices using the worker pool */
+static void fillVertices(DynamicObject* dyn, const void* args, vertex_t* vertices)
+{
+	MeshTask task;
+
+	task.batch = dyn->batch;
+	task.args = args;
+	task.x = dyn->x;
+	task.y = dyn->y;
+	task.vertices = vertices;
+	task.cancel = NULL;
+	parallelForNoWait(fillVertexRows, &task, dyn->x);
+}
+
+DynamicObject* createDynamicObject(ParametricBatchFunc batch, const void* args, int x, int y)
+{
+	const GLbitfield mapFlags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	DynamicObject* dyn;
+	GLsizeiptr size;
+	int i;
+
+	dyn = (DynamicObject*)malloc(sizeof(DynamicObject));
+	dyn->batch = batch;
+	dyn->x = x;
+	dyn->y = y;
+	dyn->segment = 0;
+	for (i = 0; i < DYNAMIC_RING; ++i)
+		dyn->fences[i] = 0;
+	dyn->persistent = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+
+	/* The indices never change. They stay strips whatever the index order,
+	 * the batch function writes the vertices in grid order every frame. */
+	acquireIndices(&dyn->object, x, y, INDEX_STRIPS);
+	dyn->object.numVertices = x * y;
+	dyn->object.vertexOffset = 0;
+	dyn->object.format = VERTEX_FLOAT;
+	size = sizeof(vertex_t) * dyn->object.numVertices;
+
+	glGenBuffers(1, &dyn->object.vertexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, dyn->object.vertexBuffer);
+	if (dyn->persistent)
+	{
+		glBufferStorage(GL_ARRAY_BUFFER, size * DYNAMIC_RING, NULL, mapFlags);
+		dyn->vertices = (vertex_t*)glMapBufferRange(GL_ARRAY_BUFFER, 0, size * DYNAMIC_RING, mapFlags);
+		if (!dyn->vertices)
+		{
+			/* Buffer storage is immutable, start over with a plain buffer */
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			glDeleteBuffers(1, &dyn->object.vertexBuffer);
+			glGenBuffers(1, &dyn->object.vertexBuffer);
+			glBindBuffer(GL_ARRAY_BUFFER, dyn->object.vertexBuffer);
+			dyn->persistent = 0;
+		}
+	}
+	if (!dyn->persistent)
+	{
+		glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+		dyn->vertices = (vertex_t*)malloc(size);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	updateDynamicObject(dyn, args);
+	return dyn;
+}
+
+void updateDynamicObject(DynamicObject* dyn, const void* args)
+{
+	const GLsizeiptr size = sizeof(vertex_t) * dyn->object.numVertices;
+	GLenum status;
+
+	if (!dyn->persistent)
+	{
+		fillVertices(dyn, args, dyn->vertices);
+
+		/* Orphan the old storage so the driver need not wait for draws
+		 * still reading it */
+		glBindBuffer(GL_ARRAY_BUFFER, dyn->object.vertexBuffer);
+		glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, size, dyn->vertices);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		return;
+	}
+
+	/* Everything issued so far, including draws from the current segment,
+	 * is behind this fence */
+	if (dyn->fences[dyn->segment])
+		glDeleteSync(dyn->fences[dyn->segment]);
+	dyn->fences[dyn->segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	/* Move on to the oldest segment, waiting if the GPU still reads it */
+	dyn->segment = (dyn->segment + 1) % DYNAMIC_RING;
+	if (dyn->fences[dyn->segment])
+	{
+		do
+			status = glClientWaitSync(dyn->fences[dyn->segment], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+		while (status == GL_TIMEOUT_EXPIRED);
+		glDeleteSync(dyn->fences[dyn->segment]);
+		dyn->fences[dyn->segment] = 0;
+	}
+
+	fillVertices(dyn, args, dyn->vertices + dyn->segment * dyn->object.numVertices);
+	dyn->object.vertexOffset = size * dyn->segment;
 }
 
+void freeDynamicObject(DynamicObject* dyn)
+{
+	int i;
+
+	for (i = 0; i < DYNAMIC_RING; ++i)
+		if (dyn->fences[i])
+			glDeleteSync(dyn->fences[i]);
+	if (dyn->persistent)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, dyn->object.vertexBuffer);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+	else
+		free(dyn->vertices);
+	glDeleteBuffers(1, &dyn->object.vertexBuffer);
+	releaseIndices(&dyn->object);
+	free(dyn);
+}
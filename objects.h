@@ -12,6 +12,9 @@
 
 #include <GL/gl.h>
 #include <stdarg.h>
+#include <stddef.h>
+
+#include "vertex-cache.h"
 
 typedef struct {
 	float x, y, z;
@@ -22,11 +25,24 @@ typedef struct {
 	vector_t norm;
 } vertex_t;
 
+/* Layouts an Object's vertex buffer can have. Meshes are always generated
+ * as VERTEX_FLOAT and converted by packMesh(). */
+typedef enum {
+	VERTEX_FLOAT, /* vertex_t, 24 bytes */
+	VERTEX_UV16, /* u and v only, as 16 bit fixed point (x 32767), 4 bytes */
+	VERTEX_HALF, /* half float position (w = 1), 8 bit signed normal, 12 bytes */
+	VERTEX_FORMAT_MAX
+} VertexFormat;
+
 typedef struct ObjectType {
 	GLuint vertexBuffer;
-	GLuint elementBuffer;
+	GLuint elementBuffer; /* shared by all objects with the same grid size */
+	GLenum elementType; /* GL_UNSIGNED_SHORT below 65536 vertices */
+	GLenum primitive; /* GL_TRIANGLE_STRIP, or GL_TRIANGLES, see IndexOrder */
   int numVertices;
 	int numElements;
+	GLintptr vertexOffset; /* bytes into vertexBuffer, non-zero for DynamicObject */
+	VertexFormat format;
 } Object;
 
 typedef vertex_t (*ParametricObjFunc)(float, float, va_list*);
@@ -36,6 +52,37 @@ vertex_t parametricTorus(float u, float v, va_list* args); /* args: inner-radius
 vertex_t parametricWave(float u, float v, va_list* args); /* args: width, height, time */
 vertex_t parametricGrid(float u, float v, va_list* args); /* args: N/A */
 
+/* Batched versions of the above. The arguments are given once in a typed
+ * struct and a range of rows [row0, row1) of an x by y grid is filled in one
+ * call, where row i holds the y vertices at u = i/(x-1), starting at
+ * vertices[i * y]. Trig that only depends on u or only on v is computed once
+ * per row or column rather than once per vertex. */
+typedef struct {
+	float radius;
+} SphereArgs;
+
+typedef struct {
+	float R, r; /* distance from the centre to the tube, tube radius */
+} TorusArgs;
+
+typedef struct {
+	float width, height, time;
+} WaveArgs;
+
+/* Any of the above, e.g. to keep a copy of the arguments of a request */
+typedef union {
+	SphereArgs sphere;
+	TorusArgs torus;
+	WaveArgs wave;
+} ParametricArgs;
+
+typedef void (*ParametricBatchFunc)(const void* args, int x, int y, int row0, int row1, vertex_t* vertices);
+
+void batchSphere(const void* args, int x, int y, int row0, int row1, vertex_t* vertices); /* args: SphereArgs */
+void batchTorus(const void* args, int x, int y, int row0, int row1, vertex_t* vertices); /* args: TorusArgs */
+void batchWave(const void* args, int x, int y, int row0, int row1, vertex_t* vertices); /* args: WaveArgs */
+void batchGrid(const void* args, int x, int y, int row0, int row1, vertex_t* vertices); /* args: NULL */
+
 void drawAxes(float x, float y, float z, float length);
 
 /*
@@ -43,8 +90,166 @@ USAGE:
 myobject = createObject(<a parametric function from the list above>, <tessellation x>, <tessellation y>, <function arguments (args)>);
 */
 Object* createObject(ParametricObjFunc parametric, int x, int y, ...);
+
+/*
+USAGE:
+TorusArgs args = {1.0f, 0.5f};
+myobject = createObjectBatch(batchTorus, &args, <tessellation x>, <tessellation y>);
+*/
+Object* createObjectBatch(ParametricBatchFunc batch, const void* args, int x, int y);
+
+/* createObjectBatch() in two halves: buildMesh() fills a CPU side vertex
+ * array using the worker pool (see workers.h) and needs no GL, uploadMesh()
+ * turns it into a VBO and frees it. Triangle strip indices only depend on the
+ * grid size, so uploadMesh() builds them once per size and shares them
+ * between objects (reference counted, freed with the last freeObject()). */
+typedef struct {
+	vertex_t* vertices; /* vertexFormatSize(format) bytes each after packMesh() */
+	int numVertices;
+	int x, y;
+	VertexFormat format;
+} Mesh;
+
+void buildMesh(Mesh* mesh, ParametricBatchFunc batch, const void* args, int x, int y);
+/* As buildMesh(), but gives up and returns 0 (with nothing allocated) if
+ * *cancel becomes non-zero part way through. Returns 1 when complete. */
+int buildMeshCancellable(Mesh* mesh, ParametricBatchFunc batch, const void* args, int x, int y, const volatile int* cancel);
+/* Converts the vertices to format in place. VERTEX_UV16 keeps vert.x and
+ * vert.y, so is only meant for batchGrid meshes (see mesh-generation.vert). */
+void packMesh(Mesh* mesh, VertexFormat format);
+Object* uploadMesh(Mesh* mesh);
+
+/* How uploadMesh() orders a grid's triangles (see vertex-cache.h). Strips
+ * are the smallest index buffer; the triangle lists are three times the size
+ * but run the vertex shader about half as often at high tessellation, and
+ * come with the vertices reordered to match. Only affects objects uploaded
+ * after it is set; DynamicObjects always use strips. */
+typedef enum {
+	INDEX_STRIPS, /* one strip per row, joined */
+	INDEX_TILED, /* triangle list in cache sized blocks */
+	INDEX_OPTIMIZED, /* the blocks reordered by optimizeVertexCache() */
+	INDEX_ORDER_MAX
+} IndexOrder;
+
+void setIndexOrder(IndexOrder order);
+IndexOrder getIndexOrder();
+const char* indexOrderName(IndexOrder order);
+/* The simulated cache behaviour of obj's indices, zero if it has none */
+void objectCacheStats(const Object* obj, VertexCacheStats* stats);
+void freeMesh(Mesh* mesh);
+int vertexFormatSize(VertexFormat format);
+const char* vertexFormatName(VertexFormat format);
+int vertexFormatSupported(VertexFormat format); /* needs a GL context */
+size_t objectVertexBytes(const Object* obj);
+size_t objectIndexBytes(const Object* obj); /* shared, see uploadMesh() */
 void drawObject(Object* obj);
 void drawNormals(Object* obj);
-void freeObject(Object* obj);
+
+/* Draws an x by y grid with no vertex or index buffers, for a vertex shader
+ * that derives u and v from gl_VertexID (see ATTRIBUTELESS in
+ * mesh-generation.vert, which must be given gridSize = (x, y)) */
+void drawGrid(int x, int y);
+
+/* Draws the (x-1) by (y-1) cells of an x by y grid as patches of four
+ * corners with no vertex buffers, for tessellation shaders that place the
+ * corners from gl_VertexID (see TESSELLATION in mesh-generation.vert, which
+ * must be given gridSize = (x, y)). Needs GL 4.0. */
+void drawPatches(int x, int y);
+void freeObject(Object* obj); /* deletes the VBOs and frees obj */
+
+/* Instanced drawing: N copies of an object (or shader grid) in one draw
+ * call, each with its own transform, material and animation phase taken from
+ * a buffer of Instances. The shaders read them as generic attributes
+ * INSTANCE_MODEL_ATTRIB (a mat4, so it and the next three) and
+ * INSTANCE_DATA_ATTRIB (material, phase), see INSTANCED in
+ * mesh-generation.vert. Needs GL 3.3 or ARB_draw_instanced and
+ * ARB_instanced_arrays.
+
+USAGE:
+buffer = uploadInstances(0, instances, count); again with buffer to refill it
+drawObjectInstanced(obj, buffer, count);
+*/
+#define INSTANCE_MODEL_ATTRIB 4
+#define INSTANCE_DATA_ATTRIB 8
+
+typedef struct {
+	float model[16]; /* column major, object to world, rotation and translation only */
+	float material; /* index into the shaders' material table */
+	float phase; /* seconds added to the animation time */
+	float pad[2];
+} Instance;
+
+int instancingSupported(); /* needs a GL context */
+GLuint uploadInstances(GLuint buffer, const Instance* instances, int count);
+void drawObjectInstanced(Object* obj, GLuint instances, int count);
+void drawGridInstanced(int x, int y, GLuint instances, int count);
+/* The same instance attributes for a plain draw, to draw them one by one */
+void setInstance(const Instance* instance);
+
+/* Levels of detail: a surface's grid at every tessellation from minTess to
+ * maxTess (a 2^tess + 1 square grid each), all in one vertex and one index
+ * buffer so a single glMultiDrawElementsIndirect can draw any mix of them.
+ * draws[i] is level i's range, as an indirect command for no instances.
+ * drawLodChainIndirect() takes the commands, one per level in order, from a
+ * GL_DRAW_INDIRECT_BUFFER and the instances they draw from the buffer given,
+ * from baseInstance on (see gpu-culling.h). Needs GL 4.3.
+
+USAGE:
+chain = createLodChain(batchGrid, NULL, 2, 10, VERTEX_UV16);
+drawLodChainIndirect(chain, instances, commands);
+*/
+#define MAX_LOD_LEVELS 16
+
+typedef struct {
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+} DrawElementsIndirectCommand;
+
+typedef struct {
+	Object object; /* the buffers, numVertices and numElements cover every level */
+	int minTess;
+	int levels;
+	DrawElementsIndirectCommand draws[MAX_LOD_LEVELS];
+} LodChain;
+
+LodChain* createLodChain(ParametricBatchFunc batch, const void* args, int minTess, int maxTess, VertexFormat format);
+void drawLodChainIndirect(LodChain* chain, GLuint instances, GLuint commands);
+void freeLodChain(LodChain* chain);
+
+/* An object whose vertices change every frame but whose grid does not, such
+ * as the animated wave. The index buffer and GL buffer names live as long as
+ * the object; updateDynamicObject() re-evaluates the vertices in place and
+ * streams them without allocating. With ARB_buffer_storage the vertex buffer
+ * is a persistently mapped ring of DYNAMIC_RING copies the batch function
+ * writes straight into, each guarded by a fence so the GPU is never
+ * overwritten mid-draw. Otherwise the buffer is orphaned and refilled with
+ * glBufferSubData() from one CPU array.
+
+USAGE:
+WaveArgs args = {2.0f, 2.0f, 0.0f};
+dyn = createDynamicObject(batchWave, &args, <tessellation x>, <tessellation y>);
+...every frame:
+args.time = t;
+updateDynamicObject(dyn, &args);
+drawObject(&dyn->object);
+*/
+#define DYNAMIC_RING 3
+
+typedef struct {
+	Object object;
+	ParametricBatchFunc batch;
+	int x, y;
+	vertex_t* vertices; /* the CPU copy, or the persistent mapping */
+	int persistent;
+	int segment; /* ring segment object.vertexOffset points at */
+	GLsync fences[DYNAMIC_RING];
+} DynamicObject;
+
+DynamicObject* createDynamicObject(ParametricBatchFunc batch, const void* args, int x, int y);
+void updateDynamicObject(DynamicObject* dyn, const void* args);
+void freeDynamicObject(DynamicObject* dyn);
 
 #endif
@@ -0,0 +1,365 @@
+/* profiler.c */
+
+#include <GL/glew.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profiler.h"
+#include "timer.h"
+
+#ifndef NDEBUG
+
+#define FRAMES (PROFILE_LATENCY + 1)
+#define BAR_ROW 6 /* pixels per nesting level */
+#define MAX_SUMMARY 12 /* scopes listed in the OSD line */
+
+typedef struct {
+	const char* name;
+	int depth;
+	double cpuStart, cpuEnd; /* getTime() seconds */
+	double gpuStart, gpuEnd; /* on the same clock, negative if not measured */
+} ProfileScope;
+
+typedef struct {
+	ProfileScope scopes[PROFILE_MAX_SCOPES];
+	GLuint queries[PROFILE_MAX_SCOPES * 2]; /* a GL_TIMESTAMP at each scope's start and end */
+	int count;
+	double start, end;
+	int pending; /* ended, its queries not read yet */
+} ProfileFrame;
+
+typedef struct {
+	const char* name;
+	double start, end;
+	int gpu;
+} TraceEvent;
+
+static ProfileFrame frames[FRAMES];
+static ProfileFrame shown; /* the latest frame read back */
+static int current = 0;
+static int inFrame = 0;
+static int stack[PROFILE_MAX_DEPTH];
+static int depth = 0;
+static int overflow = 0; /* scopes begun past PROFILE_MAX_DEPTH, ignored */
+
+static int initialised = 0;
+static int haveTimer = 0;
+static double gpuToCpu; /* add to a GL_TIMESTAMP, in seconds, for getTime() */
+
+static int tracing = 0;
+static TraceEvent* trace = NULL;
+static size_t traceSize = 0, traceCapacity = 0;
+
+static void init()
+{
+	GLint64 timestamp;
+	int i;
+
+	initialised = 1;
+	haveTimer = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+	if (!haveTimer)
+		return;
+	for (i = 0; i < FRAMES; ++i)
+		glGenQueries(PROFILE_MAX_SCOPES * 2, frames[i].queries);
+
+	/* GPU timestamps are on their own clock; line them up with the CPU's
+	 * once, drift over a run is far below what the bar shows */
+	glGetInteger64v(GL_TIMESTAMP, &timestamp);
+	gpuToCpu = getTime() - timestamp * 1e-9;
+}
+
+static void traceEvent(const char* name, double start, double end, int gpu)
+{
+	if (traceSize == traceCapacity)
+	{
+		traceCapacity = traceCapacity ? traceCapacity * 2 : 4096;
+		trace = (TraceEvent*)realloc(trace, sizeof(TraceEvent) * traceCapacity);
+	}
+	trace[traceSize].name = name;
+	trace[traceSize].start = start;
+	trace[traceSize].end = end;
+	trace[traceSize].gpu = gpu;
+	++traceSize;
+}
+
+/* Reads a finished frame's timestamps if the GPU has got to them, which
+ * PROFILE_LATENCY frames later it nearly always has, and shows it */
+static void readFrame(ProfileFrame* frame)
+{
+	GLuint available = 0;
+	GLuint64 begin, end;
+	ProfileScope* s;
+	int i;
+
+	frame->pending = 0;
+	if (haveTimer && frame->count)
+		glGetQueryObjectuiv(frame->queries[frame->count * 2 - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+	for (i = 0; i < frame->count; ++i)
+	{
+		s = &frame->scopes[i];
+		s->gpuStart = s->gpuEnd = -1.0;
+		if (!available)
+			continue;
+		glGetQueryObjectui64v(frame->queries[i * 2], GL_QUERY_RESULT, &begin);
+		glGetQueryObjectui64v(frame->queries[i * 2 + 1], GL_QUERY_RESULT, &end);
+		s->gpuStart = begin * 1e-9 + gpuToCpu;
+		s->gpuEnd = end * 1e-9 + gpuToCpu;
+	}
+
+	if (tracing)
+	{
+		for (i = 0; i < frame->count; ++i)
+		{
+			s = &frame->scopes[i];
+			traceEvent(s->name, s->cpuStart, s->cpuEnd, 0);
+			if (s->gpuStart >= 0.0)
+				traceEvent(s->name, s->gpuStart, s->gpuEnd, 1);
+		}
+	}
+	shown = *frame;
+}
+
+void profileBeginFrame()
+{
+	ProfileFrame* frame;
+
+	if (!initialised)
+		init();
+	current = (current + 1) % FRAMES;
+	frame = &frames[current];
+	if (frame->pending)
+		readFrame(frame);
+	frame->count = 0;
+	frame->start = getTime();
+	depth = 0;
+	overflow = 0;
+	inFrame = 1;
+}
+
+void profileEndFrame()
+{
+	ProfileFrame* frame = &frames[current];
+
+	if (!inFrame)
+		return;
+	/* Anything left open ends with the frame */
+	while (depth > 0)
+		profileEnd();
+	frame->end = getTime();
+	frame->pending = 1;
+	inFrame = 0;
+}
+
+void profileBegin(const char* name)
+{
+	ProfileFrame* frame = &frames[current];
+	ProfileScope* s;
+
+	if (!inFrame)
+		return;
+	if (depth == PROFILE_MAX_DEPTH || overflow)
+	{
+		++overflow;
+		return;
+	}
+	if (frame->count == PROFILE_MAX_SCOPES)
+	{
+		stack[depth++] = -1;
+		return;
+	}
+	s = &frame->scopes[frame->count];
+	s->name = name;
+	s->depth = depth;
+	if (haveTimer)
+		glQueryCounter(frame->queries[frame->count * 2], GL_TIMESTAMP);
+	s->cpuStart = getTime();
+	stack[depth++] = frame->count++;
+}
+
+void profileEnd()
+{
+	ProfileFrame* frame = &frames[current];
+	int i;
+
+	if (!inFrame)
+		return;
+	if (overflow)
+	{
+		--overflow;
+		return;
+	}
+	if (depth == 0)
+		return;
+	i = stack[--depth];
+	if (i < 0)
+		return;
+	frame->scopes[i].cpuEnd = getTime();
+	if (haveTimer)
+		glQueryCounter(frame->queries[i * 2 + 1], GL_TIMESTAMP);
+}
+
+/* A stable colour per scope name */
+static void nameColour(const char* name)
+{
+	static const float palette[][3] = {
+		{0.9f, 0.4f, 0.3f}, {0.3f, 0.7f, 0.9f}, {0.9f, 0.8f, 0.3f}, {0.5f, 0.9f, 0.4f},
+		{0.8f, 0.5f, 0.9f}, {0.9f, 0.6f, 0.2f}, {0.4f, 0.9f, 0.8f}, {0.9f, 0.5f, 0.7f},
+	};
+	unsigned int hash = 5381;
+	const char* p;
+
+	for (p = name; *p; ++p)
+		hash = hash * 33 + (unsigned char)*p;
+	glColor3fv(palette[hash % (sizeof(palette) / sizeof(palette[0]))]);
+}
+
+static void bar(float x0, float x1, float y)
+{
+	if (x1 - x0 < 1.0f)
+		x1 = x0 + 1.0f; /* still visible */
+	glVertex2f(x0, y);
+	glVertex2f(x1, y);
+	glVertex2f(x1, y + BAR_ROW - 1);
+	glVertex2f(x0, y + BAR_ROW - 1);
+}
+
+void drawProfiler(int width, int height)
+{
+	const float scale = width / (PROFILE_BAR_MS * 1e-3); /* pixels per second */
+	const float budget = 1.0 / 60.0 * scale;
+	const ProfileScope* s;
+	float gpuY;
+	int rows = 0;
+	int i;
+
+	if (!shown.count)
+		return;
+	for (i = 0; i < shown.count; ++i)
+		if (shown.scopes[i].depth >= rows)
+			rows = shown.scopes[i].depth + 1;
+	gpuY = 4 + (rows + 1) * BAR_ROW;
+
+	glPushAttrib(GL_ENABLE_BIT | GL_CURRENT_BIT | GL_POLYGON_BIT);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_LIGHTING);
+	glDisable(GL_CULL_FACE);
+	glDisable(GL_TEXTURE_2D);
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	glOrtho(0, width, 0, height, -1, 1);
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+
+	/* Scopes from the frame's start, CPU along the bottom, GPU above, one
+	 * row per nesting level */
+	glBegin(GL_QUADS);
+	for (i = 0; i < shown.count; ++i)
+	{
+		s = &shown.scopes[i];
+		nameColour(s->name);
+		bar((s->cpuStart - shown.start) * scale, (s->cpuEnd - shown.start) * scale,
+				4 + s->depth * BAR_ROW);
+		if (s->gpuStart >= 0.0)
+			bar((s->gpuStart - shown.start) * scale, (s->gpuEnd - shown.start) * scale,
+					gpuY + s->depth * BAR_ROW);
+	}
+	glEnd();
+
+	/* The 60 Hz budget */
+	glColor3f(1, 1, 1);
+	glBegin(GL_LINES);
+	glVertex2f(budget, 0);
+	glVertex2f(budget, gpuY + rows * BAR_ROW);
+	glEnd();
+
+	glPopMatrix();
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glPopAttrib();
+}
+
+void profileSummary(char* buffer, size_t size)
+{
+	const ProfileScope* s;
+	const char* separator;
+	size_t length = 0;
+	int i, n;
+
+	buffer[0] = '\0';
+	for (i = 0; i < shown.count && i < MAX_SUMMARY && length < size; ++i)
+	{
+		s = &shown.scopes[i];
+		separator = !i ? "" : s->depth ? ", " : "\n";
+		if (s->gpuStart >= 0.0)
+			n = snprintf(buffer + length, size - length, "%s%s %.2f/%.2f", separator, s->name,
+					(s->cpuEnd - s->cpuStart) * 1e3, (s->gpuEnd - s->gpuStart) * 1e3);
+		else
+			n = snprintf(buffer + length, size - length, "%s%s %.2f/-", separator, s->name,
+					(s->cpuEnd - s->cpuStart) * 1e3);
+		if (n < 0)
+			break;
+		length += n;
+	}
+}
+
+void startProfileTrace()
+{
+	tracing = 1;
+}
+
+int writeProfileTrace(const char* file)
+{
+	FILE* f;
+	double origin;
+	size_t i;
+
+	if (!(f = fopen(file, "w")))
+		return -1;
+
+	/* The last frames' queries too, it's the end so waiting is fine */
+	if (initialised)
+	{
+		glFinish();
+		for (i = 1; i <= FRAMES; ++i)
+			if (frames[(current + i) % FRAMES].pending)
+				readFrame(&frames[(current + i) % FRAMES]);
+	}
+
+	/* Trace Event Format: complete ("X") events in microseconds, the CPU
+	 * and GPU as two threads of one process */
+	origin = traceSize ? trace[0].start : 0.0;
+	for (i = 0; i < traceSize; ++i)
+		if (trace[i].start < origin)
+			origin = trace[i].start;
+	fprintf(f, "{\"traceEvents\":[\n");
+	fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n");
+	fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}");
+	for (i = 0; i < traceSize; ++i)
+		fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+				trace[i].name, trace[i].gpu ? 2 : 1, (trace[i].start - origin) * 1e6,
+				(trace[i].end - trace[i].start) * 1e6);
+	fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+	return fclose(f) ? -1 : 0;
+}
+
+void freeProfiler()
+{
+	int i;
+
+	if (initialised && haveTimer)
+		for (i = 0; i < FRAMES; ++i)
+			glDeleteQueries(PROFILE_MAX_SCOPES * 2, frames[i].queries);
+	initialised = 0;
+	inFrame = 0;
+	free(trace);
+	trace = NULL;
+	traceSize = traceCapacity = 0;
+}
+
+#endif
@@ -0,0 +1,55 @@
+/* profiler.h */
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stddef.h>
+
+/* Scoped CPU and GPU timers for the thread drawing. CPU times come from
+ * getTime() (clock_gettime), GPU times from GL_TIMESTAMP queries at the start
+ * and end of each scope. A frame's queries are only read PROFILE_LATENCY
+ * frames later, and skipped if they still aren't ready, so the CPU never
+ * waits for them. The latest complete frame is drawn as a flame bar (CPU
+ * underneath, GPU above) and summarised for the OSD; with a trace started,
+ * every frame is kept for a Chrome trace (chrome://tracing, Perfetto).
+ * Scopes nest up to PROFILE_MAX_DEPTH deep, all on the thread that began the
+ * frame. Everything compiles out with NDEBUG.
+
+USAGE:
+profileBeginFrame();
+PROFILE_BEGIN("display"); ... PROFILE_END();
+profileEndFrame();
+drawProfiler(width, height); profileSummary(buffer, size); for the OSD
+startProfileTrace(); ... writeProfileTrace("trace.json");
+*/
+#define PROFILE_LATENCY 2
+#define PROFILE_MAX_SCOPES 64 /* per frame, later ones are dropped */
+#define PROFILE_MAX_DEPTH 8
+#define PROFILE_BAR_MS 33.3 /* the flame bar's width, two 60 Hz frames */
+
+#ifdef NDEBUG
+#define PROFILE_BEGIN(name)
+#define PROFILE_END()
+#define profileBeginFrame()
+#define profileEndFrame()
+#define drawProfiler(width, height)
+#define profileSummary(buffer, size) ((buffer)[0] = '\0')
+#define startProfileTrace()
+#define writeProfileTrace(file) 0
+#define freeProfiler()
+#else
+#define PROFILE_BEGIN(name) profileBegin(name)
+#define PROFILE_END() profileEnd()
+
+void profileBeginFrame();
+void profileEndFrame();
+void profileBegin(const char* name); /* name must outlive the profiler, e.g. a literal */
+void profileEnd();
+void drawProfiler(int width, int height);
+void profileSummary(char* buffer, size_t size); /* "name cpu/gpu ms", a line per outermost scope */
+void startProfileTrace();
+int writeProfileTrace(const char* file); /* returns 0 on success */
+void freeProfiler();
+#endif
+
+#endif
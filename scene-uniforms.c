@@ -0,0 +1,191 @@
+/* scene-uniforms.c */
+
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+#include <GL/glew.h>
+
+#include "scene-uniforms.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/* std140 puts the array of structs on a 16 byte boundary after the ivec2 */
+typedef char checkLightsOffset[offsetof(SceneUniforms, lights) == 288 ? 1 : -1];
+typedef char checkLightSize[sizeof(SceneLight) == 80 ? 1 : -1];
+typedef char checkClusterOffset[offsetof(SceneUniforms, clusterParams) == 608 ? 1 : -1];
+typedef char checkMaterialsOffset[offsetof(SceneUniforms, materials) == 640 ? 1 : -1];
+
+static GLuint buffer = 0;
+static SceneUniforms uploaded;
+static int uploads = 0;
+
+int sceneUniformsSupported()
+{
+	return GLEW_VERSION_3_1 || GLEW_ARB_uniform_buffer_object;
+}
+
+void bindSceneUniforms(GLuint program)
+{
+	GLuint block = glGetUniformBlockIndex(program, "Scene");
+	if (block != GL_INVALID_INDEX)
+		glUniformBlockBinding(program, block, SCENE_BINDING);
+}
+
+static void normalize3(float* v)
+{
+	float length = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+	if (length > 0.0f)
+	{
+		v[0] /= length;
+		v[1] /= length;
+		v[2] /= length;
+	}
+}
+
+void normalMatrix(float* n, const float* m)
+{
+	float det;
+	int i, j;
+
+	/* Cofactors of the 3x3, which is the inverse transpose times det */
+	for (i = 0; i < 3; ++i)
+	{
+		for (j = 0; j < 3; ++j)
+		{
+			int i1 = (i + 1) % 3, i2 = (i + 2) % 3;
+			int j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+			n[i * 4 + j] = m[i1 * 4 + j1] * m[i2 * 4 + j2] - m[i1 * 4 + j2] * m[i2 * 4 + j1];
+		}
+		n[i * 4 + 3] = 0.0f;
+	}
+	det = m[0] * n[0] + m[1] * n[1] + m[2] * n[2];
+	for (i = 0; i < 12; ++i)
+		n[i] /= det;
+	n[12] = n[13] = n[14] = 0.0f;
+	n[15] = 1.0f;
+}
+
+int updateSceneUniforms(SceneUniforms* scene)
+{
+	SceneLight* light;
+	int i;
+
+	/* Derived values */
+	normalMatrix(scene->normalMatrix, scene->modelView);
+	for (i = 0; i < scene->numLights; ++i)
+	{
+		/* For a viewer at infinity, as the fixed function pipeline does */
+		light = &scene->lights[i];
+		memcpy(light->halfVector, light->position, sizeof(float) * 3);
+		normalize3(light->halfVector);
+		light->halfVector[2] += 1.0f;
+		normalize3(light->halfVector);
+		light->halfVector[3] = 1.0f;
+	}
+	memset(scene->pad, 0, sizeof(scene->pad));
+	memset(scene->lights + scene->numLights, 0, sizeof(SceneLight) * (MAX_LIGHTS - scene->numLights));
+
+	if (!buffer)
+	{
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(SceneUniforms), NULL, GL_DYNAMIC_DRAW);
+		glBindBufferBase(GL_UNIFORM_BUFFER, SCENE_BINDING, buffer);
+	}
+	else if (!memcmp(scene, &uploaded, sizeof(SceneUniforms)))
+		return 0;
+
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(SceneUniforms), scene);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	uploaded = *scene;
+	++uploads;
+	return 1;
+}
+
+int sceneUniformUploads()
+{
+	return uploads;
+}
+
+void freeSceneUniforms()
+{
+	if (buffer)
+		glDeleteBuffers(1, &buffer);
+	buffer = 0;
+	uploads = 0;
+}
+
+/* m = m * b, both column major */
+static void multiply(float* m, const float* b)
+{
+	float a[16];
+	int i, j, k;
+
+	memcpy(a, m, sizeof(a));
+	for (i = 0; i < 4; ++i)
+	{
+		for (j = 0; j < 4; ++j)
+		{
+			m[i * 4 + j] = 0.0f;
+			for (k = 0; k < 4; ++k)
+				m[i * 4 + j] += a[k * 4 + j] * b[i * 4 + k];
+		}
+	}
+}
+
+void loadIdentity(float* m)
+{
+	memset(m, 0, sizeof(float) * 16);
+	m[0] = m[5] = m[10] = m[15] = 1.0f;
+}
+
+void translate(float* m, float x, float y, float z)
+{
+	float t[16];
+	loadIdentity(t);
+	t[12] = x;
+	t[13] = y;
+	t[14] = z;
+	multiply(m, t);
+}
+
+void rotate(float* m, float degrees, float x, float y, float z)
+{
+	float r[16], axis[3] = {x, y, z};
+	float c = cosf(degrees * (float)M_PI / 180.0f);
+	float s = sinf(degrees * (float)M_PI / 180.0f);
+
+	normalize3(axis);
+	x = axis[0];
+	y = axis[1];
+	z = axis[2];
+	loadIdentity(r);
+	r[0] = x * x * (1 - c) + c;
+	r[1] = y * x * (1 - c) + z * s;
+	r[2] = x * z * (1 - c) - y * s;
+	r[4] = x * y * (1 - c) - z * s;
+	r[5] = y * y * (1 - c) + c;
+	r[6] = y * z * (1 - c) + x * s;
+	r[8] = x * z * (1 - c) + y * s;
+	r[9] = y * z * (1 - c) - x * s;
+	r[10] = z * z * (1 - c) + c;
+	multiply(m, r);
+}
+
+void perspective(float* m, float fovy, float aspect, float zNear, float zFar)
+{
+	float p[16];
+	float f = 1.0f / tanf(fovy * (float)M_PI / 360.0f);
+
+	memset(p, 0, sizeof(p));
+	p[0] = f / aspect;
+	p[5] = f;
+	p[10] = (zFar + zNear) / (zNear - zFar);
+	p[11] = -1.0f;
+	p[14] = 2.0f * zFar * zNear / (zNear - zFar);
+	multiply(m, p);
+}
@@ -0,0 +1,77 @@
+/* scene-uniforms.h */
+
+#ifndef SCENE_UNIFORMS_H
+#define SCENE_UNIFORMS_H
+
+/* Lights in the Scene block, MAX_LIGHTS in the shaders must match */
+#define MAX_LIGHTS 4
+
+/* Diffuse colours instances choose from, MAX_MATERIALS in the shaders must
+ * match */
+#define MAX_MATERIALS 4
+
+/* Uniform buffer binding point of the Scene block */
+#define SCENE_BINDING 0
+
+typedef struct {
+	float position[4]; /* eye space */
+	float halfVector[4]; /* filled in by updateSceneUniforms() */
+	float ambient[4];
+	float diffuse[4];
+	float specular[4];
+} SceneLight;
+
+/* The shaders' Scene uniform block, laid out as std140 would. Matrices are
+ * column major like OpenGL's. Shared by every program through one uniform
+ * buffer, which is only written when something in here changes.
+
+USAGE:
+bindSceneUniforms(program); once per program
+fill in a SceneUniforms; updateSceneUniforms(&scene); each frame
+*/
+typedef struct {
+	float modelView[16];
+	float projection[16];
+	float normalMatrix[16]; /* filled in by updateSceneUniforms() */
+	float sceneAmbient[4];
+	float materialAmbient[4];
+	float materialDiffuse[4];
+	float materialSpecular[4];
+	float materialShininess;
+	int numLights;
+	float time;
+	float uvScale;
+	int gridSize[2];
+	int pad[2]; /* lights start on a 16 byte boundary */
+	SceneLight lights[MAX_LIGHTS];
+	float clusterParams[4]; /* see updateClusteredLights() */
+	int clusterCount[4];
+	float materials[MAX_MATERIALS][4]; /* by Instance material */
+} SceneUniforms;
+
+/* GL 3.1 or ARB_uniform_buffer_object */
+int sceneUniformsSupported();
+
+/* Points the program's Scene block, if it has one, at the buffer */
+void bindSceneUniforms(GLuint program);
+
+/* Uploads scene unless it is what was last uploaded. Returns 1 if it was
+ * written. */
+int updateSceneUniforms(SceneUniforms* scene);
+
+/* Number of times the buffer has been written */
+int sceneUniformUploads();
+
+void freeSceneUniforms();
+
+/* Matrix helpers, each multiplying m on the right like the fixed function
+ * calls they are named after */
+void loadIdentity(float* m);
+void translate(float* m, float x, float y, float z);
+void rotate(float* m, float degrees, float x, float y, float z);
+void perspective(float* m, float fovy, float aspect, float zNear, float zFar);
+
+/* n = the inverse transpose of m's upper 3x3, as gl_NormalMatrix */
+void normalMatrix(float* n, const float* m);
+
+#endif
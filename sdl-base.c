@@ -6,11 +6,49 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#ifdef HEADLESS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+/* Drawing on a thread of its own needs the GL context handed over to it,
+ * which SDL 1.2 has no call for; on X11 it's GLX's */
+#if !defined(HEADLESS) && defined(__unix__) && !defined(__APPLE__)
+#define RENDER_THREAD
+#include <GL/glx.h>
+#include <X11/Xlib.h>
+#include <pthread.h>
+#include <semaphore.h>
+#endif
+
+#include "bench.h"
+#include "frame-pacer.h"
+#include "profiler.h"
+#include "timer.h"
+#include "triple-buffer.h"
 
 #define DEFAULT_WIDTH 800
 #define DEFAULT_HEIGHT 600
 #define DEFAULT_DEPTH 32
 #define DEFAULT_FLAGS (SDL_OPENGL | SDL_RESIZABLE)
+#define DEFAULT_FRAME_MS (1000.0 / 60.0)
+
+/* Simulated time step given to update() while benchmarking, so every run
+ * animates identically regardless of how fast the frames are */
+#define BENCH_UPDATE_MS 16
+
+/* update() always advances by this much, display() shows the state
+ * interpolated between the last two steps */
+#define UPDATE_STEP_MS 10
+/* Steps run per frame at most. After a longer stall (a breakpoint, the
+ * window being dragged) the simulation drops the time instead of running
+ * ever more steps to catch up. */
+#define MAX_UPDATE_STEPS 25
+
+/* Inputs the latency median and the report at exit are over */
+#define LATENCY_SAMPLES 256
 
 static SDL_Surface *screen;
 static int videoFlags;
@@ -22,31 +60,527 @@ static int quit_flag;
 int frame_rate;
 const Uint32 frame_rate_update_interval = 1000;
 
+/* What the main thread hands the renderer each frame, followed by the
+ * application's snapshot() */
+typedef struct {
+	int input; /* numbers the oldest input not shown yet, or the last shown */
+	double input_time; /* getTime() when the main loop read it */
+} FrameHeader;
+
+static TripleBuffer frames;
+
+/* Input to present latency. Inputs are numbered, only the oldest not shown
+ * yet is timed: later ones go out in the same frame. */
+static int input_count; /* main thread */
+static double input_time;
+static int input_shown; /* written by whichever thread draws */
+static float latency_samples[LATENCY_SAMPLES];
+static int latency_count;
+float input_latency;
+
+#ifdef RENDER_THREAD
+static pthread_t render_thread;
+static sem_t frame_ready; /* posted for each frame published */
+static sem_t frame_taken; /* posted for each frame the render thread reads */
+static int render_stop;
+static long render_us; /* the last frame's time on the render thread, for the pacer */
+static Display *gl_display;
+static GLXDrawable gl_drawable;
+static GLXContext gl_context;
+#endif
+
+struct options options = {
+	0,               /* bench */
+	10,              /* bench_warmup */
+	100,             /* bench_frames */
+	"bench.csv",     /* bench_csv */
+	"bench.json",    /* bench_json */
+	NULL,            /* simd */
+	0,               /* threads */
+	256,             /* cache_mb */
+	NULL,            /* vertex_format */
+	NULL,            /* index_order */
+	NULL,            /* shader_grid */
+	0,               /* uber_shader */
+	1,               /* lights */
+	NULL,            /* trace */
+	NULL,            /* gl_debug */
+	-1.0,            /* frame_ms */
+	1,               /* adaptive_pacing */
+	0,               /* vsync */
+	1,               /* render_thread */
+};
+
 void quit()
 {
 	quit_flag = 1;
 }
 
+static void usage(const char *prog)
+{
+	printf("Usage: %s [--bench] [--bench-warmup N] [--bench-frames N]\n"
+		"       [--bench-csv FILE] [--bench-json FILE] [--simd scalar|sse2|avx2]\n"
+		"       [--threads N] [--cache-mb N] [--vertex-format float|compact]\n"
+		"       [--index-order strips|tiled|optimized]\n"
+		"       [--shader-grid vbo|vertexid] [--uber-shader] [--lights N]\n"
+		"       [--trace FILE] [--gl-debug callback|sync|poll]\n"
+		"       [--frame-ms MS] [--pacing adaptive|fixed] [--vsync]\n"
+		"       [--render-thread on|off]\n", prog);
+}
+
+static int parse_options(int argc, char **argv)
+{
+	int i;
+	for (i = 1; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "--bench"))
+			options.bench = 1;
+		else if (!strcmp(argv[i], "--bench-warmup") && i + 1 < argc)
+			options.bench_warmup = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--bench-frames") && i + 1 < argc)
+			options.bench_frames = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--bench-csv") && i + 1 < argc)
+			options.bench_csv = argv[++i];
+		else if (!strcmp(argv[i], "--bench-json") && i + 1 < argc)
+			options.bench_json = argv[++i];
+		else if (!strcmp(argv[i], "--simd") && i + 1 < argc)
+			options.simd = argv[++i];
+		else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+			options.threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--cache-mb") && i + 1 < argc)
+			options.cache_mb = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--vertex-format") && i + 1 < argc)
+			options.vertex_format = argv[++i];
+		else if (!strcmp(argv[i], "--index-order") && i + 1 < argc)
+			options.index_order = argv[++i];
+		else if (!strcmp(argv[i], "--shader-grid") && i + 1 < argc)
+			options.shader_grid = argv[++i];
+		else if (!strcmp(argv[i], "--uber-shader"))
+			options.uber_shader = 1;
+		else if (!strcmp(argv[i], "--lights") && i + 1 < argc)
+			options.lights = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--trace") && i + 1 < argc)
+			options.trace = argv[++i];
+		else if (!strcmp(argv[i], "--gl-debug") && i + 1 < argc)
+			options.gl_debug = argv[++i];
+		else if (!strcmp(argv[i], "--frame-ms") && i + 1 < argc)
+			options.frame_ms = atof(argv[++i]);
+		else if (!strcmp(argv[i], "--pacing") && i + 1 < argc)
+			options.adaptive_pacing = strcmp(argv[++i], "fixed") != 0;
+		else if (!strcmp(argv[i], "--vsync"))
+			options.vsync = 1;
+		else if (!strcmp(argv[i], "--render-thread") && i + 1 < argc)
+			options.render_thread = strcmp(argv[++i], "off") != 0;
+		else
+		{
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (options.bench_frames < 1)
+		options.bench_frames = 1;
+	return 0;
+}
+
+#ifdef HEADLESS
+/* Render into an offscreen EGL pbuffer instead of an SDL window. With Mesa
+ * this needs neither a display nor a GPU (llvmpipe), which is what CI has. */
+static EGLDisplay egl_display;
+static EGLSurface egl_surface;
+static EGLContext egl_context;
+static EGLConfig egl_config;
+static SDL_Surface headless_screen;
+
+static SDL_Surface *create_headless_context(int width, int height)
+{
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay;
+	EGLint major, minor, numConfigs;
+	const EGLint configAttribs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+		EGL_DEPTH_SIZE, 24,
+		EGL_NONE};
+	const EGLint surfaceAttribs[] = {EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE};
+#ifndef NDEBUG
+	const EGLint debugAttribs[] = {EGL_CONTEXT_FLAGS_KHR, EGL_CONTEXT_OPENGL_DEBUG_BIT_KHR, EGL_NONE};
+#endif
+
+	getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (getPlatformDisplay)
+		egl_display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	else
+		egl_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if (!eglInitialize(egl_display, &major, &minor) ||
+		!eglBindAPI(EGL_OPENGL_API) ||
+		!eglChooseConfig(egl_display, configAttribs, &egl_config, 1, &numConfigs) ||
+		numConfigs < 1)
+		return NULL;
+
+	egl_surface = eglCreatePbufferSurface(egl_display, egl_config, surfaceAttribs);
+#ifdef NDEBUG
+	egl_context = eglCreateContext(egl_display, egl_config, EGL_NO_CONTEXT, NULL);
+#else
+	/* A debug context, for init() to turn debug output on in; some drivers
+	 * only send it there. Needs EGL 1.5 or EGL_KHR_create_context. */
+	egl_context = eglCreateContext(egl_display, egl_config, EGL_NO_CONTEXT, debugAttribs);
+	if (egl_context == EGL_NO_CONTEXT)
+		egl_context = eglCreateContext(egl_display, egl_config, EGL_NO_CONTEXT, NULL);
+#endif
+	if (egl_surface == EGL_NO_SURFACE || egl_context == EGL_NO_CONTEXT ||
+		!eglMakeCurrent(egl_display, egl_surface, egl_surface, egl_context))
+		return NULL;
+	eglSwapInterval(egl_display, options.vsync); /* pbuffers may ignore it */
+
+	headless_screen.w = width;
+	headless_screen.h = height;
+	return &headless_screen;
+}
+
+/* A new pbuffer at the new size, keeping the old one if that fails */
+static SDL_Surface *resize_headless_context(int width, int height)
+{
+	const EGLint surfaceAttribs[] = {EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE};
+	EGLSurface surface;
+
+	surface = eglCreatePbufferSurface(egl_display, egl_config, surfaceAttribs);
+	if (surface == EGL_NO_SURFACE)
+		return &headless_screen;
+	if (!eglMakeCurrent(egl_display, surface, surface, egl_context))
+	{
+		eglDestroySurface(egl_display, surface);
+		return &headless_screen;
+	}
+	eglDestroySurface(egl_display, egl_surface);
+	egl_surface = surface;
+	headless_screen.w = width;
+	headless_screen.h = height;
+	return &headless_screen;
+}
+
+static void destroy_headless_context()
+{
+	eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglDestroyContext(egl_display, egl_context);
+	eglDestroySurface(egl_display, egl_surface);
+	eglTerminate(egl_display);
+}
+#endif
+
+void resize_window(int w, int h)
+{
+#ifdef HEADLESS
+	screen = resize_headless_context(w, h);
+#else
+	screen = SDL_SetVideoMode(w, h, DEFAULT_DEPTH, videoFlags);
+#endif
+	reshape(screen->w, screen->h);
+}
+
+static void swap_buffers()
+{
+	PROFILE_BEGIN("swap");
+#ifdef HEADLESS
+	eglSwapBuffers(egl_display, egl_surface);
+#else
+	SDL_GL_SwapBuffers();
+#endif
+	PROFILE_END();
+}
+
+/* Counts frames drawn into frame_rate once a second */
+static void count_frame()
+{
+	Uint32 ticks = SDL_GetTicks();
+
+	frame_count++;
+	if (ticks - frame_time > frame_rate_update_interval)
+	{
+		frame_rate = (frame_count * frame_rate_update_interval) / (ticks - frame_time);
+		frame_count = 0;
+		frame_time = ticks;
+	}
+}
+
+static int compare_float(const void *a, const void *b)
+{
+	const float x = *(const float *)a, y = *(const float *)b;
+	return (x > y) - (x < y);
+}
+
+/* The latest latency samples, sorted, returns how many */
+static int sorted_latencies(float *sorted)
+{
+	const int n = latency_count < LATENCY_SAMPLES ? latency_count : LATENCY_SAMPLES;
+
+	memcpy(sorted, latency_samples, n * sizeof(float));
+	qsort(sorted, n, sizeof(float), compare_float);
+	return n;
+}
+
+static void record_latency(float ms)
+{
+	float sorted[LATENCY_SAMPLES];
+	int n;
+
+	latency_samples[latency_count++ % LATENCY_SAMPLES] = ms;
+	n = sorted_latencies(sorted);
+	input_latency = sorted[n / 2];
+}
+
+static void report_latency()
+{
+	float sorted[LATENCY_SAMPLES];
+	const int n = sorted_latencies(sorted);
+
+	if (n)
+		printf("Input to present, last %d of %d inputs: median %.1f ms, 95th percentile %.1f ms, max %.1f ms\n",
+				n, latency_count, sorted[n / 2], sorted[(n - 1) * 95 / 100], sorted[n - 1]);
+}
+
+/* Called for key and mouse events, times the oldest not shown yet */
+static void stamp_input()
+{
+	if (input_count == __atomic_load_n(&input_shown, __ATOMIC_ACQUIRE))
+	{
+		++input_count;
+		input_time = getTime();
+	}
+}
+
+/* One frame's update() steps and interpolate(), then a snapshot() of the
+ * result, with the input it shows, into frame. Not profiled, the profiler
+ * is the render thread's when there is one. */
+static void simulate(int steps, int milliseconds, float alpha, void *frame)
+{
+	FrameHeader *header = (FrameHeader *)frame;
+	int i;
+
+	for (i = 0; i < steps; ++i)
+		update(milliseconds);
+	interpolate(alpha);
+	header->input = input_count;
+	header->input_time = input_time;
+	snapshot(header + 1);
+}
+
+/* apply_snapshot() and display() a frame, profiled */
+static void show_frame(const void *frame)
+{
+	PROFILE_BEGIN("apply");
+	apply_snapshot((const FrameHeader *)frame + 1);
+	PROFILE_END();
+	PROFILE_BEGIN("display");
+	display(screen);
+	PROFILE_END();
+}
+
+/* Shows a frame and swaps, on whichever thread has the context. The
+ * latency is to the swap returning: the display scans it out up to a
+ * refresh later, or a few with the driver queueing frames. */
+static void render_frame(const void *frame)
+{
+	const FrameHeader *header = (const FrameHeader *)frame;
+
+	show_frame(frame);
+	swap_buffers();
+	if (header->input != input_shown)
+	{
+		record_latency((getTime() - header->input_time) * 1000.0);
+		__atomic_store_n(&input_shown, header->input, __ATOMIC_RELEASE);
+	}
+	count_frame();
+}
+
+#ifdef RENDER_THREAD
+/* The context is current on one thread at a time. The main thread lets go
+ * of it before starting the render thread, which takes it until stopped. */
+static void release_context()
+{
+	gl_display = glXGetCurrentDisplay();
+	gl_drawable = glXGetCurrentDrawable();
+	gl_context = glXGetCurrentContext();
+	glXMakeCurrent(gl_display, None, NULL);
+}
+
+static void acquire_context()
+{
+	glXMakeCurrent(gl_display, gl_drawable, gl_context);
+}
+
+static void *render_main(void *arg)
+{
+	void *frame;
+	double start;
+	int fresh;
+
+	(void)arg;
+	acquire_context();
+	for (;;)
+	{
+		sem_wait(&frame_ready);
+		if (__atomic_load_n(&render_stop, __ATOMIC_ACQUIRE))
+			break;
+		/* The first post after a few publishes finds the latest, the rest
+		 * nothing new */
+		frame = readTripleBuffer(&frames, &fresh);
+		if (!fresh)
+			continue;
+		sem_post(&frame_taken);
+
+		start = getTime();
+		profileBeginFrame();
+		render_frame(frame);
+		profileEndFrame();
+		__atomic_store_n(&render_us, (long)((getTime() - start) * 1e6), __ATOMIC_RELAXED);
+	}
+	glXMakeCurrent(gl_display, None, NULL);
+	return NULL;
+}
+
+/* Returns 0 if there's no thread, leaving the context on this one */
+static int start_render_thread()
+{
+	render_stop = 0;
+	release_context();
+	if (pthread_create(&render_thread, NULL, render_main, NULL))
+	{
+		acquire_context();
+		return 0;
+	}
+	return 1;
+}
+
+/* Waits for the frame being drawn and takes the context back */
+static void stop_render_thread()
+{
+	__atomic_store_n(&render_stop, 1, __ATOMIC_RELEASE);
+	sem_post(&frame_ready);
+	pthread_join(render_thread, NULL);
+	acquire_context();
+}
+#endif
+
+/* Render every bench_step() state for a fixed number of frames, recording
+ * per-frame CPU and GPU times. It all runs on the main thread, so a frame's
+ * CPU time is all of its work. */
+static void run_bench()
+{
+	char label[64];
+	int step, frame;
+
+	benchInit();
+	for (step = 0; !quit_flag && bench_step(step, label, sizeof label); ++step)
+	{
+		for (frame = 0; frame < options.bench_warmup; ++frame)
+		{
+			profileBeginFrame();
+			PROFILE_BEGIN("update");
+			simulate(1, BENCH_UPDATE_MS, 1.0f, tripleBufferBack(&frames));
+			PROFILE_END();
+			show_frame(tripleBufferBack(&frames));
+			swap_buffers();
+			profileEndFrame();
+		}
+
+		benchBeginState(label);
+		for (frame = 0; frame < options.bench_frames; ++frame)
+		{
+			profileBeginFrame();
+			benchBeginFrame();
+			PROFILE_BEGIN("update");
+			simulate(1, BENCH_UPDATE_MS, 1.0f, tripleBufferBack(&frames));
+			PROFILE_END();
+			show_frame(tripleBufferBack(&frames));
+			benchEndGPU();
+			swap_buffers();
+			benchEndFrame();
+			profileEndFrame();
+		}
+		benchEndState();
+	}
+	benchWrite(options.bench_csv, options.bench_json);
+	benchCleanup();
+}
+
 int main(int argc, char **argv)
 {
 	SDL_Event ev;
-	Uint32 now, last_frame_time;
+	FramePacer pacer;
+	double now, last_frame_time, lag;
+	void *frame;
+	int steps;
+	int threaded = 0;
+
+	if (parse_options(argc, argv))
+		return EXIT_FAILURE;
 
 	quit_flag = 0;
 	videoFlags = DEFAULT_FLAGS;
+#ifdef HEADLESS
+	SDL_Init(SDL_INIT_TIMER);
+	screen = create_headless_context(DEFAULT_WIDTH, DEFAULT_HEIGHT);
+	if (!screen)
+	{
+		printf("Error creating headless EGL context\n");
+		return EXIT_FAILURE;
+	}
+	options.bench = 1; /* nothing else to do without a window */
+#else
+#ifdef RENDER_THREAD
+	/* Xlib is called from both threads, SDL's events and the swap */
+	if (options.render_thread && !options.bench)
+		XInitThreads();
+#endif
 	SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER);
 	SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
-	screen = SDL_SetVideoMode(DEFAULT_WIDTH, DEFAULT_HEIGHT, 
+	SDL_GL_SetAttribute(SDL_GL_SWAP_CONTROL, options.vsync);
+	screen = SDL_SetVideoMode(DEFAULT_WIDTH, DEFAULT_HEIGHT,
 							  DEFAULT_DEPTH, videoFlags);
+#endif
 
 	init();
 	reshape(screen->w, screen->h);
+	if (initTripleBuffer(&frames, sizeof(FrameHeader) + snapshot_size))
+	{
+		printf("Error allocating frames\n");
+		return EXIT_FAILURE;
+	}
+	if (options.trace)
+	{
+#ifdef NDEBUG
+		printf("--trace: the profiler is compiled out of release builds\n");
+#endif
+		startProfileTrace();
+	}
+
+	if (options.bench)
+		run_bench();
+
+	/* With vsync the swap paces frames, unless given a budget as well */
+	if (options.frame_ms < 0.0)
+		options.frame_ms = options.vsync ? 0.0 : DEFAULT_FRAME_MS;
+	initFramePacer(&pacer, options.frame_ms / 1000.0, options.adaptive_pacing);
 
 	frame_rate = 0;
 	frame_count = 0;
-	last_frame_time = frame_time = SDL_GetTicks();
-	while (!quit_flag) 
+	frame_time = SDL_GetTicks();
+	last_frame_time = getTime();
+	lag = 0.0;
+#ifdef RENDER_THREAD
+	if (options.render_thread && !options.bench)
 	{
+		sem_init(&frame_ready, 0, 0);
+		sem_init(&frame_taken, 0, 0);
+		threaded = start_render_thread();
+	}
+#endif
+	while (!quit_flag && !options.bench)
+	{
+		/* Without a render thread the events are part of the frame */
+		if (!threaded)
+			profileBeginFrame();
+
 		/* Process all pending events */
 		while (SDL_PollEvent(&ev))
 		{
@@ -56,37 +590,96 @@ int main(int argc, char **argv)
 				quit();
 				break;
 			case SDL_VIDEORESIZE:
-				screen = SDL_SetVideoMode(ev.resize.w, 
-										  ev.resize.h,
-										  DEFAULT_DEPTH, videoFlags);
-				reshape(screen->w, screen->h);
+#ifdef RENDER_THREAD
+				/* SDL resizes on the main thread, with the context */
+				if (threaded)
+				{
+					stop_render_thread();
+					resize_window(ev.resize.w, ev.resize.h);
+					threaded = start_render_thread();
+					break;
+				}
+#endif
+				resize_window(ev.resize.w, ev.resize.h);
+				break;
+			case SDL_KEYDOWN:
+			case SDL_MOUSEBUTTONDOWN:
+			case SDL_MOUSEMOTION:
+				stamp_input();
+				event(&ev);
 				break;
 			default:
 				event(&ev);
 				break;
 			}
 		}
-		/* Calculate time passed */
-		now = SDL_GetTicks();
-		update(now - last_frame_time);
+		/* Whole update steps for the time passed, the rest carried over */
+		now = getTime();
+		lag += now - last_frame_time;
 		last_frame_time = now;
+		for (steps = 0; lag >= UPDATE_STEP_MS / 1000.0 && steps < MAX_UPDATE_STEPS; ++steps)
+			lag -= UPDATE_STEP_MS / 1000.0;
+		if (steps == MAX_UPDATE_STEPS)
+			lag = 0.0;
 
-		/* Refresh display and flip buffers */
-		display(screen);
-		SDL_GL_SwapBuffers();
+		frame = tripleBufferBack(&frames);
+		if (!threaded)
+		{
+			PROFILE_BEGIN("update");
+			simulate(steps, UPDATE_STEP_MS, lag / (UPDATE_STEP_MS / 1000.0), frame);
+			PROFILE_END();
 
-		/* Update frame_rate */
-		frame_count++;
-		if (now - frame_time > frame_rate_update_interval)
+			/* Refresh display and flip buffers */
+			render_frame(frame);
+			profileEndFrame();
+		}
+#ifdef RENDER_THREAD
+		else
 		{
-			frame_rate = (frame_count * frame_rate_update_interval) / (now - frame_time);
-			frame_count = 0;
-			frame_time = now;
+			/* Hand it over and start on the next. Without a budget to pace
+			 * to, wait for the render thread to take each one instead. */
+			simulate(steps, UPDATE_STEP_MS, lag / (UPDATE_STEP_MS / 1000.0), frame);
+			publishTripleBuffer(&frames);
+			sem_post(&frame_ready);
+			if (pacer.budget <= 0.0)
+				sem_wait(&frame_taken);
 		}
+#endif
+
+		/* Wait out the rest of the frame's budget, which has to cover the
+		 * render thread's frame too */
+#ifdef RENDER_THREAD
+		if (threaded)
+			pacer.otherCost = __atomic_load_n(&render_us, __ATOMIC_RELAXED) / 1e6;
+#endif
+		paceFrame(&pacer);
+	}
+#ifdef RENDER_THREAD
+	if (threaded)
+		stop_render_thread();
+	if (options.render_thread && !options.bench)
+	{
+		sem_destroy(&frame_ready);
+		sem_destroy(&frame_taken);
 	}
+#endif
+	if (!options.bench)
+		report_latency();
 
+	if (options.trace)
+	{
+		if (writeProfileTrace(options.trace))
+			printf("Error writing %s\n", options.trace);
+		else
+			printf("Wrote %s\n", options.trace);
+	}
+	freeProfiler();
+	freeTripleBuffer(&frames);
 	cleanup();
+#ifdef HEADLESS
+	destroy_headless_context();
+#endif
 	SDL_Quit();
-	
+
 	return EXIT_SUCCESS;
 }
@@ -1,20 +1,71 @@
 #include <SDL/SDL.h>
+#include <stddef.h>
 
 #define GL_GLEXT_PROTOTYPES
 #include <GL/gl.h>
 
-/* Implement these yourself */
+/* Implement these yourself. update() advances the simulation by a fixed
+ * step, any number of times a frame. interpolate() is called once a frame,
+ * to show the state alpha (0 to 1) of the way from before the last step to
+ * after it.
+ *
+ * event(), update(), interpolate() and snapshot() run on the main thread,
+ * and on most platforms the rest run on a render thread that has the GL
+ * context, so the first three mustn't call GL. snapshot() copies what
+ * display() needs into a frame of snapshot_size bytes; the render thread
+ * gets the latest frame, apply_snapshot() makes it the state to draw and
+ * does any GL work the changes need, then display() draws it. */
 void init();
 void reshape(int w, int h);
 void update(int milliseconds);
+void interpolate(float alpha);
+void snapshot(void *frame);
+void apply_snapshot(const void *frame);
 void display(SDL_Surface *screen);
 void event(SDL_Event *event);
 void cleanup();
+extern const size_t snapshot_size;
+
+/* Benchmark script, only used with --bench. Set up render state number
+ * `step`, write a short description of it into `label` and return 1, or
+ * return 0 once there are no more steps. */
+int bench_step(int step, char *label, int size);
 
 /* This is updated every second by the main loop -- no need to calculate it
  * yourself.*/
 extern int frame_rate;
 
+/* Median milliseconds from the main loop reading recent key and mouse
+ * input to the swap of the first frame showing it */
+extern float input_latency;
+
+/* Command line options, parsed by the main loop before init() is called. */
+struct options {
+	int bench;              /* --bench: run bench_step() states and quit */
+	int bench_warmup;       /* --bench-warmup N: unmeasured frames per state */
+	int bench_frames;       /* --bench-frames N: measured frames per state */
+	const char *bench_csv;  /* --bench-csv FILE: per-frame times */
+	const char *bench_json; /* --bench-json FILE: per-state percentiles */
+	const char *simd;       /* --simd scalar|sse2|avx2: mesh generation kernels */
+	int threads;            /* --threads N: mesh generation threads, 0 = per CPU */
+	int cache_mb;           /* --cache-mb N: geometry cache budget */
+	const char *vertex_format; /* --vertex-format float|compact: VBO layouts */
+	const char *index_order;   /* --index-order strips|tiled|optimized: mesh triangles */
+	const char *shader_grid;   /* --shader-grid vbo|vertexid: shaders' grid source */
+	int uber_shader;        /* --uber-shader: branch on uniforms, no permutations */
+	int lights;             /* --lights N: 1 to 4 lights */
+	const char *trace;      /* --trace FILE: Chrome trace of the profiler's scopes */
+	const char *gl_debug;   /* --gl-debug callback|sync|poll: how debug builds see GL errors */
+	double frame_ms;        /* --frame-ms MS: frame-time budget, 0 = none, < 0 = default */
+	int adaptive_pacing;    /* --pacing adaptive|fixed: slower multiples when over budget */
+	int vsync;              /* --vsync: wait for the display in the swap */
+	int render_thread;      /* --render-thread on|off: draw on a thread of its own */
+};
+extern struct options options;
+
 /* Call this to quit. */
 void quit();
 
+/* Call this to change the window (or offscreen surface) size. reshape() is
+ * called with the size it ends up. */
+void resize_window(int w, int h);
@@ -1,5 +1,78 @@
 // shader.frag
 
+#ifdef UNIFORM_BUFFER
+#extension GL_ARB_uniform_buffer_object : enable
+#endif
+
+#ifdef UNIFORM_BUFFER
+#define MAX_LIGHTS 4 /* as in scene-uniforms.h */
+#define MAX_MATERIALS 4
+
+struct Light {
+	vec4 position; /* eye space */
+	vec4 halfVector;
+	vec4 ambient;
+	vec4 diffuse;
+	vec4 specular;
+};
+
+/* Camera, lights and material, shared by every program. Must match
+ * SceneUniforms in scene-uniforms.h and the block in mesh-generation.vert. */
+layout(std140) uniform Scene {
+	mat4 modelView;
+	mat4 projection;
+	mat4 normalMatrix;
+	vec4 sceneAmbient;
+	vec4 materialAmbient;
+	vec4 materialDiffuse;
+	vec4 materialSpecular;
+	float materialShininess;
+	int numLights;
+	float time;
+	float uvScale;
+	ivec2 gridSize;
+	Light lights[MAX_LIGHTS];
+	vec4 clusterParams; /* tile width and height in pixels, slice scale and bias */
+	ivec4 clusterCount; /* tiles across and down, slices, point lights */
+	vec4 materials[MAX_MATERIALS]; /* diffuse colours for instances */
+};
+#define modelViewProjection (projection * modelView)
+
+#ifdef INSTANCED
+/* The instance's material, see mesh-generation.vert */
+varying vec4 instanceDiffuse;
+#define materialDiffuse instanceDiffuse
+#endif
+
+#ifdef DEFERRED_LIGHTING
+/* The material comes from the G-buffer instead, read in main() */
+vec4 gbufferDiffuse;
+float gbufferShininess;
+#define materialDiffuse gbufferDiffuse
+#define materialShininess gbufferShininess
+#endif
+#else
+/* The fixed function state, which has one light */
+#define numLights 1
+#define lights gl_LightSource
+#define sceneAmbient gl_LightModel.ambient
+#define materialAmbient gl_FrontMaterial.ambient
+#define materialDiffuse gl_FrontMaterial.diffuse
+#define materialSpecular gl_FrontMaterial.specular
+#define materialShininess gl_FrontMaterial.shininess
+#define modelView gl_ModelViewMatrix
+#define normalMatrix gl_NormalMatrix
+#define modelViewProjection gl_ModelViewProjectionMatrix
+#endif
+
+#ifdef PERMUTATION
+/* Specialised for one state, the branches below fold away */
+const int lightingModel = LIGHTING_MODEL;
+const bool isPerPixelLighting = PER_PIXEL;
+#ifdef DEFERRED_LIGHTING
+const bool isLocalViewer = LOCAL_VIEWER;
+#endif
+#else
 /* lighting model:
  *  0 = phong
  *  1 = blinn-phong
@@ -7,32 +80,55 @@
 uniform int lightingModel;
 
 uniform bool isPerPixelLighting;
-
-
+#endif
+
+#ifdef DEFERRED_LIGHTING
+/* Written by the GBUFFER pass, see gbuffer.h */
+uniform sampler2D gbufferNormal; /* eye space normal, shininess */
+uniform sampler2D gbufferMaterial; /* diffuse colour */
+uniform sampler2D gbufferDepth;
+#else
 varying vec3 eye;
 varying vec3 normal;
-
-void main (void)
+#endif
+
+#ifdef CLUSTERED
+/* Point lights binned into view space clusters, see clustered-lights.h */
+uniform usamplerBuffer clusterGrid; /* offset and count into clusterLights */
+uniform usamplerBuffer clusterLights; /* indices into pointLights */
+uniform samplerBuffer pointLights; /* eye space position and radius, colour */
+
+#ifdef DEFERRED_LIGHTING
+vec3 position; /* from the depth buffer */
+#else
+varying vec3 position;
+#endif
+#endif
+
+/* Phong or Blinn-Phong, summed over the lights */
+vec4 shade(vec3 normal, vec3 eye)
 {
-	if (isPerPixelLighting) {
-		const int Phong = 0;
-		const int BlinnPhong = 1;
+	const int Phong = 0;
+	const int BlinnPhong = 1;
+
+	// add global ambient
+	vec4 color = materialAmbient * sceneAmbient;
 
-		vec4 color = vec4(0.0);
+	for (int i = 0; i < numLights; ++i) {
 
+		// unit vector in direction of light, light source position/direction
 		// already transformed into eye space coordinates by modelview matrix
-		vec3 light = normalize(vec3(gl_LightSource[0].position));
+		vec3 light = normalize(vec3(lights[i].position));
 
 		// compute diffuse scalar
 		float NdotL = max(dot(normal, light), 0.0);
 
-		// add global and light ambient
-		color += gl_FrontMaterial.ambient * (gl_LightModel.ambient + gl_LightSource[0].ambient);
+		// add light ambient
+		color += materialAmbient * lights[i].ambient;
 
-		if (NdotL > 0.0)
-		{
+		if (NdotL > 0.0) {
 			// add diffuse component
-			color += NdotL * gl_FrontMaterial.diffuse * gl_LightSource[0].diffuse;
+			color += NdotL * materialDiffuse * lights[i].diffuse;
 
 			// add specular color depending on light model
 			if (lightingModel == Phong) {
@@ -41,23 +137,112 @@ void main (void)
 				vec3 reflection = reflect(light, normal);
 				float RdotE = max(dot(reflection, eye), 0.0);
 
-				color += pow(RdotE, gl_FrontMaterial.shininess) *
-					gl_LightSource[0].specular * gl_FrontMaterial.specular;
+				color += pow(RdotE, materialShininess) *
+					lights[i].specular * materialSpecular;
 
 			} else /* lightingModel == BlinnPhong */ {
 
-				// add specular color
-				float NdotHV = max(dot(normal, gl_LightSource[0].halfVector.xyz), 0.0);
-
-				color += gl_FrontMaterial.specular * gl_LightSource[0].specular *
-					pow(NdotHV, gl_FrontMaterial.shininess);
+				float NdotHV = max(dot(normal, lights[i].halfVector.xyz), 0.0);
+				color += materialSpecular * lights[i].specular *
+					pow(NdotHV, materialShininess);
 
 			}
 		}
+	}
+	return color;
+}
 
-		gl_FragColor = color;
-
-	} else {
-		gl_FragColor = gl_Color;
+#ifdef CLUSTERED
+/* Diffuse and specular from the point lights in this fragment's cluster */
+vec4 shadePointLights(vec3 normal, vec3 eye)
+{
+	const int Phong = 0;
+	const int BlinnPhong = 1;
+
+	ivec3 cluster = ivec3(gl_FragCoord.xy / clusterParams.xy,
+		log(-position.z) * clusterParams.z + clusterParams.w);
+	cluster = clamp(cluster, ivec3(0), clusterCount.xyz - 1);
+	uvec2 range = texelFetch(clusterGrid,
+		(cluster.z * clusterCount.y + cluster.y) * clusterCount.x + cluster.x).xy;
+
+	vec4 color = vec4(0.0);
+	for (uint i = 0u; i < range.y; ++i) {
+		int index = int(texelFetch(clusterLights, int(range.x + i)).x);
+		vec4 light = texelFetch(pointLights, index * 2);
+		vec4 lightColor = texelFetch(pointLights, index * 2 + 1);
+
+		vec3 toLight = light.xyz - position;
+		float dist = length(toLight);
+		if (dist >= light.w)
+			continue;
+		toLight /= dist;
+
+		// falls off smoothly to nothing at the radius
+		float attenuation = 1.0 - dist / light.w;
+		attenuation *= attenuation;
+
+		float NdotL = dot(normal, toLight);
+		if (NdotL <= 0.0)
+			continue;
+
+		float specular;
+		if (lightingModel == Phong)
+			specular = pow(max(dot(reflect(toLight, normal), eye), 0.0), materialShininess);
+		else /* lightingModel == BlinnPhong */
+			specular = pow(max(dot(normal, normalize(toLight - eye)), 0.0), materialShininess);
+
+		color += attenuation * lightColor *
+			(NdotL * materialDiffuse + specular * materialSpecular);
 	}
+	return color;
+}
+#endif
+
+#ifdef DEFERRED_LIGHTING
+/* Shades the surface the geometry pass left in this pixel, if any */
+void main (void)
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	float depth = texelFetch(gbufferDepth, pixel, 0).x;
+	if (depth == 1.0)
+		discard;
+
+	vec4 normalShininess = texelFetch(gbufferNormal, pixel, 0);
+	gbufferDiffuse = texelFetch(gbufferMaterial, pixel, 0);
+	gbufferShininess = normalShininess.w;
+
+	// back from window coordinates to eye space, for a perspective projection
+	vec3 ndc = vec3(gl_FragCoord.xy / vec2(textureSize(gbufferDepth, 0)), depth) * 2.0 - 1.0;
+	float z = -projection[3][2] / (ndc.z + projection[2][2]);
+	vec3 eyePosition = vec3(-z * ndc.xy / vec2(projection[0][0], projection[1][1]), z);
+	vec3 eye = isLocalViewer ? normalize(eyePosition) : vec3(0.0, 0.0, -1.0);
+
+	vec4 color = shade(normalShininess.xyz, eye);
+#ifdef CLUSTERED
+	position = eyePosition;
+	color += shadePointLights(normalize(normalShininess.xyz), eye);
+#endif
+	gl_FragColor = color;
+	gl_FragDepth = depth; /* for anything drawn after */
+}
+#elif defined(GBUFFER)
+/* Just what the lighting pass needs, per pixel lighting only */
+void main (void)
+{
+	gl_FragData[0] = vec4(normal, materialShininess);
+	gl_FragData[1] = materialDiffuse;
+}
+#else
+void main (void)
+{
+	vec4 color;
+	if (isPerPixelLighting)
+		color = shade(normal, eye);
+	else
+		color = gl_Color;
+#ifdef CLUSTERED
+	color += shadePointLights(normalize(normal), eye);
+#endif
+	gl_FragColor = color;
 }
+#endif
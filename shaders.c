@@ -9,10 +9,80 @@
 #ifdef _WIN32
 #pragma warning(disable:4996)
 #include <windows.h>
+#include <direct.h>
+#define mkdir(path, mode) _mkdir(path)
+#else
+#include <sys/stat.h>
+#endif
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
 #endif
 
 #include "shaders.h"
 
+/* First line of a program binary cache file, bump if the layout changes */
+#define SHADER_CACHE_MAGIC "glprogram 1"
+
+/* Directories watched for shader edits */
+#define MAX_WATCHED_DIRS 16
+
+/* The shader stages a program can have, in pipeline order */
+enum { STAGE_VERTEX, STAGE_TESS_CONTROL, STAGE_TESS_EVALUATION, STAGE_FRAGMENT, STAGE_COMPUTE, NUM_STAGES };
+
+static const GLenum stageTypes[NUM_STAGES] = {GL_VERTEX_SHADER, GL_TESS_CONTROL_SHADER,
+	GL_TESS_EVALUATION_SHADER, GL_FRAGMENT_SHADER, GL_COMPUTE_SHADER};
+
+/* Defined after the header, so one file can be built as more than one stage */
+static const char* stageDefines[NUM_STAGES] = {"#define VERTEX_SHADER\n",
+	"#define TESS_CONTROL_SHADER\n", "#define TESS_EVALUATION_SHADER\n",
+	"#define FRAGMENT_SHADER\n", "#define COMPUTE_SHADER\n"};
+
+/* Programs handed out by getShader(), owned until clearShaderCache() */
+typedef struct CachedProgram {
+	char* files[NUM_STAGES]; /* NULL for the stages it doesn't have */
+	char* header;
+	unsigned long long hash; /* of the sources, names the binary on disk */
+	GLuint program;
+
+	/* Rebuilding after the files changed */
+	int stale; /* changed since the last rebuild started */
+	GLuint pending, pendingShaders[NUM_STAGES]; /* 0 unless compiling */
+	unsigned long long pendingHash;
+	int failed; /* the last rebuild didn't compile */
+
+	struct CachedProgram* next;
+} CachedProgram;
+
+static CachedProgram* programs = NULL;
+static ShaderOrigin lastOrigin = SHADER_COMPILED;
+
+/* Info logs from shaderError() and programError(), cleared before a rebuild
+ * is checked, and a copy of them from the last rebuild that failed */
+static char infoLogs[4096];
+static char reloadLog[4096];
+
+static int watchFd = -1;
+static int watchStarted = 0;
+static struct {
+	int wd;
+	char dir[256];
+} watched[MAX_WATCHED_DIRS];
+static int numWatched = 0;
+
+/* Keeps a copy of an info log for the OSD, after printing it */
+static void appendLog(const char* name, const char* log)
+{
+	size_t length = strlen(infoLogs);
+	snprintf(infoLogs + length, sizeof(infoLogs) - length, "%s:\n%s", name, log);
+}
+
+/* The last CHECKERROR passed, for the debug callback's messages */
+static int debugOutput = 0;
+static const char* checkFile = "startup";
+static int checkLine = 0;
+
 int oglError(int line, const char* file)
 {
 	GLenum glErr;
@@ -23,6 +93,14 @@ int oglError(int line, const char* file)
 	if (p != NULL) 
 		file = p+1;
 
+	/* debugCallback() reports them, no need to ask */
+	if (debugOutput)
+	{
+		checkFile = file;
+		checkLine = line;
+		return 0;
+	}
+
 	/* Get all opengl errors */
 	while ((glErr = glGetError()) != GL_NO_ERROR)
 	{
@@ -33,6 +111,47 @@ int oglError(int line, const char* file)
 	return retCode;
 }
 
+static const char* debugSeverity(GLenum severity)
+{
+	switch (severity)
+	{
+	case GL_DEBUG_SEVERITY_HIGH: return "error";
+	case GL_DEBUG_SEVERITY_MEDIUM: return "warning";
+	case GL_DEBUG_SEVERITY_LOW: return "note";
+	default: return "notification";
+	}
+}
+
+static void GLAPIENTRY debugCallback(GLenum source, GLenum type, GLuint id, GLenum severity,
+	GLsizei length, const GLchar* message, const void* user)
+{
+	/* Low severity messages are mostly performance hints */
+	if (type == GL_DEBUG_TYPE_ERROR || severity != GL_DEBUG_SEVERITY_LOW)
+		printf("GL %s 0x%x after %s:%i: %s\n", type == GL_DEBUG_TYPE_ERROR ? "error" :
+			debugSeverity(severity), id, checkFile, checkLine, message);
+}
+
+int enableDebugOutput(int synchronous)
+{
+	if (!GLEW_VERSION_4_3 && !GLEW_KHR_debug)
+		return 0;
+
+	/* Everything but notifications, which some drivers send per call */
+	glDebugMessageCallback(debugCallback, NULL);
+	glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, NULL, GL_TRUE);
+	glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION, 0, NULL, GL_FALSE);
+	if (synchronous)
+		glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+	else
+		glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+	glEnable(GL_DEBUG_OUTPUT);
+
+	/* Anything from before is still waiting for glGetError() */
+	oglError(__LINE__, __FILE__);
+	debugOutput = 1;
+	return 1;
+}
+
 int shaderError(GLuint shader, const char* name)
 {
 	int infologLength = 0;
@@ -51,17 +170,35 @@ int shaderError(GLuint shader, const char* name)
 			infoLog = (GLchar *)malloc(infologLength);
 			glGetShaderInfoLog(shader, infologLength, &charsWritten, infoLog);
 			printf("Shader InfoLog (%s):\n%s", name, infoLog);
+			appendLog(name, infoLog);
 			free(infoLog);
 		}
 		else
+		{
 			printf("Shader InfoLog (%s): <no info log>\n", name);
+			appendLog(name, "<no info log>\n");
+		}
 		return 1;
 	}
 	CHECKERROR;
 	return 0;
 }
 
-int programError(GLuint program, const char* vert, const char* frag)
+/* A program's files joined with slashes, for messages */
+static const char* programName(char* const* files)
+{
+	static char name[512];
+	int i;
+
+	name[0] = '\0';
+	for (i = 0; i < NUM_STAGES; ++i)
+		if (files[i])
+			snprintf(name + strlen(name), sizeof(name) - strlen(name), "%s%s",
+				name[0] ? "/" : "", files[i]);
+	return name;
+}
+
+int programError(GLuint program, const char* name)
 {
 	int infologLength = 0;
 	int charsWritten = 0;
@@ -77,11 +214,15 @@ int programError(GLuint program, const char* vert, const char* frag)
 		{
 			infoLog = (GLchar *)malloc(infologLength);
 			glGetProgramInfoLog(program, infologLength, &charsWritten, infoLog);
-			printf("Program InfoLog (%s/%s):\n%s", vert, frag, infoLog);
+			printf("Program InfoLog (%s):\n%s", name, infoLog);
+			appendLog("program", infoLog);
 			free(infoLog);
 		}
 		else
-			printf("Program InfoLog (%s/%s): <no info log>\n", vert, frag);
+		{
+			printf("Program InfoLog (%s): <no info log>\n", name);
+			appendLog("program", "<no info log>\n");
+		}
 		return 1;
 	}
 	CHECKERROR;
@@ -109,68 +250,597 @@ char* readFile(const char* filename)
 	return data;
 }
 
-GLuint createShader(const char* filename, GLenum type)
+/* Starts compiling a shader, without waiting to see if it worked */
+static GLuint startShader(const char* source, int stage, const char* header)
 {
-	char* source;
+	const GLchar* sources[3];
 	GLuint shader;
 
-	/* Read the contents of the source files */
-	source = readFile(filename);
-	if (!source)
-	{
-		printf("Error reading shader %s\n", filename);
-		return 0;
-	}
-	
 	/* Create the shader */
-	shader = glCreateShader(type);
+	shader = glCreateShader(stageTypes[stage]);
 	
-	/* Pass in the source code for the shader */
-	glShaderSource(shader, 1, (const GLchar**)&source, NULL);
-	
-	/* Compile and check each for errors */
+	/* Pass in the source code for the shader, after the header if any and
+	 * the stage's define */
+	sources[0] = header ? header : "";
+	sources[1] = stageDefines[stage];
+	sources[2] = source;
+	glShaderSource(shader, 3, sources, NULL);
 	glCompileShader(shader);
-	if (shaderError(shader, filename))
+	return shader;
+}
+
+GLuint createShader(const char* name, const char* source, int stage, const char* header)
+{
+	GLuint shader;
+
+	/* Compile and check each for errors */
+	shader = startShader(source, stage, header);
+	if (shaderError(shader, name))
 	{
 		glDeleteShader(shader);
 		shader = 0;
 	}
-	
-	free(source);
 	return shader;
 }
 
-GLuint getShader(const char* vertexFile, const char* fragmentFile)
+/* Program binaries are only any good to the same driver that wrote them */
+static int haveBinaries()
 {
-	GLuint vert, frag, program;
+	static int have = -1;
+	GLint formats = 0;
+	if (have < 0)
+	{
+		if (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary)
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		have = formats > 0;
+	}
+	return have;
+}
+
+static int binaryFormatSupported(GLenum format)
+{
+	GLint i, count = 0;
+	GLint* formats;
+	int found = 0;
+
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &count);
+	formats = (GLint*)malloc(sizeof(GLint) * (count > 0 ? count : 1));
+	glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, formats);
+	for (i = 0; i < count; ++i)
+		if ((GLenum)formats[i] == format)
+			found = 1;
+	free(formats);
+	return found;
+}
+
+/* 64 bit FNV-1a, over the header and every stage's source including
+ * terminators */
+static unsigned long long hashSources(const char* header, char* const* sources)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	const char* c;
+	int i;
+
+	for (i = -1; i < NUM_STAGES; ++i)
+	{
+		c = i < 0 ? header : sources[i];
+		if (!c)
+			c = "";
+		do {
+			hash ^= (unsigned char)*c;
+			hash *= 1099511628211ULL;
+		} while (*c++);
+	}
+	return hash;
+}
+
+static void binaryPath(char* path, int size, unsigned long long hash, const char* ext)
+{
+	snprintf(path, size, "%s/%016llx.%s", SHADER_CACHE_DIR, hash, ext);
+}
+
+/* The first lines of a cache file, which must match for it to be used */
+static void driverString(char* str, int size)
+{
+	snprintf(str, size, "%s\n%s\n%s\n%s\n", SHADER_CACHE_MAGIC,
+		(const char*)glGetString(GL_VENDOR),
+		(const char*)glGetString(GL_RENDERER),
+		(const char*)glGetString(GL_VERSION));
+}
+
+/* Returns a linked program from the cache file, or 0 if there isn't a
+ * usable one */
+static GLuint loadBinary(unsigned long long hash)
+{
+	char path[256], expected[1024], found[1024];
+	GLuint program = 0;
+	unsigned int format;
+	int length, success = 0;
+	void* binary;
+	FILE* file;
+
+	binaryPath(path, sizeof(path), hash, "bin");
+	file = fopen(path, "rb");
+	if (!file)
+		return 0;
+
+	driverString(expected, sizeof(expected));
+	memset(found, 0, sizeof(found));
+	if (fread(found, 1, strlen(expected), file) == strlen(expected) &&
+		!strcmp(found, expected) &&
+		fread(&format, sizeof(format), 1, file) == 1 &&
+		fread(&length, sizeof(length), 1, file) == 1 &&
+		length > 0 && binaryFormatSupported(format))
+	{
+		binary = malloc(length);
+		if (fread(binary, 1, length, file) == (size_t)length)
+		{
+			program = glCreateProgram();
+			glProgramBinary(program, format, binary, length);
+			glGetProgramiv(program, GL_LINK_STATUS, &success);
+			if (!success)
+			{
+				glDeleteProgram(program);
+				program = 0;
+			}
+		}
+		free(binary);
+	}
+	fclose(file);
+	return program;
+}
+
+/* Writes the program's binary to the cache. Failing is harmless, the
+ * program is just compiled again next time. */
+static void saveBinary(GLuint program, unsigned long long hash)
+{
+	char path[256], temp[256], driver[1024];
+	unsigned int format;
+	GLenum binaryFormat;
+	GLint length = 0;
+	void* binary;
+	FILE* file;
+	int ok;
+
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+	binary = malloc(length);
+	glGetProgramBinary(program, length, &length, &binaryFormat, binary);
+	format = binaryFormat;
+
+	/* Write a temporary file and move it into place, so another instance
+	 * never reads half a binary */
+	mkdir(SHADER_CACHE_DIR, 0755);
+	binaryPath(path, sizeof(path), hash, "bin");
+	binaryPath(temp, sizeof(temp), hash, "tmp");
+	driverString(driver, sizeof(driver));
+	file = fopen(temp, "wb");
+	if (file)
+	{
+		ok = fwrite(driver, 1, strlen(driver), file) == strlen(driver) &&
+			fwrite(&format, sizeof(format), 1, file) == 1 &&
+			fwrite(&length, sizeof(length), 1, file) == 1 &&
+			fwrite(binary, 1, length, file) == (size_t)length;
+		ok = !fclose(file) && ok;
+		if (!ok || rename(temp, path))
+			remove(temp);
+	}
+	free(binary);
+}
+
+static GLuint linkProgram(char* const* files, char* const* sources, const char* header, int retrievable)
+{
+	GLuint shaders[NUM_STAGES], program;
+	int i, any = 0;
 
-	/* If the error points here, it's before this function is called */
-	CHECKERROR;
-	
 	/* Create the shaders */
-	vert = createShader(vertexFile, GL_VERTEX_SHADER);
-	frag = createShader(fragmentFile, GL_FRAGMENT_SHADER);
-	if (!vert && !frag) 
+	for (i = 0; i < NUM_STAGES; ++i)
+	{
+		shaders[i] = sources[i] ? createShader(files[i], sources[i], i, header) : 0;
+		any = any || shaders[i];
+	}
+	if (!any)
 		return 0;
 
 	/* Create program, attach shaders, link and check for errors */
 	program = glCreateProgram();
-	if (vert) 
-		glAttachShader(program, vert);
-	if (frag) 
-		glAttachShader(program, frag);
+	if (retrievable)
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	for (i = 0; i < NUM_STAGES; ++i)
+		if (shaders[i])
+			glAttachShader(program, shaders[i]);
 	glLinkProgram(program);
-	if (programError(program, vertexFile, fragmentFile))
+	if (programError(program, programName(files)))
 	{
 		glDeleteProgram(program);
 		program = 0;
 	}
 
 	/* Clean up intermediates and return the program */
-	if (vert) 
-		glDeleteShader(vert);
-	if (frag) 
-		glDeleteShader(frag);
-	return program; /* NOTE: use glDeleteProgram to free resources */
+	for (i = 0; i < NUM_STAGES; ++i)
+		if (shaders[i])
+			glDeleteShader(shaders[i]);
+	return program;
+}
+
+static char* copyString(const char* str)
+{
+	char* copy;
+	if (!str)
+		return NULL;
+	copy = (char*)malloc(strlen(str) + 1);
+	strcpy(copy, str);
+	return copy;
+}
+
+static int sameString(const char* a, const char* b)
+{
+	return !strcmp(a ? a : "", b ? b : "");
+}
+
+/* Watches the directory a file is in, editors often replace files rather
+ * than writing them in place */
+static void watchFile(const char* file)
+{
+#ifdef __linux__
+	const char* slash;
+	char dir[256];
+	int i, wd;
+
+	if (!file)
+		return;
+	slash = strrchr(file, '/');
+	if (!watchStarted)
+	{
+		watchFd = inotify_init1(IN_NONBLOCK);
+		watchStarted = 1;
+	}
+	if (watchFd < 0 || numWatched == MAX_WATCHED_DIRS)
+		return;
+
+	if (slash)
+		snprintf(dir, sizeof(dir), "%.*s", (int)(slash - file), file);
+	else
+		snprintf(dir, sizeof(dir), ".");
+	for (i = 0; i < numWatched; ++i)
+		if (!strcmp(watched[i].dir, dir))
+			return;
+	wd = inotify_add_watch(watchFd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+	if (wd < 0)
+		return;
+	watched[numWatched].wd = wd;
+	snprintf(watched[numWatched].dir, sizeof(watched[numWatched].dir), "%s", dir);
+	++numWatched;
+#else
+	(void)file;
+#endif
+}
+
+/* Marks the programs using files that changed as stale */
+static void readChanges()
+{
+#ifdef __linux__
+	union {
+		struct inotify_event event;
+		char bytes[4096];
+	} buffer;
+	const struct inotify_event* event;
+	CachedProgram* cached;
+	char path[512];
+	ssize_t length;
+	char* p;
+	int i, j;
+
+	if (watchFd < 0)
+		return;
+	while ((length = read(watchFd, buffer.bytes, sizeof(buffer.bytes))) > 0)
+	{
+		for (p = buffer.bytes; p < buffer.bytes + length; p += sizeof(struct inotify_event) + event->len)
+		{
+			event = (const struct inotify_event*)p;
+			if (!event->len)
+				continue;
+			for (i = 0; i < numWatched; ++i)
+				if (watched[i].wd == event->wd)
+					break;
+			if (i == numWatched)
+				continue;
+			if (!strcmp(watched[i].dir, "."))
+				snprintf(path, sizeof(path), "%s", event->name);
+			else
+				snprintf(path, sizeof(path), "%s/%s", watched[i].dir, event->name);
+			for (cached = programs; cached; cached = cached->next)
+				for (j = 0; j < NUM_STAGES; ++j)
+					if (cached->files[j] && !strcmp(path, cached->files[j]))
+						cached->stale = 1;
+		}
+	}
+#endif
+}
+
+static CachedProgram* findProgram(char* const* files, const char* header)
+{
+	CachedProgram* cached;
+	int i;
+
+	for (cached = programs; cached; cached = cached->next)
+	{
+		for (i = 0; i < NUM_STAGES; ++i)
+			if (!sameString(cached->files[i], files[i]))
+				break;
+		if (i == NUM_STAGES && sameString(cached->header, header))
+			return cached;
+	}
+	return NULL;
+}
+
+/* Finds the program in the memory cache (if useMemory), the disk cache (if
+ * useBinary) or compiles it */
+static GLuint loadProgram(char* const* files, const char* header, int useMemory, int useBinary)
+{
+	char* sources[NUM_STAGES];
+	unsigned long long hash;
+	CachedProgram* cached;
+	GLuint program = 0;
+	int i, any = 0;
+
+	/* If the error points here, it's before this function is called */
+	CHECKERROR;
+
+	if (useMemory && (cached = findProgram(files, header)))
+	{
+		lastOrigin = SHADER_FROM_MEMORY;
+		return cached->program;
+	}
+
+	/* Read the contents of the source files */
+	for (i = 0; i < NUM_STAGES; ++i)
+	{
+		sources[i] = files[i] ? readFile(files[i]) : NULL;
+		if (files[i] && !sources[i])
+			printf("Error reading shader %s\n", files[i]);
+		any = any || sources[i];
+	}
+	if (!any)
+		return 0;
+
+	hash = hashSources(header, sources);
+	useBinary = useBinary && haveBinaries();
+
+	if (useBinary)
+	{
+		program = loadBinary(hash);
+		lastOrigin = SHADER_FROM_DISK;
+	}
+	if (!program)
+	{
+		program = linkProgram(files, sources, header, useBinary);
+		lastOrigin = SHADER_COMPILED;
+		if (program && useBinary)
+			saveBinary(program, hash);
+	}
+	if (program && useMemory)
+	{
+		cached = (CachedProgram*)malloc(sizeof(CachedProgram));
+		memset(cached, 0, sizeof(CachedProgram));
+		for (i = 0; i < NUM_STAGES; ++i)
+		{
+			cached->files[i] = copyString(files[i]);
+			watchFile(files[i]);
+		}
+		cached->header = copyString(header);
+		cached->hash = hash;
+		cached->program = program;
+		cached->next = programs;
+		programs = cached;
+	}
+
+	for (i = 0; i < NUM_STAGES; ++i)
+		free(sources[i]);
+	return program;
+}
+
+static int haveParallelCompile()
+{
+	static int have = -1;
+	if (have < 0)
+	{
+		have = GLEW_KHR_parallel_shader_compile;
+		if (have)
+			glMaxShaderCompilerThreadsKHR(0xFFFFFFFF); /* as many as the driver likes */
+	}
+	return have;
+}
+
+/* Starts compiling the changed sources of a program, leaving the old one
+ * in place until the new one links */
+static void startRebuild(CachedProgram* cached)
+{
+	char* sources[NUM_STAGES];
+	unsigned long long hash;
+	int i, missing = 0;
+
+	/* An editor may be half way through replacing a file, try again next
+	 * time if one is not there */
+	for (i = 0; i < NUM_STAGES; ++i)
+	{
+		sources[i] = cached->files[i] ? readFile(cached->files[i]) : NULL;
+		missing = missing || (cached->files[i] && !sources[i]);
+	}
+	if (!missing)
+	{
+		cached->stale = 0;
+		hash = hashSources(cached->header, sources);
+		if (hash != cached->hash || cached->failed)
+		{
+			haveParallelCompile();
+			cached->pending = glCreateProgram();
+			if (haveBinaries())
+				glProgramParameteri(cached->pending, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+			for (i = 0; i < NUM_STAGES; ++i)
+			{
+				cached->pendingShaders[i] = sources[i] ? startShader(sources[i], i, cached->header) : 0;
+				if (cached->pendingShaders[i])
+					glAttachShader(cached->pending, cached->pendingShaders[i]);
+			}
+			glLinkProgram(cached->pending);
+			cached->pendingHash = hash;
+		}
+	}
+	for (i = 0; i < NUM_STAGES; ++i)
+		free(sources[i]);
 }
 
+/* Swaps in a rebuilt program once it has linked. Returns 1 if it did. */
+static int finishRebuild(CachedProgram* cached)
+{
+	GLint done = GL_TRUE;
+	int i, failed = 0;
+
+	/* Without the extension asking would wait for the compile */
+	if (haveParallelCompile())
+		glGetProgramiv(cached->pending, GL_COMPLETION_STATUS_KHR, &done);
+	if (!done)
+		return 0;
+
+	infoLogs[0] = '\0';
+	for (i = 0; i < NUM_STAGES; ++i)
+		if (cached->pendingShaders[i])
+			failed = shaderError(cached->pendingShaders[i], cached->files[i]) || failed;
+	failed = failed || programError(cached->pending, programName(cached->files));
+	for (i = 0; i < NUM_STAGES; ++i)
+		glDeleteShader(cached->pendingShaders[i]);
+
+	if (failed)
+	{
+		printf("Keeping the old %s\n", programName(cached->files));
+		snprintf(reloadLog, sizeof(reloadLog), "%s", infoLogs);
+		glDeleteProgram(cached->pending);
+	}
+	else
+	{
+		glDeleteProgram(cached->program);
+		cached->program = cached->pending;
+		cached->hash = cached->pendingHash;
+		if (haveBinaries())
+			saveBinary(cached->program, cached->hash);
+	}
+	cached->failed = failed;
+	cached->pending = 0;
+	memset(cached->pendingShaders, 0, sizeof(cached->pendingShaders));
+	return !failed;
+}
+
+/* A program from the files for each stage, NULL for those it hasn't got */
+static GLuint loadFiles(const char* vertexFile, const char* controlFile, const char* evaluationFile,
+	const char* fragmentFile, const char* computeFile, const char* header, int useMemory, int useBinary)
+{
+	char* files[NUM_STAGES];
+
+	files[STAGE_VERTEX] = (char*)vertexFile;
+	files[STAGE_TESS_CONTROL] = (char*)controlFile;
+	files[STAGE_TESS_EVALUATION] = (char*)evaluationFile;
+	files[STAGE_FRAGMENT] = (char*)fragmentFile;
+	files[STAGE_COMPUTE] = (char*)computeFile;
+	return loadProgram(files, header, useMemory, useBinary);
+}
+
+GLuint getShader(const char* vertexFile, const char* fragmentFile)
+{
+	return getShaderWithHeader(vertexFile, fragmentFile, NULL);
+}
+
+GLuint getShaderWithHeader(const char* vertexFile, const char* fragmentFile, const char* header)
+{
+	return loadFiles(vertexFile, NULL, NULL, fragmentFile, NULL, header, 1, 1);
+}
+
+GLuint getTessellationShader(const char* vertexFile, const char* controlFile,
+	const char* evaluationFile, const char* fragmentFile, const char* header)
+{
+	return loadFiles(vertexFile, controlFile, evaluationFile, fragmentFile, NULL, header, 1, 1);
+}
+
+GLuint getComputeShader(const char* computeFile, const char* header)
+{
+	return loadFiles(NULL, NULL, NULL, NULL, computeFile, header, 1, 1);
+}
+
+GLuint compileShader(const char* vertexFile, const char* fragmentFile, const char* header, int useBinary)
+{
+	return loadFiles(vertexFile, NULL, NULL, fragmentFile, NULL, header, 0, useBinary);
+}
+
+int updateShaders()
+{
+	CachedProgram* cached;
+	int swapped = 0;
+
+	readChanges();
+	for (cached = programs; cached; cached = cached->next)
+	{
+		if (cached->pending)
+			swapped += finishRebuild(cached);
+		if (!cached->pending && cached->stale)
+			startRebuild(cached);
+	}
+	if (swapped)
+		printf("Reloaded %d shader programs\n", swapped);
+	return swapped;
+}
+
+const char* shaderReloadLog()
+{
+	CachedProgram* cached;
+	for (cached = programs; cached; cached = cached->next)
+		if (cached->failed)
+			return reloadLog;
+	return NULL;
+}
+
+ShaderOrigin lastShaderOrigin()
+{
+	return lastOrigin;
+}
+
+const char* shaderOriginName(ShaderOrigin origin)
+{
+	static const char* names[] = {"compiled", "binary", "cached"};
+	return names[origin];
+}
+
+int shaderBinariesSupported()
+{
+	return haveBinaries();
+}
+
+void clearShaderCache()
+{
+	CachedProgram* cached;
+	int i;
+	while (programs)
+	{
+		cached = programs;
+		programs = cached->next;
+		if (cached->pending)
+		{
+			for (i = 0; i < NUM_STAGES; ++i)
+				glDeleteShader(cached->pendingShaders[i]);
+			glDeleteProgram(cached->pending);
+		}
+		glDeleteProgram(cached->program);
+		for (i = 0; i < NUM_STAGES; ++i)
+			free(cached->files[i]);
+		free(cached->header);
+		free(cached);
+	}
+
+#ifdef __linux__
+	if (watchFd >= 0)
+		close(watchFd);
+#endif
+	watchFd = -1;
+	watchStarted = 0;
+	numWatched = 0;
+}
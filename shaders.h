@@ -3,9 +3,80 @@
 #ifndef SHADERS_H
 #define SHADERS_H
 
+/* Checks for GL errors here. With debug output on (enableDebugOutput()) the
+ * driver reports errors to a callback as they happen, so this only notes the
+ * place for its messages, without a glGetError() round trip; otherwise it
+ * polls glGetError(). Release builds (NDEBUG) compile it out. */
+#ifdef NDEBUG
+#define CHECKERROR ((void)0)
+#else
 #define CHECKERROR oglError(__LINE__, __FILE__)
+#endif
+
+/* Where linked program binaries are kept between runs */
+#define SHADER_CACHE_DIR ".shader-cache"
+
+/* How the last program was found */
+typedef enum {
+	SHADER_COMPILED,    /* from source */
+	SHADER_FROM_DISK,   /* from a binary in SHADER_CACHE_DIR */
+	SHADER_FROM_MEMORY  /* already loaded by this process */
+} ShaderOrigin;
 
 int oglError(int line, const char* file);
+
+/* Reports GL errors and warnings through a KHR_debug (GL 4.3) callback,
+ * with the last CHECKERROR passed as the location. Asynchronous unless
+ * synchronous is set, then the callback runs inside the failing call (and
+ * under a debugger its stack shows the caller). Returns 0 if the driver
+ * hasn't got debug output, CHECKERROR then keeps polling. */
+int enableDebugOutput(int synchronous);
+
+/* Programs are cached: asking again for the same files and header returns
+ * the same program. Where the driver supports program binaries the linked
+ * program is saved to SHADER_CACHE_DIR under a hash of the header and
+ * sources, and loaded from there next run. A missing, stale or rejected
+ * binary just means compiling from source. The cache owns the programs, see
+ * clearShaderCache(). */
 GLuint getShader(const char* vertexFile, const char* fragmentFile);
 
+/* As getShader(), with header (e.g. "#version 130\n#define FOO\n") placed
+ * before the source of both shaders */
+GLuint getShaderWithHeader(const char* vertexFile, const char* fragmentFile, const char* header);
+
+/* As getShaderWithHeader(), with tessellation control and evaluation
+ * shaders (GL 4.0) between the two. Each shader is compiled with its stage
+ * defined after the header (VERTEX_SHADER, TESS_CONTROL_SHADER,
+ * TESS_EVALUATION_SHADER, FRAGMENT_SHADER or COMPUTE_SHADER), so one file
+ * can be more than one stage. */
+GLuint getTessellationShader(const char* vertexFile, const char* controlFile,
+	const char* evaluationFile, const char* fragmentFile, const char* header);
+
+/* A compute program (GL 4.3) from one file, cached and reloaded like the
+ * others. The header must give the #version. */
+GLuint getComputeShader(const char* computeFile, const char* header);
+
+/* As getShaderWithHeader(), skipping the in-process cache and the disk cache
+ * too unless useBinary. For timing startup. NOTE: use glDeleteProgram to
+ * free the result. */
+GLuint compileShader(const char* vertexFile, const char* fragmentFile, const char* header, int useBinary);
+
+/* Call once a frame. Rebuilds programs whose files changed (watched with
+ * inotify on Linux) in the background where the driver can, and swaps each
+ * one in once it links, so its handle changes: returns the number swapped,
+ * ask getShader() again for the new handles when it isn't 0. A program that
+ * fails to build keeps the old one. */
+int updateShaders();
+
+/* The info logs from the last failed rebuild, or NULL if every program
+ * built */
+const char* shaderReloadLog();
+
+ShaderOrigin lastShaderOrigin();
+const char* shaderOriginName(ShaderOrigin origin);
+int shaderBinariesSupported();
+
+/* Deletes every program getShader() returned */
+void clearShaderCache();
+
 #endif
@@ -0,0 +1,615 @@
+/* tests.c */
+
+/* Checks of the code that doesn't need a GL context, built and run by
+ * `make test`. Prints each failed check and exits non-zero if any did. */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <GL/glew.h>
+
+#include "clustered-lights.h"
+#include "frame-pacer.h"
+#include "geometry-cache.h"
+#include "gpu-culling.h"
+#include "objects-simd.h"
+#include "scene-uniforms.h"
+#include "timer.h"
+#include "triple-buffer.h"
+#include "vertex-cache.h"
+#include "workers.h"
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+static int checks = 0;
+static int failures = 0;
+
+static void check(int passed, const char *condition, const char *file, int line)
+{
+	++checks;
+	if (passed)
+		return;
+	printf("%s:%d: failed: %s\n", file, line, condition);
+	++failures;
+}
+
+/* Every vector level the CPU has against the scalar reference */
+static void test_simd_kernels()
+{
+	SimdLevel level;
+	float error;
+
+	for (level = SIMD_SSE2; level <= simdSupported(); ++level)
+	{
+		error = simdCheck(level);
+		if (error > SIMD_TOLERANCE)
+			printf("SIMD %s: max error vs scalar %g\n", simdLevelName(level), error);
+		CHECK(error <= SIMD_TOLERANCE);
+	}
+}
+
+static void nap()
+{
+	struct timespec t = {0, 100000};
+	nanosleep(&t, NULL);
+}
+
+static volatile int job_started, job_release;
+
+/* Holds the pool until released */
+static void hold_pool(void *data, int begin, int end)
+{
+	(void)data;
+	(void)begin;
+	(void)end;
+	job_started = 1;
+	while (!job_release)
+		nap();
+}
+
+static void *hold_pool_thread(void *arg)
+{
+	(void)arg;
+	parallelFor(hold_pool, NULL, 64);
+	return NULL;
+}
+
+static void count_range(void *data, int begin, int end)
+{
+	__sync_fetch_and_add((int *)data, end - begin);
+}
+
+/* parallelForNoWait() runs its range itself while another thread's job has
+ * the pool, rather than wait for it as parallelFor() does */
+static void test_workers()
+{
+	pthread_t thread;
+	int covered = 0;
+
+	setWorkerThreads(4); /* a pool even on one CPU */
+	parallelFor(count_range, &covered, 1000);
+	CHECK(covered == 1000);
+
+	job_started = job_release = 0;
+	pthread_create(&thread, NULL, hold_pool_thread, NULL);
+	while (!job_started)
+		nap();
+	covered = 0;
+	parallelForNoWait(count_range, &covered, 1000);
+	CHECK(covered == 1000);
+	CHECK(!job_release); /* still held, so it didn't wait */
+	job_release = 1;
+	pthread_join(thread, NULL);
+
+	covered = 0;
+	parallelForNoWait(count_range, &covered, 1000);
+	CHECK(covered == 1000);
+	shutdownWorkers();
+}
+
+/* The tests are linked with --wrap=freeObject, so Objects the cache frees
+ * come here instead of freeObject(), which deletes their GL buffers */
+static int objects_freed = 0;
+
+void __wrap_freeObject(Object *obj)
+{
+	++objects_freed;
+	free(obj);
+}
+
+static Object *fake_object(int vertices)
+{
+	Object *obj = (Object *)calloc(1, sizeof(Object));
+	obj->format = VERTEX_FLOAT;
+	obj->numVertices = vertices;
+	return obj;
+}
+
+static MeshRequest torus_request(int x)
+{
+	MeshRequest request;
+	memset(&request, 0, sizeof request);
+	request.batch = batchTorusScalar;
+	request.args.torus.R = 1.0f;
+	request.args.torus.r = 0.5f;
+	request.x = request.y = x;
+	request.format = VERTEX_FLOAT;
+	return request;
+}
+
+/* Least recently used first out, except the Object in use */
+static void test_geometry_cache()
+{
+	const size_t bytes = sizeof(vertex_t) * 100;
+	MeshRequest a = torus_request(9), b = torus_request(17), c = torus_request(33);
+	Object *obj_a = fake_object(100), *obj_b = fake_object(100), *obj_c = fake_object(100);
+	Object *replacement;
+	GeometryCacheStats stats;
+
+	objects_freed = 0;
+	setGeometryCacheBudget(bytes * 2);
+	CHECK(findGeometry(&a) == NULL);
+	cacheGeometry(&a, obj_a);
+	cacheGeometry(&b, obj_b);
+	CHECK(findGeometry(&a) == obj_a); /* b is the least recently used now */
+	cacheGeometry(&c, obj_c);
+	trimGeometryCache(obj_c);
+	CHECK(findGeometry(&b) == NULL);
+	CHECK(findGeometry(&a) == obj_a);
+	CHECK(findGeometry(&c) == obj_c);
+	CHECK(objects_freed == 1);
+	geometryCacheStats(&stats);
+	CHECK(stats.count == 2);
+	CHECK(stats.bytes == bytes * 2);
+	CHECK(stats.evictions == 1);
+	CHECK(stats.hits == 3);
+	CHECK(stats.misses == 2);
+
+	/* Over budget, everything but the Object in use goes */
+	setGeometryCacheBudget(0);
+	trimGeometryCache(obj_a);
+	CHECK(findGeometry(&c) == NULL);
+	CHECK(findGeometry(&a) == obj_a);
+	CHECK(objects_freed == 2);
+
+	/* A new Object for the same request replaces and frees the old one */
+	replacement = fake_object(50);
+	cacheGeometry(&a, replacement);
+	CHECK(findGeometry(&a) == replacement);
+	CHECK(objects_freed == 3);
+	geometryCacheStats(&stats);
+	CHECK(stats.bytes == sizeof(vertex_t) * 50);
+
+	clearGeometryCache();
+	CHECK(objects_freed == 4);
+	geometryCacheStats(&stats);
+	CHECK(stats.count == 0);
+	CHECK(stats.bytes == 0);
+	setGeometryCacheBudget(256 << 20);
+}
+
+static int near(float a, float b, float tolerance)
+{
+	return fabsf(a - b) <= tolerance;
+}
+
+/* The normal matrix transposed times the matrix is the identity, and for a
+ * rotation it is the rotation */
+static void test_normal_matrix()
+{
+	float m[16], n[16], product;
+	int i, j, k, inverse = 1, same = 1;
+
+	loadIdentity(m);
+	m[0] = 2.0f;
+	m[5] = 0.5f;
+	m[10] = 3.0f;
+	rotate(m, 30.0f, 1.0f, 2.0f, 3.0f);
+	translate(m, 4.0f, 5.0f, 6.0f);
+	normalMatrix(n, m);
+	for (i = 0; i < 3; ++i)
+	{
+		for (j = 0; j < 3; ++j)
+		{
+			product = 0.0f;
+			for (k = 0; k < 3; ++k)
+				product += n[i * 4 + k] * m[j * 4 + k];
+			inverse &= near(product, i == j ? 1.0f : 0.0f, 1e-5f);
+		}
+	}
+	CHECK(inverse);
+	CHECK(n[3] == 0.0f && n[7] == 0.0f && n[11] == 0.0f);
+	CHECK(n[12] == 0.0f && n[13] == 0.0f && n[14] == 0.0f && n[15] == 1.0f);
+
+	loadIdentity(m);
+	rotate(m, 75.0f, -1.0f, 0.5f, 2.0f);
+	normalMatrix(n, m);
+	for (i = 0; i < 11; ++i)
+		same &= near(n[i], m[i], 1e-5f);
+	CHECK(same);
+}
+
+static int has_light(int x, int y, int z, unsigned int light)
+{
+	const unsigned int *lights;
+	int i, count = clusterLights(x, y, z, &lights);
+	for (i = 0; i < count; ++i)
+		if (lights[i] == light)
+			return 1;
+	return 0;
+}
+
+/* Lights land in the clusters around them; those behind the camera or past
+ * the far plane don't count */
+static void test_cluster_binning()
+{
+	static const PointLight lights[] = {
+		{{0.0f, 0.0f, -10.0f}, 1.0f, {1.0f, 1.0f, 1.0f}, 0.0f}, /* ahead */
+		{{0.0f, 0.0f, 10.0f}, 1.0f, {1.0f, 1.0f, 1.0f}, 0.0f}, /* behind */
+		{{0.0f, 0.0f, -200.0f}, 1.0f, {1.0f, 1.0f, 1.0f}, 0.0f}, /* too far */
+		{{0.0f, 0.0f, 0.0f}, 2.0f, {1.0f, 1.0f, 1.0f}, 0.0f}, /* around the camera */
+	};
+	SceneUniforms scene;
+	ClusterStats stats;
+	const unsigned int *found;
+	int x, y, z, near_slice, ahead, indices = 0, everywhere = 1;
+
+	memset(&scene, 0, sizeof scene);
+	loadIdentity(scene.modelView);
+	loadIdentity(scene.projection);
+	perspective(scene.projection, 60.0f, 16.0f / 9.0f, 1.0f, 100.0f);
+	binClusteredLights(lights, 4, 1280, 720, 1.0f, 100.0f, &scene);
+
+	clusteredLightStats(&stats);
+	CHECK(stats.lights == 2);
+	CHECK(scene.clusterCount[3] == 2);
+	CHECK(scene.clusterParams[0] == 80.0f);
+	CHECK(scene.clusterParams[1] == 80.0f);
+
+	/* The first light is in the cluster at the middle of the screen at its
+	 * depth, but not in a corner or nearer slices */
+	ahead = (int)floorf(logf(10.0f) * scene.clusterParams[2] + scene.clusterParams[3]);
+	near_slice = (int)floorf(logf(8.0f) * scene.clusterParams[2] + scene.clusterParams[3]);
+	CHECK(has_light(8, 4, ahead, 0));
+	CHECK(!has_light(0, 0, ahead, 0));
+	CHECK(!has_light(8, 4, near_slice, 0));
+
+	/* The one around the camera is in every tile of the nearest slices */
+	for (y = 0; y < CLUSTER_TILES_Y; ++y)
+		for (x = 0; x < CLUSTER_TILES_X; ++x)
+			everywhere &= has_light(x, y, 0, 1);
+	CHECK(everywhere);
+	CHECK(!has_light(8, 4, ahead, 1));
+
+	for (z = 0; z < CLUSTER_SLICES; ++z)
+		for (y = 0; y < CLUSTER_TILES_Y; ++y)
+			for (x = 0; x < CLUSTER_TILES_X; ++x)
+				indices += clusterLights(x, y, z, &found);
+	CHECK(indices == stats.indices);
+	CHECK(stats.maxPerCluster == 1);
+
+	binClusteredLights(lights, 0, 1280, 720, 1.0f, 100.0f, &scene);
+	clusteredLightStats(&stats);
+	CHECK(stats.lights == 0);
+	CHECK(stats.indices == 0);
+}
+
+/* The signed distances of an eye space point from the frustum planes */
+static void plane_distances(float planes[6][4], float x, float y, float z, float *distances)
+{
+	int p;
+	for (p = 0; p < 6; ++p)
+		distances[p] = planes[p][0] * x + planes[p][1] * y + planes[p][2] * z + planes[p][3];
+}
+
+static int inside(float planes[6][4], float x, float y, float z)
+{
+	float distances[6];
+	int p;
+
+	plane_distances(planes, x, y, z, distances);
+	for (p = 0; p < 6; ++p)
+		if (distances[p] < 0.0f)
+			return 0;
+	return 1;
+}
+
+/* Points in a perspective() frustum are in front of every plane, the
+ * distances are in eye space units, and the sides pass through the edges of
+ * the view */
+static void test_frustum_planes()
+{
+	float projection[16], planes[6][4], distances[6];
+	float edge = 10.0f * tanf(30.0f * 3.14159265f / 180.0f);
+
+	loadIdentity(projection);
+	perspective(projection, 60.0f, 2.0f, 1.0f, 100.0f);
+	frustumPlanes(projection, planes);
+
+	CHECK(inside(planes, 0.0f, 0.0f, -10.0f));
+	CHECK(inside(planes, 1.9f * edge, 0.9f * edge, -10.0f));
+	CHECK(!inside(planes, 0.0f, 0.0f, -0.5f));
+	CHECK(!inside(planes, 0.0f, 0.0f, -150.0f));
+	CHECK(!inside(planes, 0.0f, 0.0f, 10.0f));
+	CHECK(!inside(planes, -2.1f * edge, 0.0f, -10.0f));
+	CHECK(!inside(planes, 2.1f * edge, 0.0f, -10.0f));
+	CHECK(!inside(planes, 0.0f, -1.1f * edge, -10.0f));
+	CHECK(!inside(planes, 0.0f, 1.1f * edge, -10.0f));
+
+	plane_distances(planes, 0.0f, 0.0f, -10.0f, distances);
+	CHECK(near(distances[4], 9.0f, 1e-3f));
+	CHECK(near(distances[5], 90.0f, 1e-2f));
+	plane_distances(planes, 2.0f * edge, edge, -10.0f, distances);
+	CHECK(near(distances[1], 0.0f, 1e-4f));
+	CHECK(near(distances[3], 0.0f, 1e-4f));
+}
+
+/* Rotates each triangle to start at its lowest index, keeping the winding,
+ * and sorts them, so lists of the same triangles compare equal */
+static int compare_triangles(const void *a, const void *b)
+{
+	return memcmp(a, b, sizeof(unsigned int) * 3);
+}
+
+static void canonical_triangles(unsigned int *indices, int num_indices)
+{
+	unsigned int *t, first;
+	int i;
+
+	for (i = 0; i < num_indices; i += 3)
+	{
+		t = indices + i;
+		while (t[0] > t[1] || t[0] > t[2])
+		{
+			first = t[0];
+			t[0] = t[1];
+			t[1] = t[2];
+			t[2] = first;
+		}
+	}
+	qsort(indices, num_indices / 3, sizeof(unsigned int) * 3, compare_triangles);
+}
+
+/* The cache simulation on orders with known misses, then Tipsify and the
+ * fetch reorder keeping the triangles while cutting the grid's misses */
+static void test_vertex_cache()
+{
+	static const unsigned int pair[] = {0, 1, 2, 2, 1, 3};
+	static const unsigned int cycle[] = {0, 1, 2, 3, 4, 5, 0, 1, 2};
+	const int x = 33, y = 33, num_indices = gridTriangleIndices(x, y), num_vertices = x * y;
+	unsigned int *rows, *tiled, *optimized, *before, *remap;
+	VertexCacheStats stats, row_stats, tiled_stats;
+	int i, used = 0, permutation = 1, in_order = 1;
+	char *seen;
+
+	vertexCacheStats(pair, 6, 4, 2, VERTEX_CACHE_SIZE, &stats);
+	CHECK(stats.transforms == 4);
+	CHECK(stats.triangles == 2);
+	CHECK(stats.acmr == 2.0f);
+	CHECK(stats.atvr == 1.0f);
+	vertexCacheStats(cycle, 9, 6, 3, 3, &stats); /* FIFO of 3: 0, 1, 2 are gone */
+	CHECK(stats.transforms == 9);
+	vertexCacheStats(cycle, 9, 6, 3, 6, &stats);
+	CHECK(stats.transforms == 6);
+
+	rows = (unsigned int *)malloc(sizeof(unsigned int) * num_indices);
+	tiled = (unsigned int *)malloc(sizeof(unsigned int) * num_indices);
+	optimized = (unsigned int *)malloc(sizeof(unsigned int) * num_indices);
+	before = (unsigned int *)malloc(sizeof(unsigned int) * num_indices);
+	remap = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
+	seen = (char *)calloc(num_vertices, 1);
+
+	/* A cache big enough for the whole grid tiles it as one block, row by row */
+	tileGridTriangles(rows, x, y, 4 * num_vertices);
+	tileGridTriangles(tiled, x, y, VERTEX_CACHE_SIZE);
+	vertexCacheStats(rows, num_indices, num_vertices, num_indices / 3, VERTEX_CACHE_SIZE, &row_stats);
+	vertexCacheStats(tiled, num_indices, num_vertices, num_indices / 3, VERTEX_CACHE_SIZE, &tiled_stats);
+	CHECK(row_stats.triangles == (x - 1) * (y - 1) * 2);
+	CHECK(row_stats.acmr > 1.0f); /* two rows don't fit */
+	CHECK(tiled_stats.acmr < 0.6f);
+
+	/* Tipsify finds about as good an order from rows, and keeps the tiled
+	 * one about as good (the tiles are near ideal for a grid already) */
+	memcpy(optimized, rows, sizeof(unsigned int) * num_indices);
+	optimizeVertexCache(optimized, num_indices, num_vertices, VERTEX_CACHE_SIZE);
+	vertexCacheStats(optimized, num_indices, num_vertices, num_indices / 3, VERTEX_CACHE_SIZE, &stats);
+	CHECK(stats.acmr < 0.6f);
+	memcpy(optimized, tiled, sizeof(unsigned int) * num_indices);
+	optimizeVertexCache(optimized, num_indices, num_vertices, VERTEX_CACHE_SIZE);
+	vertexCacheStats(optimized, num_indices, num_vertices, num_indices / 3, VERTEX_CACHE_SIZE, &stats);
+	CHECK(stats.acmr >= 0.5f);
+	CHECK(stats.acmr < tiled_stats.acmr * 1.02f);
+	CHECK(stats.atvr >= 1.0f);
+
+	/* Still the same triangles, same way round */
+	memcpy(before, optimized, sizeof(unsigned int) * num_indices);
+	canonical_triangles(before, num_indices);
+	canonical_triangles(rows, num_indices);
+	CHECK(memcmp(before, rows, sizeof(unsigned int) * num_indices) == 0);
+
+	/* The fetch order numbers vertices by first use, through a permutation */
+	memcpy(before, optimized, sizeof(unsigned int) * num_indices);
+	optimizeVertexFetch(optimized, num_indices, num_vertices, remap);
+	for (i = 0; i < num_vertices; ++i)
+	{
+		permutation &= remap[i] < (unsigned int)num_vertices && !seen[remap[i]];
+		if (remap[i] < (unsigned int)num_vertices)
+			seen[remap[i]] = 1;
+	}
+	CHECK(permutation);
+	for (i = 0; i < num_indices; ++i)
+	{
+		in_order &= optimized[i] == remap[before[i]];
+		if ((int)optimized[i] == used)
+			++used;
+		else
+			in_order &= (int)optimized[i] < used;
+	}
+	CHECK(in_order);
+	CHECK(used == num_vertices);
+
+	free(rows);
+	free(tiled);
+	free(optimized);
+	free(before);
+	free(remap);
+	free(seen);
+}
+
+static void busy_for(double seconds)
+{
+	double end = getTime() + seconds;
+	while (getTime() < end)
+		;
+}
+
+/* Frames end on the budget, and adaptive pacing moves to two budgets while
+ * the work, on this thread or another, takes longer than one. The timing
+ * bounds are loose for a loaded machine. */
+static void test_frame_pacer()
+{
+	const double budget = 0.005;
+	FramePacer pacer;
+	double start;
+	int i;
+
+	initFramePacer(&pacer, budget, 0);
+	start = pacer.frameStart;
+	for (i = 0; i < 20; ++i)
+		paceFrame(&pacer);
+	CHECK(getTime() - start >= 20 * budget);
+	CHECK(getTime() - start < 20 * budget * 1.5);
+	CHECK(pacer.multiple == 1);
+
+	initFramePacer(&pacer, budget, 1);
+	busy_for(budget * 1.6);
+	paceFrame(&pacer);
+	CHECK(pacer.cost >= budget * 1.6);
+	CHECK(pacer.multiple == 2);
+
+	/* Only the other thread is slow */
+	initFramePacer(&pacer, budget, 1);
+	pacer.otherCost = budget * 1.6;
+	for (i = 0; i < 10; ++i)
+		paceFrame(&pacer);
+	CHECK(pacer.multiple == 2);
+
+	/* And back, once the smoothed cost is well under one budget */
+	pacer.otherCost = 0.0;
+	for (i = 0; i < 30; ++i)
+		paceFrame(&pacer);
+	CHECK(pacer.multiple == 1);
+
+	initFramePacer(&pacer, budget, 0);
+	pacer.otherCost = budget * 1.6;
+	paceFrame(&pacer);
+	CHECK(pacer.multiple == 1);
+
+	initFramePacer(&pacer, 0.0, 1);
+	start = getTime();
+	paceFrame(&pacer);
+	CHECK(pacer.waited == 0.0);
+	CHECK(getTime() - start < budget);
+}
+
+#define SNAPSHOT_WORDS 64
+#define SNAPSHOTS 100000
+
+typedef struct {
+	int words[SNAPSHOT_WORDS]; /* every one the snapshot's number */
+} Snapshot;
+
+static void write_snapshot(TripleBuffer *tb, int number)
+{
+	Snapshot *snapshot = (Snapshot *)tripleBufferBack(tb);
+	int i;
+	for (i = 0; i < SNAPSHOT_WORDS; ++i)
+		snapshot->words[i] = number;
+	publishTripleBuffer(tb);
+}
+
+static void *produce_snapshots(void *arg)
+{
+	int number;
+	for (number = 1; number <= SNAPSHOTS; ++number)
+		write_snapshot((TripleBuffer *)arg, number);
+	return NULL;
+}
+
+/* The consumer gets the newest snapshot, whole, and only once; across two
+ * threads it never sees one half written or an older one after a newer */
+static void test_triple_buffer()
+{
+	TripleBuffer tb;
+	const Snapshot *snapshot;
+	pthread_t thread;
+	int fresh, i, last = 0, whole = 1, newer = 1, stale = 1;
+
+	CHECK(initTripleBuffer(&tb, sizeof(Snapshot)) == 0);
+	snapshot = (const Snapshot *)readTripleBuffer(&tb, &fresh);
+	CHECK(!fresh);
+	CHECK(snapshot->words[0] == 0);
+
+	write_snapshot(&tb, 1);
+	snapshot = (const Snapshot *)readTripleBuffer(&tb, &fresh);
+	CHECK(fresh);
+	CHECK(snapshot->words[0] == 1);
+	snapshot = (const Snapshot *)readTripleBuffer(&tb, &fresh);
+	CHECK(!fresh);
+	CHECK(snapshot->words[0] == 1);
+
+	write_snapshot(&tb, 2);
+	write_snapshot(&tb, 3);
+	CHECK(tripleBufferBack(&tb) != (void *)snapshot);
+	snapshot = (const Snapshot *)readTripleBuffer(&tb, &fresh);
+	CHECK(fresh);
+	CHECK(snapshot->words[0] == 3);
+	CHECK(tripleBufferBack(&tb) != (void *)snapshot);
+	freeTripleBuffer(&tb);
+
+	initTripleBuffer(&tb, sizeof(Snapshot));
+	pthread_create(&thread, NULL, produce_snapshots, &tb);
+	while (last < SNAPSHOTS)
+	{
+		snapshot = (const Snapshot *)readTripleBuffer(&tb, &fresh);
+		for (i = 1; i < SNAPSHOT_WORDS; ++i)
+			whole &= snapshot->words[i] == snapshot->words[0];
+		if (fresh)
+			newer &= snapshot->words[0] > last;
+		else
+			stale &= snapshot->words[0] == last;
+		last = snapshot->words[0];
+	}
+	pthread_join(thread, NULL);
+	CHECK(whole);
+	CHECK(newer);
+	CHECK(stale);
+	freeTripleBuffer(&tb);
+}
+
+int main()
+{
+	test_simd_kernels();
+	test_workers();
+	test_geometry_cache();
+	test_normal_matrix();
+	test_cluster_binning();
+	test_frustum_planes();
+	test_vertex_cache();
+	test_frame_pacer();
+	test_triple_buffer();
+
+	if (failures)
+	{
+		printf("%d of %d checks failed\n", failures, checks);
+		return EXIT_FAILURE;
+	}
+	printf("All %d checks passed\n", checks);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,222 @@
+/* text.c */
+
+#include <GL/glew.h>
+#include <GL/glut.h>
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "text.h"
+
+#define FIRST_GLYPH 32 /* space */
+#define LAST_GLYPH 126 /* tilde */
+#define GLYPH_WIDTH 9 /* GLUT_BITMAP_9_BY_15's advance */
+#define GLYPH_DESCENT 5 /* room below the baseline in a TEXT_HEIGHT tall cell */
+#define ATLAS_COLUMNS 16
+#define ATLAS_ROWS ((LAST_GLYPH - FIRST_GLYPH + ATLAS_COLUMNS) / ATLAS_COLUMNS)
+#define ATLAS_WIDTH (ATLAS_COLUMNS * GLYPH_WIDTH)
+#define ATLAS_HEIGHT (ATLAS_ROWS * TEXT_HEIGHT)
+
+typedef struct {
+	float x, y; /* pixels from the bottom left */
+	float s, t;
+} TextVertex;
+
+static GLuint atlas = 0;
+
+/* Bottom left of character c's cell in the atlas */
+static int cellX(int c)
+{
+	return (c - FIRST_GLYPH) % ATLAS_COLUMNS * GLYPH_WIDTH;
+}
+
+static int cellY(int c)
+{
+	return (c - FIRST_GLYPH) / ATLAS_COLUMNS * TEXT_HEIGHT;
+}
+
+/* Pixel coordinates, y up, for the screen */
+static void pushOrtho(int width, int height)
+{
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	glOrtho(0, width, 0, height, -1, 1);
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+}
+
+static void popOrtho()
+{
+	glPopMatrix();
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+}
+
+int initText()
+{
+	GLint viewport[4];
+	unsigned char* coverage;
+	int c;
+
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	if (viewport[2] < ATLAS_WIDTH || viewport[3] < ATLAS_HEIGHT)
+		return 0;
+
+	/* Every glyph white on black in the corner of the back buffer, one per
+	 * cell, with the raster path the atlas replaces */
+	glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_CURRENT_BIT);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_LIGHTING);
+	glClearColor(0, 0, 0, 0);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glColor3f(1, 1, 1);
+	pushOrtho(viewport[2], viewport[3]);
+	for (c = FIRST_GLYPH; c <= LAST_GLYPH; ++c)
+	{
+		glRasterPos2i(cellX(c), cellY(c) + GLYPH_DESCENT);
+		glutBitmapCharacter(GLUT_BITMAP_9_BY_15, c);
+	}
+	popOrtho();
+
+	coverage = (unsigned char*)malloc(ATLAS_WIDTH * ATLAS_HEIGHT);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, ATLAS_WIDTH, ATLAS_HEIGHT, GL_RED, GL_UNSIGNED_BYTE, coverage);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glPopAttrib();
+
+	/* Only the coverage is kept, drawText() colours it */
+	glGenTextures(1, &atlas);
+	glBindTexture(GL_TEXTURE_2D, atlas);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA8, ATLAS_WIDTH, ATLAS_HEIGHT, 0, GL_ALPHA,
+			GL_UNSIGNED_BYTE, coverage);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	free(coverage);
+	return 1;
+}
+
+void setText(TextLayout* layout, const char* text, int x, int y, int screenWidth, int screenHeight)
+{
+	const size_t length = strlen(text);
+	TextVertex* vertices;
+	TextVertex* v;
+	const char* p;
+	float penX, baseline;
+	float s0, t0, s1, t1;
+	int c;
+
+	if (!atlas)
+		return;
+	if (layout->text && !strcmp(layout->text, text) && layout->x == x && layout->y == y &&
+			layout->screenWidth == screenWidth && layout->screenHeight == screenHeight)
+		return;
+
+	free(layout->text);
+	layout->text = (char*)malloc(length + 1);
+	memcpy(layout->text, text, length + 1);
+	layout->x = x;
+	layout->y = y;
+	layout->screenWidth = screenWidth;
+	layout->screenHeight = screenHeight;
+
+	/* A quad per visible character, baselines TEXT_HEIGHT apart from the
+	 * first line's at y + TEXT_HEIGHT down from the top */
+	vertices = (TextVertex*)malloc(sizeof(TextVertex) * 4 * (length + 1));
+	v = vertices;
+	penX = x;
+	baseline = screenHeight - y - TEXT_HEIGHT;
+	for (p = text; *p; ++p)
+	{
+		c = (unsigned char)*p;
+		if (c == '\n')
+		{
+			penX = x;
+			baseline -= TEXT_HEIGHT;
+			continue;
+		}
+		if (c > FIRST_GLYPH && c <= LAST_GLYPH)
+		{
+			s0 = cellX(c) / (float)ATLAS_WIDTH;
+			t0 = cellY(c) / (float)ATLAS_HEIGHT;
+			s1 = s0 + GLYPH_WIDTH / (float)ATLAS_WIDTH;
+			t1 = t0 + TEXT_HEIGHT / (float)ATLAS_HEIGHT;
+			v[0].x = v[3].x = penX;
+			v[1].x = v[2].x = penX + GLYPH_WIDTH;
+			v[0].y = v[1].y = baseline - GLYPH_DESCENT;
+			v[2].y = v[3].y = baseline - GLYPH_DESCENT + TEXT_HEIGHT;
+			v[0].s = v[3].s = s0;
+			v[1].s = v[2].s = s1;
+			v[0].t = v[1].t = t0;
+			v[2].t = v[3].t = t1;
+			v += 4;
+		}
+		penX += GLYPH_WIDTH;
+	}
+	layout->vertices = v - vertices;
+
+	if (!layout->buffer)
+		glGenBuffers(1, &layout->buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, layout->buffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(TextVertex) * layout->vertices, vertices, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	free(vertices);
+}
+
+void drawText(const TextLayout* layout)
+{
+	if (!atlas || !layout->vertices)
+		return;
+
+	/* Whatever the scene left on, e.g. wireframe */
+	glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_TEXTURE_BIT | GL_POLYGON_BIT);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_LIGHTING);
+	glDisable(GL_CULL_FACE);
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glActiveTexture(GL_TEXTURE0);
+	glEnable(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, atlas);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+	pushOrtho(layout->screenWidth, layout->screenHeight);
+
+	glBindBuffer(GL_ARRAY_BUFFER, layout->buffer);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glVertexPointer(2, GL_FLOAT, sizeof(TextVertex), (void*)0);
+	glTexCoordPointer(2, GL_FLOAT, sizeof(TextVertex), (void*)offsetof(TextVertex, s));
+	glDrawArrays(GL_QUADS, 0, layout->vertices);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	popOrtho();
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glPopAttrib();
+}
+
+void freeTextLayout(TextLayout* layout)
+{
+	if (layout->buffer)
+		glDeleteBuffers(1, &layout->buffer);
+	free(layout->text);
+	memset(layout, 0, sizeof(*layout));
+}
+
+void freeText()
+{
+	if (atlas)
+		glDeleteTextures(1, &atlas);
+	atlas = 0;
+}
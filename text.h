@@ -0,0 +1,36 @@
+/* text.h */
+
+#ifndef TEXT_H
+#define TEXT_H
+
+#define TEXT_HEIGHT 20 /* pixels between lines */
+
+/* Screen text from a glyph atlas. initText() renders the printable ASCII
+ * characters of GLUT's 9x15 bitmap font once, with glutBitmapCharacter(),
+ * into an alpha texture. A TextLayout turns a string into textured quads in
+ * a vertex buffer, again only when the string, position or screen size
+ * changes, and drawText() draws them all with one call in the current
+ * colour.
+
+USAGE:
+initText(); once glut and GL are up
+static TextLayout layout;
+setText(&layout, "FR: 60\nmore", x, y, screenWidth, screenHeight); every frame, cheap if unchanged
+drawText(&layout);
+freeTextLayout(&layout); freeText(); at exit
+*/
+typedef struct {
+	GLuint buffer;
+	int vertices;
+	char* text; /* what buffer holds, NULL until laid out */
+	int x, y; /* top left, in pixels from the top left of the screen */
+	int screenWidth, screenHeight;
+} TextLayout;
+
+int initText(); /* returns 0 if the atlas couldn't be made, drawText() then does nothing */
+void setText(TextLayout* layout, const char* text, int x, int y, int screenWidth, int screenHeight);
+void drawText(const TextLayout* layout);
+void freeTextLayout(TextLayout* layout);
+void freeText();
+
+#endif
@@ -0,0 +1,10 @@
+/* timer.h */
+
+#ifndef TIMER_H
+#define TIMER_H
+
+/* Monotonic wall clock in seconds, with (at least) microsecond resolution.
+ * Only differences between two calls are meaningful. */
+double getTime();
+
+#endif
@@ -0,0 +1,57 @@
+/* triple-buffer.c */
+
+#include <stdlib.h>
+
+#include "triple-buffer.h"
+
+#define FRESH 4 /* in middle, above the slot index */
+
+int initTripleBuffer(TripleBuffer* tb, size_t size)
+{
+	int i;
+
+	for (i = 0; i < 3; ++i)
+		tb->slots[i] = (char*)calloc(1, size);
+	tb->back = 0;
+	tb->middle = 1;
+	tb->front = 2;
+	if (!tb->slots[0] || !tb->slots[1] || !tb->slots[2])
+	{
+		freeTripleBuffer(tb);
+		return -1;
+	}
+	return 0;
+}
+
+void* tripleBufferBack(TripleBuffer* tb)
+{
+	return tb->slots[tb->back];
+}
+
+void publishTripleBuffer(TripleBuffer* tb)
+{
+	/* Releases the writes to back to the consumer. A middle it never read
+	 * comes back to be written over. */
+	tb->back = __atomic_exchange_n(&tb->middle, tb->back | FRESH, __ATOMIC_ACQ_REL) & ~FRESH;
+}
+
+void* readTripleBuffer(TripleBuffer* tb, int* fresh)
+{
+	/* Only the consumer clears FRESH, so once seen the exchange gets a
+	 * published slot, the one seen or a newer one */
+	*fresh = (__atomic_load_n(&tb->middle, __ATOMIC_RELAXED) & FRESH) != 0;
+	if (*fresh)
+		tb->front = __atomic_exchange_n(&tb->middle, tb->front, __ATOMIC_ACQ_REL) & ~FRESH;
+	return tb->slots[tb->front];
+}
+
+void freeTripleBuffer(TripleBuffer* tb)
+{
+	int i;
+
+	for (i = 0; i < 3; ++i)
+	{
+		free(tb->slots[i]);
+		tb->slots[i] = NULL;
+	}
+}
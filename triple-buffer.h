@@ -0,0 +1,36 @@
+/* triple-buffer.h */
+
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <stddef.h>
+
+/* Hands the latest of a stream of fixed size values, e.g. a frame's state,
+ * from one producer thread to one consumer thread without locks. Each side
+ * owns a slot and the third sits between them: publishing swaps the
+ * producer's slot with it, reading swaps it with the consumer's if it is
+ * newer. Neither side ever waits, and a slot is never written while it is
+ * read. Values the consumer doesn't get to in time are skipped, it always
+ * reads the newest.
+
+USAGE:
+TripleBuffer tb;
+initTripleBuffer(&tb, sizeof(State));
+producer: State* s = tripleBufferBack(&tb); ... publishTripleBuffer(&tb);
+consumer: s = readTripleBuffer(&tb, &fresh); fresh is 0 if s was read before
+freeTripleBuffer(&tb);
+*/
+typedef struct {
+	char* slots[3];
+	int back; /* the producer's */
+	int front; /* the consumer's */
+	int middle; /* the other, plus a flag while it is newer than front */
+} TripleBuffer;
+
+int initTripleBuffer(TripleBuffer* tb, size_t size); /* zeroed, returns 0 on success */
+void* tripleBufferBack(TripleBuffer* tb);
+void publishTripleBuffer(TripleBuffer* tb);
+void* readTripleBuffer(TripleBuffer* tb, int* fresh);
+void freeTripleBuffer(TripleBuffer* tb);
+
+#endif
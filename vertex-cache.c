@@ -0,0 +1,196 @@
+/* vertex-cache.c */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vertex-cache.h"
+
+int gridTriangleIndices(int x, int y)
+{
+	return (x-1) * (y-1) * 6;
+}
+
+void tileGridTriangles(unsigned int* indices, int x, int y, int cacheSize)
+{
+	/* A block's row shares its first vertices with the row before, so both
+	 * have to fit: 2 * (width + 1) vertices */
+	const int width = cacheSize / 2 - 1 > 0 ? cacheSize / 2 - 1 : 1;
+	unsigned int* out = indices;
+	int i, j, j0, j1;
+#define INDEX(I, J) ((I)*y + (J))
+
+	for (j0 = 0; j0 < y-1; j0 = j1)
+	{
+		j1 = j0 + width < y-1 ? j0 + width : y-1;
+		for (i = 0; i < x-1; ++i)
+		{
+			for (j = j0; j < j1; ++j)
+			{
+				/* The two triangles a strip makes of the cell, in its order */
+				*out++ = INDEX(i, j);
+				*out++ = INDEX(i, j+1);
+				*out++ = INDEX(i+1, j);
+				*out++ = INDEX(i+1, j);
+				*out++ = INDEX(i, j+1);
+				*out++ = INDEX(i+1, j+1);
+			}
+		}
+	}
+	assert(out == indices + gridTriangleIndices(x, y));
+#undef INDEX
+}
+
+/* The vertex to fan around next when the last fan's vertices are all used
+ * up: the most recent one on the dead end stack still with triangles left,
+ * or failing that the next in index order. -1 once every triangle is out. */
+static int skipDeadEnd(const int* live, const int* deadEnd, int* top, int* cursor, int numVertices)
+{
+	int v;
+
+	while (*top > 0)
+	{
+		v = deadEnd[--*top];
+		if (live[v] > 0)
+			return v;
+	}
+	for (; *cursor < numVertices; ++*cursor)
+		if (live[*cursor] > 0)
+			return *cursor;
+	return -1;
+}
+
+void optimizeVertexCache(unsigned int* indices, int numIndices, int numVertices, int cacheSize)
+{
+	const int numTriangles = numIndices / 3;
+	int* live; /* triangles still to emit, per vertex */
+	int* offsets; /* vertex v's triangles are adjacency[offsets[v]] up to offsets[v+1] */
+	int* adjacency;
+	int* stamps; /* when each vertex last went into the cache */
+	int* deadEnd; /* vertices of emitted triangles, most recent on top */
+	char* emitted;
+	unsigned int* output;
+	int time = cacheSize + 1; /* counts cache insertions */
+	int cursor = 0, top = 0, out = 0;
+	int fan, start, best, priority, bestPriority;
+	int t, v, k, c;
+
+	live = (int*)calloc(numVertices, sizeof(int));
+	offsets = (int*)calloc(numVertices + 1, sizeof(int));
+	adjacency = (int*)malloc(sizeof(int) * numIndices);
+	stamps = (int*)calloc(numVertices, sizeof(int));
+	deadEnd = (int*)malloc(sizeof(int) * numIndices);
+	emitted = (char*)calloc(numTriangles, 1);
+	output = (unsigned int*)malloc(sizeof(unsigned int) * numIndices);
+
+	/* Triangles around each vertex */
+	for (k = 0; k < numIndices; ++k)
+		++live[indices[k]];
+	for (v = 0; v < numVertices; ++v)
+		offsets[v+1] = offsets[v] + live[v];
+	for (k = 0; k < numIndices; ++k)
+		adjacency[offsets[indices[k]]++] = k / 3;
+	for (v = numVertices; v > 0; --v)
+		offsets[v] = offsets[v-1];
+	offsets[0] = 0;
+
+	fan = skipDeadEnd(live, deadEnd, &top, &cursor, numVertices);
+	while (fan >= 0)
+	{
+		/* Every triangle left around the fan vertex */
+		start = top;
+		for (k = offsets[fan]; k < offsets[fan+1]; ++k)
+		{
+			t = adjacency[k];
+			if (emitted[t])
+				continue;
+			for (c = 0; c < 3; ++c)
+			{
+				v = indices[t * 3 + c];
+				output[out++] = v;
+				deadEnd[top++] = v;
+				--live[v];
+				if (time - stamps[v] > cacheSize)
+					stamps[v] = time++;
+			}
+			emitted[t] = 1;
+		}
+
+		/* Next, the vertex just used that has been in the cache longest but
+		 * will still be there after its remaining triangles go out */
+		best = -1;
+		bestPriority = -1;
+		for (k = start; k < top; ++k)
+		{
+			v = deadEnd[k];
+			if (live[v] <= 0)
+				continue;
+			priority = 0;
+			if (time - stamps[v] + 2 * live[v] <= cacheSize)
+				priority = time - stamps[v];
+			if (priority > bestPriority)
+			{
+				bestPriority = priority;
+				best = v;
+			}
+		}
+		fan = best >= 0 ? best : skipDeadEnd(live, deadEnd, &top, &cursor, numVertices);
+	}
+	assert(out == numTriangles * 3);
+	memcpy(indices, output, sizeof(unsigned int) * out);
+
+	free(live);
+	free(offsets);
+	free(adjacency);
+	free(stamps);
+	free(deadEnd);
+	free(emitted);
+	free(output);
+}
+
+void optimizeVertexFetch(unsigned int* indices, int numIndices, int numVertices, unsigned int* remap)
+{
+	unsigned int next = 0;
+	int k, v;
+
+	for (v = 0; v < numVertices; ++v)
+		remap[v] = VERTEX_CACHE_RESTART;
+	for (k = 0; k < numIndices; ++k)
+	{
+		if (remap[indices[k]] == VERTEX_CACHE_RESTART)
+			remap[indices[k]] = next++;
+		indices[k] = remap[indices[k]];
+	}
+
+	/* Any unused vertices go at the end */
+	for (v = 0; v < numVertices; ++v)
+		if (remap[v] == VERTEX_CACHE_RESTART)
+			remap[v] = next++;
+}
+
+void vertexCacheStats(const unsigned int* indices, int numIndices, int numVertices, int numTriangles,
+		int cacheSize, VertexCacheStats* stats)
+{
+	int* stamps = (int*)calloc(numVertices, sizeof(int));
+	int time = cacheSize + 1;
+	int k;
+	unsigned int v;
+
+	stats->transforms = 0;
+	for (k = 0; k < numIndices; ++k)
+	{
+		v = indices[k];
+		if (v == VERTEX_CACHE_RESTART)
+			continue;
+		if (time - stamps[v] > cacheSize)
+		{
+			stamps[v] = time++;
+			++stats->transforms;
+		}
+	}
+	free(stamps);
+
+	stats->triangles = numTriangles;
+	stats->acmr = numTriangles ? (float)stats->transforms / numTriangles : 0.0f;
+	stats->atvr = numVertices ? (float)stats->transforms / numVertices : 0.0f;
+}
@@ -0,0 +1,61 @@
+/* vertex-cache.h */
+
+#ifndef VERTEX_CACHE_H
+#define VERTEX_CACHE_H
+
+/* Triangle orders for the GPU's post-transform vertex cache, which keeps the
+ * last few transformed vertices so a triangle reusing them doesn't run the
+ * vertex shader again. Grid meshes come as triangle strips a whole row long,
+ * far longer than the cache, so every vertex is transformed about twice
+ * (once for the strip either side of it). These build indexed triangle lists
+ * that revisit vertices while they are still cached.
+
+USAGE:
+indices = malloc(sizeof(unsigned int) * gridTriangleIndices(x, y));
+tileGridTriangles(indices, x, y, VERTEX_CACHE_SIZE);
+optimizeVertexCache(indices, gridTriangleIndices(x, y), x * y, VERTEX_CACHE_SIZE);
+optimizeVertexFetch(indices, gridTriangleIndices(x, y), x * y, remap);
+...and put vertex i at remap[i] in the vertex buffer
+vertexCacheStats(indices, gridTriangleIndices(x, y), x * y, gridTriangleIndices(x, y) / 3,
+		VERTEX_CACHE_SIZE, &stats);
+*/
+#define VERTEX_CACHE_SIZE 32 /* vertices, the FIFO the orders are tuned and measured for */
+#define VERTEX_CACHE_RESTART 0xFFFFFFFFu /* skipped by vertexCacheStats() */
+
+typedef struct {
+	float acmr; /* average cache miss ratio: transformed vertices per triangle, 0.5 at best */
+	float atvr; /* average transform to vertex ratio: transforms per vertex, 1 at best */
+	int transforms; /* vertex shader runs for one draw */
+	int triangles;
+} VertexCacheStats;
+
+/* Indices in a triangle list of the (x-1) by (y-1) cells of an x by y grid */
+int gridTriangleIndices(int x, int y);
+
+/* Fills indices with the cells of an x by y grid (vertex (i, j) at i*y + j,
+ * see fillIndexStrips() in objects.c, with the same winding) as a triangle
+ * list in blocks narrow enough that two of their rows of vertices fit in a
+ * cache of cacheSize. The blocks are emitted one after another, like
+ * meshlets. */
+void tileGridTriangles(unsigned int* indices, int x, int y, int cacheSize);
+
+/* Reorders a triangle list in place for a FIFO cache of cacheSize (Sander,
+ * Nehab and Barczak's Tipsify: fans around recently used vertices, jumping
+ * to the most recent dead end when it runs out). Linear in the number of
+ * triangles. */
+void optimizeVertexCache(unsigned int* indices, int numIndices, int numVertices, int cacheSize);
+
+/* Renumbers the vertices in the order the triangles first use them, and
+ * sets remap[old] = new so the vertex buffer can be put in the same order.
+ * Neighbouring triangles then read nearby vertices, and the indices a
+ * cache sees are close together rather than a grid row apart (which some
+ * direct mapped caches, e.g. Mesa's, alias). */
+void optimizeVertexFetch(unsigned int* indices, int numIndices, int numVertices, unsigned int* remap);
+
+/* Simulates a FIFO cache of cacheSize over indices. Strips (joined by
+ * degenerates or VERTEX_CACHE_RESTART) work too, given how many real
+ * triangles they hold; for a list pass numIndices / 3. */
+void vertexCacheStats(const unsigned int* indices, int numIndices, int numVertices, int numTriangles,
+		int cacheSize, VertexCacheStats* stats);
+
+#endif
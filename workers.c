@@ -0,0 +1,194 @@
+/* workers.c */
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "workers.h"
+
+/* Ranges handed out per thread, so uneven rows still balance */
+#define CHUNKS_PER_THREAD 4
+
+static pthread_mutex_t callerLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t startCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t doneCond = PTHREAD_COND_INITIALIZER;
+
+static pthread_t* workers = NULL;
+static int numWorkers = -1; /* not counting the caller, -1 until started */
+static int quitFlag = 0;
+
+/* The current job */
+static WorkerFunc jobFunc;
+static void* jobData;
+static int jobCount;
+static int jobGrain;
+static int jobNext;          /* next unclaimed index, atomic */
+static int jobActive;        /* workers yet to finish, under lock */
+static unsigned jobGeneration; /* bumped for every job, under lock */
+
+static void runChunks()
+{
+	int begin, end;
+	while ((begin = __sync_fetch_and_add(&jobNext, jobGrain)) < jobCount)
+	{
+		end = begin + jobGrain;
+		if (end > jobCount)
+			end = jobCount;
+		jobFunc(jobData, begin, end);
+	}
+}
+
+static void* workerMain(void* arg)
+{
+	unsigned seen = 0;
+
+	(void)arg;
+	for (;;)
+	{
+		pthread_mutex_lock(&lock);
+		while (!quitFlag && jobGeneration == seen)
+			pthread_cond_wait(&startCond, &lock);
+		if (quitFlag)
+		{
+			pthread_mutex_unlock(&lock);
+			return NULL;
+		}
+		seen = jobGeneration;
+		pthread_mutex_unlock(&lock);
+
+		runChunks();
+
+		pthread_mutex_lock(&lock);
+		if (--jobActive == 0)
+			pthread_cond_signal(&doneCond);
+		pthread_mutex_unlock(&lock);
+	}
+}
+
+static void startWorkers(int threads)
+{
+	int i;
+
+	if (threads <= 0)
+		threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads < 1)
+		threads = 1;
+
+	quitFlag = 0;
+	numWorkers = threads - 1;
+	workers = numWorkers ? (pthread_t*)malloc(sizeof(pthread_t) * numWorkers) : NULL;
+	for (i = 0; i < numWorkers; ++i)
+	{
+		if (pthread_create(&workers[i], NULL, workerMain, NULL))
+		{
+			printf("Error starting worker thread, using %d\n", i + 1);
+			numWorkers = i;
+			break;
+		}
+	}
+}
+
+static void stopWorkers()
+{
+	int i;
+
+	pthread_mutex_lock(&lock);
+	quitFlag = 1;
+	pthread_cond_broadcast(&startCond);
+	pthread_mutex_unlock(&lock);
+	for (i = 0; i < numWorkers; ++i)
+		pthread_join(workers[i], NULL);
+	free(workers);
+	workers = NULL;
+	numWorkers = -1;
+}
+
+/* Runs a job on the pool, with callerLock held */
+static void runJob(WorkerFunc func, void* data, int count)
+{
+	if (numWorkers < 0)
+		startWorkers(0);
+
+	if (numWorkers == 0 || count == 1)
+	{
+		func(data, 0, count);
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	jobFunc = func;
+	jobData = data;
+	jobCount = count;
+	jobGrain = count / ((numWorkers + 1) * CHUNKS_PER_THREAD);
+	if (jobGrain < 1)
+		jobGrain = 1;
+	jobNext = 0;
+	jobActive = numWorkers;
+	++jobGeneration;
+	pthread_cond_broadcast(&startCond);
+	pthread_mutex_unlock(&lock);
+
+	/* Help out, then wait for every worker to leave the job */
+	runChunks();
+	pthread_mutex_lock(&lock);
+	while (jobActive > 0)
+		pthread_cond_wait(&doneCond, &lock);
+	pthread_mutex_unlock(&lock);
+}
+
+void parallelFor(WorkerFunc func, void* data, int count)
+{
+	if (count <= 0)
+		return;
+
+	pthread_mutex_lock(&callerLock);
+	runJob(func, data, count);
+	pthread_mutex_unlock(&callerLock);
+}
+
+void parallelForNoWait(WorkerFunc func, void* data, int count)
+{
+	if (count <= 0)
+		return;
+
+	if (pthread_mutex_trylock(&callerLock))
+	{
+		/* Another thread's job has the pool */
+		func(data, 0, count);
+		return;
+	}
+	runJob(func, data, count);
+	pthread_mutex_unlock(&callerLock);
+}
+
+void setWorkerThreads(int threads)
+{
+	pthread_mutex_lock(&callerLock);
+	if (numWorkers >= 0)
+		stopWorkers();
+	startWorkers(threads);
+	pthread_mutex_unlock(&callerLock);
+}
+
+int workerThreads()
+{
+	int threads;
+	pthread_mutex_lock(&callerLock);
+	if (numWorkers < 0)
+		startWorkers(0);
+	threads = numWorkers + 1;
+	pthread_mutex_unlock(&callerLock);
+	return threads;
+}
+
+void shutdownWorkers()
+{
+	pthread_mutex_lock(&callerLock);
+	if (numWorkers >= 0)
+		stopWorkers();
+	pthread_mutex_unlock(&callerLock);
+}
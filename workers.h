@@ -0,0 +1,28 @@
+/* workers.h */
+
+#ifndef WORKERS_H
+#define WORKERS_H
+
+/* A persistent pool of worker threads for data parallel loops */
+
+typedef void (*WorkerFunc)(void* data, int begin, int end);
+
+/*
+USAGE:
+parallelFor(func, data, count);
+calls func(data, begin, end) on disjoint ranges covering [0, count), spread
+over the pool and the calling thread, and returns once all are done. Calls
+from different threads are run one after another.
+*/
+void parallelFor(WorkerFunc func, void* data, int count);
+
+/* The same, except that if another thread's job has the pool it runs the
+ * whole range on the calling thread rather than wait. For the GL thread,
+ * which mustn't stall behind a background mesh build. */
+void parallelForNoWait(WorkerFunc func, void* data, int count);
+
+void setWorkerThreads(int threads); /* total including the caller, 0 = one per CPU */
+int workerThreads();
+void shutdownWorkers();
+
+#endif